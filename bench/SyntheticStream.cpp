@@ -0,0 +1,170 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "SyntheticStream.hpp"
+#include "PacketCapture.hpp"
+#include "PacketDescriptions.hpp"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+
+namespace {
+
+const int avioBufferSize = 32 * 1024;
+
+struct Output {
+  capture::Writer& writer;
+  std::uint32_t type;
+};
+
+#if LIBAVFORMAT_VERSION_MAJOR >= 61
+int writeCallback(void* opaque, const std::uint8_t* buffer, int size) {
+#else
+int writeCallback(void* opaque, std::uint8_t* buffer, int size) {
+#endif
+  auto& output = *static_cast<Output*>(opaque);
+  output.writer.write(output.type, buffer, size);
+  return size;
+}
+
+/// Fill the frame with a pattern that moves every frame (so that every
+/// frame has to be coded) and has enough detail to cost a realistic amount
+/// to decode.
+void fillTestPattern(AVFrame* frame, int index) {
+  for (int y = 0; y < frame->height; ++y) {
+    auto* row = frame->data[0] + y * frame->linesize[0];
+    for (int x = 0; x < frame->width; ++x) {
+      row[x] = static_cast<std::uint8_t>((x + 4 * index) ^ (y * 3 - index) ^ ((x * y) >> 7));
+    }
+  }
+  for (int y = 0; y < (frame->height + 1) / 2; ++y) {
+    auto* u = frame->data[1] + y * frame->linesize[1];
+    auto* v = frame->data[2] + y * frame->linesize[2];
+    for (int x = 0; x < (frame->width + 1) / 2; ++x) {
+      u[x] = static_cast<std::uint8_t>(128 + y + index);
+      v[x] = static_cast<std::uint8_t>(64 + x - index);
+    }
+  }
+}
+
+/// Owns the FFmpeg objects used for encoding.
+struct Encoder {
+  AVFormatContext* format = nullptr;
+  AVCodecContext* codec = nullptr;
+  AVStream* stream = nullptr;
+  AVIOContext* io = nullptr;
+  AVFrame* frame = nullptr;
+  AVPacket* packet = nullptr;
+
+  ~Encoder() {
+    av_packet_free(&packet);
+    av_frame_free(&frame);
+    avcodec_free_context(&codec);
+    if (io != nullptr) {
+      av_freep(&io->buffer);
+      avio_context_free(&io);
+    }
+    avformat_free_context(format);
+  }
+
+  /// Write all packets the encoder has ready.
+  void drain() {
+    while (avcodec_receive_packet(codec, packet) == 0) {
+      av_packet_rescale_ts(packet, codec->time_base, stream->time_base);
+      packet->stream_index = stream->index;
+      if (av_interleaved_write_frame(format, packet) < 0) {
+        throw std::runtime_error("Could not mux synthetic video.");
+      }
+    }
+  }
+};
+
+const AVCodec* findEncoder(const std::string& name) {
+  if (!name.empty()) {
+    return avcodec_find_encoder_by_name(name.c_str());
+  }
+  const AVCodec* codec = avcodec_find_encoder(AV_CODEC_ID_H264);
+  return codec ? codec : avcodec_find_encoder(AV_CODEC_ID_MPEG4);
+}
+
+} // end anonymous namespace
+
+void writeSyntheticCapture(const std::string& fileName, const SyntheticStreamOptions& options) {
+  const auto& types = packets::packetTypes;
+  const auto type = std::find(types.begin(), types.end(), "render_preview") - types.begin();
+  capture::Writer writer(fileName, types);
+  Output output{writer, std::uint32_t(type)};
+
+  const AVCodec* codec = findEncoder(options.encoder);
+  if (codec == nullptr) {
+    throw std::runtime_error("No video encoder available: '" + options.encoder + "'");
+  }
+
+  Encoder e;
+  if (avformat_alloc_output_context2(&e.format, nullptr, options.container.c_str(), nullptr) < 0) {
+    throw std::runtime_error("Unknown container format: '" + options.container + "'");
+  }
+
+  e.codec = avcodec_alloc_context3(codec);
+  e.codec->width = options.width;
+  e.codec->height = options.height;
+  e.codec->pix_fmt = AV_PIX_FMT_YUV420P;
+  e.codec->time_base = AVRational{1, options.frameRate};
+  e.codec->framerate = AVRational{options.frameRate, 1};
+  e.codec->bit_rate = static_cast<std::int64_t>(options.bitRateMbps * 1e6);
+  // Same structure as a live preview: regular key-frames, no reordering:
+  e.codec->gop_size = options.frameRate;
+  e.codec->max_b_frames = 0;
+  if (e.format->oformat->flags & AVFMT_GLOBALHEADER) {
+    e.codec->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+  if (avcodec_open2(e.codec, codec, nullptr) < 0) {
+    throw std::runtime_error(std::string("Could not open video encoder: ") + codec->name);
+  }
+
+  e.stream = avformat_new_stream(e.format, nullptr);
+  avcodec_parameters_from_context(e.stream->codecpar, e.codec);
+  e.stream->time_base = e.codec->time_base;
+
+  auto ioBuffer = static_cast<std::uint8_t*>(av_malloc(avioBufferSize));
+  e.io = avio_alloc_context(ioBuffer, avioBufferSize, 1, &output, nullptr, &writeCallback, nullptr);
+  e.format->pb = e.io;
+  e.format->flags |= AVFMT_FLAG_CUSTOM_IO | AVFMT_FLAG_FLUSH_PACKETS;
+  if (avformat_write_header(e.format, nullptr) < 0) {
+    throw std::runtime_error("Could not write synthetic video header.");
+  }
+
+  e.frame = av_frame_alloc();
+  e.frame->format = AV_PIX_FMT_YUV420P;
+  e.frame->width = options.width;
+  e.frame->height = options.height;
+  e.packet = av_packet_alloc();
+  if (av_frame_get_buffer(e.frame, 0) < 0) {
+    throw std::runtime_error("Could not allocate synthetic video frame.");
+  }
+
+  for (int i = 0; i < options.frames; ++i) {
+    av_frame_make_writable(e.frame);
+    fillTestPattern(e.frame, i);
+    e.frame->pts = i;
+    if (avcodec_send_frame(e.codec, e.frame) < 0) {
+      throw std::runtime_error("Could not encode synthetic video.");
+    }
+    e.drain();
+  }
+  avcodec_send_frame(e.codec, nullptr);
+  e.drain();
+  av_write_trailer(e.format);
+  avio_flush(e.io);
+
+  BOOST_LOG_TRIVIAL(debug) << "Encoded " << options.frames << " synthetic " << options.width << "x"
+                           << options.height << " frames with " << codec->name << " into "
+                           << writer.recordCount() << " packets.";
+}
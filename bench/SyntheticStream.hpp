@@ -0,0 +1,24 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <string>
+
+/// Parameters of a synthetic preview stream.
+struct SyntheticStreamOptions {
+  int width = 1280;
+  int height = 720;
+  int frames = 300;
+  int frameRate = 30;
+  double bitRateMbps = 8.0;
+  /// FFmpeg encoder name (empty for the default H.264 encoder).
+  std::string encoder;
+  /// FFmpeg container format the stream is muxed into.
+  std::string container = "mpegts";
+};
+
+/// Encode a moving test pattern and write it to a capture file as
+/// 'render_preview' packets (one or more per frame as the server sends
+/// them) so that it can be replayed with CaptureReplayServer.
+/// Throws a std::runtime_error if the stream can not be encoded.
+void writeSyntheticCapture(const std::string& fileName, const SyntheticStreamOptions& options);
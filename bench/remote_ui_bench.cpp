@@ -0,0 +1,334 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+// Headless benchmark of the preview video pipeline: packets are replayed
+// over a loopback connection to a real VideoClient and each decoded frame
+// is extracted exactly as VideoPreviewWindow does it, but without a GUI.
+
+#include <PacketComms.h>
+#include <PacketSerialisation.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include <boost/log/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/trivial.hpp>
+#include <boost/program_options.hpp>
+
+#include "BufferPool.hpp"
+#include "CaptureReplayServer.hpp"
+#include "ConnectionManager.hpp"
+#include "DecodedVideoFrame.hpp"
+#include "FrameStats.hpp"
+#include "SyntheticStream.hpp"
+#include "VideoClient.hpp"
+
+// Count every C++ heap allocation (on all threads) so the steady state
+// cost per frame can be reported. Buffers mapped by the BufferPool
+// are added separately. FFmpeg's own av_malloc() calls are not included.
+namespace {
+std::atomic<std::uint64_t> allocationCount(0);
+}
+
+void* operator new(std::size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+struct Resolution {
+  int width;
+  int height;
+};
+
+struct BenchConfig {
+  std::string captureFile;
+  std::string label;
+  int threads;
+  int port;
+};
+
+struct BenchResult {
+  std::size_t frames = 0;
+  double seconds = 0.0;
+  std::uint64_t droppedPackets = 0;
+  double allocationsPerFrame = 0.0;
+  double peakRssMiB = 0.0;
+  FrameStats::Summary queue;
+  FrameStats::Summary decode;
+  FrameStats::Summary convert;
+  FrameStats::Summary total;
+};
+
+double peakRssMiB() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+  return usage.ru_maxrss / (1024.0 * 1024.0); // Bytes.
+#else
+  return usage.ru_maxrss / 1024.0; // KiB.
+#endif
+}
+
+std::vector<Resolution> parseResolutions(const std::string& list) {
+  std::vector<Resolution> result;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    Resolution r;
+    char x;
+    std::stringstream is(item);
+    if (!(is >> r.width >> x >> r.height) || x != 'x' || r.width <= 0 || r.height <= 0) {
+      throw std::runtime_error("Invalid resolution: '" + item + "' (expected e.g. 1280x720)");
+    }
+    result.push_back(r);
+  }
+  return result;
+}
+
+std::vector<int> parseIntList(const std::string& list) {
+  std::vector<int> result;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    result.push_back(std::stoi(item));
+  }
+  return result;
+}
+
+BenchResult runBench(const BenchConfig& config, double speed, const VideoDecoderOptions& baseOptions,
+                     bool yuv, int rgbChannels) {
+  using namespace std::chrono_literals;
+  using Clock = FrameTiming::Clock;
+
+  CaptureReplayServer server(config.captureFile, config.port, speed);
+  ReconnectOptions noReconnect;
+  noReconnect.enabled = false;
+  ConnectionManager connection("localhost", config.port, 0, noReconnect);
+  if (!connection.connect()) {
+    throw std::runtime_error("Could not connect to the replay server.");
+  }
+
+  BenchResult result;
+  {
+    VideoClient client(connection.receiver(), "render_preview", "frame_timestamp");
+    syncWithServer(connection.sender(), connection.receiver(), "ready");
+
+    VideoDecoderOptions options = baseOptions;
+    options.threads = config.threads;
+    if (!client.initialiseVideoStream(1s, options)) {
+      throw std::runtime_error("Could not initialise the video stream from '" + config.captureFile + "'");
+    }
+
+    FrameStats stats(1 << 16);
+    DecodedVideoFrame frame;
+    const auto start = Clock::now();
+    auto lastFrame = start;
+    allocationCount = 0;
+    const auto poolMisses = BufferPool::shared().stats().misses;
+
+    // The stream times out once the replay has finished:
+    while (!client.streamLost()) {
+      client.receiveVideoFrame([&](VideoDecoder& stream) {
+        frame.extract(stream, yuv, rgbChannels);
+        auto timing = client.getFrameTiming();
+        timing.converted = Clock::now();
+        // There is no UI so the frame is "presented" once converted:
+        timing.uploadStart = timing.uploaded = timing.presented = timing.converted;
+        stats.record(timing);
+        lastFrame = timing.converted;
+        result.frames += 1;
+      });
+    }
+
+    result.seconds = std::chrono::duration<double>(lastFrame - start).count();
+    const auto allocations = allocationCount + (BufferPool::shared().stats().misses - poolMisses);
+    result.allocationsPerFrame = result.frames ? double(allocations) / result.frames : 0.0;
+    result.droppedPackets = client.getDroppedPacketCount();
+    result.queue = stats.summary(FrameStats::Stage::Queue);
+    result.decode = stats.summary(FrameStats::Stage::Decode);
+    result.convert = stats.summary(FrameStats::Stage::Convert);
+    result.total = stats.summary(FrameStats::Stage::Total);
+  }
+  connection.disconnect();
+  result.peakRssMiB = peakRssMiB();
+  return result;
+}
+
+const char* csvHeader =
+    "stream,threads,frames,fps,dropped_packets,"
+    "queue_p50_ms,queue_p99_ms,decode_p50_ms,decode_p99_ms,decode_max_ms,"
+    "convert_p50_ms,convert_p99_ms,total_p50_ms,total_p99_ms,total_max_ms,"
+    "allocs_per_frame,peak_rss_mib";
+
+void writeCsvRow(std::ostream& out, const BenchConfig& config, const BenchResult& r) {
+  const double fps = r.seconds > 0.0 ? r.frames / r.seconds : 0.0;
+  out << config.label << ',' << config.threads << ',' << r.frames << ',' << fps << ',' << r.droppedPackets << ','
+      << r.queue.p50Ms << ',' << r.queue.p99Ms << ','
+      << r.decode.p50Ms << ',' << r.decode.p99Ms << ',' << r.decode.maxMs << ','
+      << r.convert.p50Ms << ',' << r.convert.p99Ms << ','
+      << r.total.p50Ms << ',' << r.total.p99Ms << ',' << r.total.maxMs << ','
+      << r.allocationsPerFrame << ',' << r.peakRssMiB << '\n';
+}
+
+void printRow(const BenchConfig& config, const BenchResult& r) {
+  const double fps = r.seconds > 0.0 ? r.frames / r.seconds : 0.0;
+  std::cout << std::fixed << std::setprecision(2)
+            << std::left << std::setw(12) << config.label << std::right
+            << std::setw(8) << (config.threads == 0 ? std::string("auto") : std::to_string(config.threads))
+            << std::setw(8) << r.frames
+            << std::setw(10) << fps
+            << std::setw(9) << r.decode.p50Ms << std::setw(9) << r.decode.p99Ms
+            << std::setw(9) << r.convert.p50Ms << std::setw(9) << r.convert.p99Ms
+            << std::setw(9) << r.total.p50Ms << std::setw(9) << r.total.p99Ms
+            << std::setw(10) << r.allocationsPerFrame
+            << std::setw(10) << r.peakRssMiB;
+  if (r.droppedPackets) {
+    std::cout << "  (" << r.droppedPackets << " packets dropped)";
+  }
+  std::cout << std::endl;
+}
+
+boost::program_options::options_description getOptions() {
+  namespace po = boost::program_options;
+  po::options_description desc("Options");
+  desc.add_options()
+  ("help", "Show command help.")
+  ("capture", po::value<std::string>()->default_value(""), "Benchmark a capture file recorded by remote-ui --record instead of synthetic streams.")
+  ("resolutions", po::value<std::string>()->default_value("640x360,1280x720,1920x1080,3840x2160"), "Comma separated synthetic stream resolutions.")
+  ("threads", po::value<std::string>()->default_value("1,2,4,0"), "Comma separated decoder thread counts to test (zero uses one per core).")
+  ("frames", po::value<int>()->default_value(300), "Number of frames in each synthetic stream.")
+  ("frame-rate", po::value<int>()->default_value(30), "Frame rate of the synthetic streams.")
+  ("bit-rate", po::value<double>()->default_value(8.0), "Bit-rate of the synthetic streams in Mbps.")
+  ("encoder", po::value<std::string>()->default_value(""), "FFmpeg encoder for the synthetic streams (default H.264).")
+  ("replay-speed", po::value<double>()->default_value(0.0), "Replay speed relative to the recording (zero replays as fast as possible, which measures throughput; queue times then include the backlog).")
+  ("convert", po::value<std::string>()->default_value("yuv"), "Frame extraction to measure: 'yuv' (GPU colour conversion), 'rgb' or 'rgba' (CPU conversion).")
+  ("hwdecode", po::value<std::string>()->default_value(""), "Decode in hardware using one of: 'vaapi', 'videotoolbox', 'nvdec' or 'auto'.")
+  ("low-latency", po::bool_switch()->default_value(false), "Open the decoder in low-latency mode.")
+  ("port", po::value<int>()->default_value(3200), "First loopback port to replay on (each run uses the next one).")
+  ("csv", po::value<std::string>()->default_value(""), "Also write the results to this CSV file.")
+  ("log-level", po::value<std::string>()->default_value("warning"), "Set the log level to one of the following: 'trace', 'debug', 'info', 'warn', 'err', 'critical', 'off'.");
+  return desc;
+}
+
+} // end anonymous namespace
+
+int main(int argc, char** argv) {
+  namespace po = boost::program_options;
+  auto desc = getOptions();
+  po::variables_map args;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), args);
+    po::notify(args);
+  } catch (const po::error& e) {
+    std::cerr << e.what() << "\n" << desc << "\n";
+    return EXIT_FAILURE;
+  }
+  if (args.count("help")) {
+    std::cout << desc << "\n";
+    return EXIT_SUCCESS;
+  }
+
+  namespace logging = boost::log;
+  std::stringstream ss(args.at("log-level").as<std::string>());
+  logging::trivial::severity_level level;
+  ss >> level;
+  logging::core::get()->set_filter(logging::trivial::severity >= level);
+
+  std::vector<std::string> syntheticFiles;
+  try {
+    const auto convert = args.at("convert").as<std::string>();
+    if (convert != "yuv" && convert != "rgb" && convert != "rgba") {
+      throw std::runtime_error("Unknown conversion: '" + convert + "'");
+    }
+    const bool yuv = convert == "yuv";
+    const int rgbChannels = convert == "rgba" ? 4 : 3;
+
+    VideoDecoderOptions decoderOptions;
+    decoderOptions.hwDevice = args.at("hwdecode").as<std::string>();
+    decoderOptions.lowLatency = args.at("low-latency").as<bool>();
+
+    // Work out which streams to decode:
+    std::vector<std::pair<std::string, std::string>> streams; // (label, capture file)
+    const auto captureFile = args.at("capture").as<std::string>();
+    if (!captureFile.empty()) {
+      streams.emplace_back(std::filesystem::path(captureFile).filename().string(), captureFile);
+    } else {
+      SyntheticStreamOptions synthetic;
+      synthetic.frames = args.at("frames").as<int>();
+      synthetic.frameRate = args.at("frame-rate").as<int>();
+      synthetic.bitRateMbps = args.at("bit-rate").as<double>();
+      synthetic.encoder = args.at("encoder").as<std::string>();
+      for (const auto& r : parseResolutions(args.at("resolutions").as<std::string>())) {
+        synthetic.width = r.width;
+        synthetic.height = r.height;
+        const auto label = std::to_string(r.width) + "x" + std::to_string(r.height);
+        const auto file = (std::filesystem::temp_directory_path() / ("remote-ui-bench-" + label + ".cap")).string();
+        std::cout << "Encoding " << synthetic.frames << " synthetic " << label << " frames..." << std::endl;
+        writeSyntheticCapture(file, synthetic);
+        syntheticFiles.push_back(file);
+        streams.emplace_back(label, file);
+      }
+    }
+
+    std::unique_ptr<std::ofstream> csv;
+    const auto csvFile = args.at("csv").as<std::string>();
+    if (!csvFile.empty()) {
+      csv = std::make_unique<std::ofstream>(csvFile);
+      *csv << csvHeader << '\n';
+    }
+
+    std::cout << "\nConversion: " << convert << ", times in ms (decode excludes waiting for data,"
+              << " total is packet received to frame ready for upload).\n"
+              << std::left << std::setw(12) << "stream" << std::right
+              << std::setw(8) << "threads" << std::setw(8) << "frames" << std::setw(10) << "fps"
+              << std::setw(9) << "dec p50" << std::setw(9) << "dec p99"
+              << std::setw(9) << "cvt p50" << std::setw(9) << "cvt p99"
+              << std::setw(9) << "tot p50" << std::setw(9) << "tot p99"
+              << std::setw(10) << "allocs/f" << std::setw(10) << "RSS MiB" << std::endl;
+
+    const auto speed = args.at("replay-speed").as<double>();
+    int port = args.at("port").as<int>();
+    for (const auto& stream : streams) {
+      for (const auto threads : parseIntList(args.at("threads").as<std::string>())) {
+        // Each run gets a fresh port so a socket lingering from the
+        // previous one can not stop the replay server binding:
+        const BenchConfig config{stream.second, stream.first, threads, port++};
+        const auto result = runBench(config, speed, decoderOptions, yuv, rgbChannels);
+        printRow(config, result);
+        if (csv) {
+          writeCsvRow(*csv, config, result);
+        }
+      }
+    }
+    std::cout << "\nPeak RSS is the process high-water mark so far (it never decreases).\n";
+  } catch (const std::exception& e) {
+    BOOST_LOG_TRIVIAL(error) << "Error: " << e.what();
+    for (const auto& f : syntheticFiles) {
+      std::filesystem::remove(f);
+    }
+    return EXIT_FAILURE;
+  }
+
+  for (const auto& f : syntheticFiles) {
+    std::filesystem::remove(f);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,56 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "AdaptiveSampleController.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+AdaptiveSampleController::AdaptiveSampleController(const AdaptiveSampleOptions& options)
+    : opts(options) {}
+
+std::uint32_t AdaptiveSampleController::clamp(double samples) const {
+  const double lo = opts.minSamples;
+  const double hi = std::max(opts.minSamples, opts.maxSamples);
+  return static_cast<std::uint32_t>(std::min(hi, std::max(lo, std::floor(samples))));
+}
+
+std::uint32_t AdaptiveSampleController::update(const Measurements& m, std::uint32_t current,
+                                               std::chrono::steady_clock::time_point lastInteraction,
+                                               std::chrono::steady_clock::time_point now) {
+  if (now - lastUpdate < opts.updateInterval) {
+    return current;
+  }
+  lastUpdate = now;
+
+  std::uint32_t next = current;
+  const bool interacting = now - lastInteraction < opts.idleDelay;
+  if (!interacting) {
+    // Improve quality while nothing is changing:
+    next = clamp(2.0 * current);
+  } else if (m.fps > 0.0 && opts.targetFps > 0.f) {
+    // Samples per frame that the server's throughput could sustain at the target rate:
+    const bool haveThroughput = m.pathRate > 0.0 && m.pixels > 0;
+    const double sustainable = haveThroughput ? m.pathRate / (double(m.pixels) * opts.targetFps) : opts.maxSamples;
+
+    if (m.fps < 0.9 * opts.targetFps) {
+      // Frame time scales (roughly) with samples so scale down in proportion:
+      next = clamp(std::min(current * m.fps / opts.targetFps, sustainable));
+    } else if (m.fps > 1.1 * opts.targetFps && current + 1 <= sustainable) {
+      next = clamp(current + 1);
+    }
+
+    if (opts.maxLatencyMs > 0.0 && m.latencyMs > opts.maxLatencyMs && next >= current) {
+      next = clamp(double(current) - 1.0);
+    }
+  }
+
+  if (next != current) {
+    BOOST_LOG_TRIVIAL(debug) << "Adaptive samples: " << current << " -> " << next
+                             << (interacting ? " (interacting)" : " (idle)")
+                             << " fps: " << m.fps << " latency: " << m.latencyMs << " ms"
+                             << " path-rate: " << m.pathRate;
+  }
+  return next;
+}
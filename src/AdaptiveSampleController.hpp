@@ -0,0 +1,60 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+/// Options for the adaptive interactive-sample controller.
+struct AdaptiveSampleOptions {
+  /// Frame rate to hold while the user is interacting.
+  float targetFps = 20.f;
+  /// Reduce samples if latency exceeds this (zero to ignore latency).
+  double maxLatencyMs = 0.0;
+  std::uint32_t minSamples = 1;
+  std::uint32_t maxSamples = 16;
+  /// Time since the last control change after which the user is
+  /// considered idle (and samples are raised to improve quality).
+  std::chrono::milliseconds idleDelay = std::chrono::milliseconds(1000);
+  /// Minimum time between adjustments (so each change can take effect
+  /// and be measured before the next).
+  std::chrono::milliseconds updateInterval = std::chrono::milliseconds(500);
+};
+
+/// Feedback controller that chooses the number of interactive samples
+/// per step from the measured preview frame rate, latency and the
+/// server's path-tracing throughput.
+///
+/// While the user interacts the controller holds the target frame rate:
+/// when below target it scales samples down in proportion (bounded by
+/// what the measured path rate can sustain at the target frame rate),
+/// when comfortably above target samples are increased one at a time.
+/// When the user is idle samples are doubled each interval up to the
+/// maximum so that the image quality improves.
+class AdaptiveSampleController {
+public:
+  struct Measurements {
+    double fps = 0.0;
+    double latencyMs = -1.0; // Negative if unknown.
+    double pathRate = 0.0;   // Paths per second reported by the server (zero if unknown).
+    std::int64_t pixels = 0; // Pixels in each frame (zero if unknown).
+  };
+
+  AdaptiveSampleController(const AdaptiveSampleOptions& options = AdaptiveSampleOptions());
+
+  /// Compute the sample count to use.
+  /// @param current The sample count currently in use.
+  /// @param lastInteraction Time of the most recent control change.
+  /// @return The new sample count (equal to current if no change is needed).
+  std::uint32_t update(const Measurements& m, std::uint32_t current,
+                       std::chrono::steady_clock::time_point lastInteraction,
+                       std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+  AdaptiveSampleOptions& options() { return opts; }
+
+private:
+  std::uint32_t clamp(double samples) const;
+
+  AdaptiveSampleOptions opts;
+  std::chrono::steady_clock::time_point lastUpdate;
+};
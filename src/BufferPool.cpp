@@ -0,0 +1,123 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "BufferPool.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+
+#include <sys/mman.h>
+
+BufferPool& BufferPool::shared() {
+  // Never destroyed so buffers may safely be released during static destruction:
+  static auto* pool = new BufferPool();
+  return *pool;
+}
+
+std::size_t BufferPool::sizeClass(std::size_t bytes) {
+  if (bytes <= minPooledSize) {
+    return minPooledSize;
+  }
+  // Step is a quarter of the highest power of two not above bytes:
+  std::size_t step = minPooledSize / 4;
+  while (step * 8 <= bytes) {
+    step *= 2;
+  }
+  return (bytes + step - 1) / step * step;
+}
+
+BufferPool::BufferPool(std::size_t limit)
+    : cacheLimit(limit),
+      hugePages(false) {}
+
+BufferPool::~BufferPool() {
+  std::lock_guard<std::mutex> lock(mutex);
+  trimTo(0);
+  if (counters.buffersInUse != 0) {
+    BOOST_LOG_TRIVIAL(debug) << "Buffer pool destroyed with " << counters.buffersInUse << " buffers in use.";
+  }
+}
+
+void* BufferPool::map(std::size_t size, bool useHugePages) {
+  void* buffer = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buffer == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+#ifdef MADV_HUGEPAGE
+  if (useHugePages && madvise(buffer, size, MADV_HUGEPAGE) != 0) {
+    BOOST_LOG_TRIVIAL(debug) << "Huge pages are not available for pooled buffers.";
+  }
+#endif
+  return buffer;
+}
+
+void* BufferPool::allocate(std::size_t bytes) {
+  const auto size = sizeClass(bytes);
+  std::unique_lock<std::mutex> lock(mutex);
+  auto found = std::find_if(cached.begin(), cached.end(), [size](const Entry& e) { return e.size == size; });
+  void* buffer = nullptr;
+  if (found != cached.end()) {
+    buffer = found->buffer;
+    cached.erase(found);
+    counters.bytesCached -= size;
+    counters.hits += 1;
+  } else {
+    counters.misses += 1;
+    // Don't hold the lock while the OS maps (and zeroes) the memory:
+    const bool useHugePages = hugePages;
+    lock.unlock();
+    buffer = map(size, useHugePages);
+    lock.lock();
+  }
+  counters.bytesInUse += size;
+  counters.buffersInUse += 1;
+  counters.peakBytes = std::max(counters.peakBytes, counters.bytesInUse + counters.bytesCached);
+  return buffer;
+}
+
+void BufferPool::release(void* buffer, std::size_t bytes) {
+  if (buffer == nullptr) {
+    return;
+  }
+  const auto size = sizeClass(bytes);
+  std::lock_guard<std::mutex> lock(mutex);
+  counters.bytesInUse -= size;
+  counters.buffersInUse -= 1;
+  if (size > cacheLimit) {
+    munmap(buffer, size);
+    return;
+  }
+  cached.push_front(Entry{buffer, size});
+  counters.bytesCached += size;
+  trimTo(cacheLimit);
+}
+
+void BufferPool::setHugePages(bool enable) {
+  std::lock_guard<std::mutex> lock(mutex);
+  hugePages = enable;
+}
+
+void BufferPool::setCacheLimit(std::size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  cacheLimit = bytes;
+  trimTo(cacheLimit);
+}
+
+void BufferPool::trim() {
+  std::lock_guard<std::mutex> lock(mutex);
+  trimTo(0);
+}
+
+BufferPool::Stats BufferPool::stats() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return counters;
+}
+
+void BufferPool::trimTo(std::size_t limit) {
+  while (counters.bytesCached > limit && !cached.empty()) {
+    const auto& oldest = cached.back();
+    munmap(oldest.buffer, oldest.size);
+    counters.bytesCached -= oldest.size;
+    cached.pop_back();
+  }
+}
@@ -0,0 +1,121 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <new>
+#include <vector>
+
+/// Recycles the large (multi-megabyte) pixel buffers used for decoded
+/// video frames, HDR images and HDR tiles.
+///
+/// Buffers are mapped directly from the OS (so are page-aligned and
+/// optionally backed by transparent huge pages) and their sizes are
+/// rounded up to a size class: a quarter power of two, so at most 25%
+/// is wasted. Released buffers are kept for reuse by the next request
+/// in the same class, newest first, up to a cache limit beyond which
+/// the oldest are returned to the OS. This avoids heap fragmentation
+/// and page faults from repeatedly allocating ~100MB images in long
+/// sessions, and means memory is really given back when it is freed.
+///
+/// Safe to use from any thread.
+class BufferPool {
+public:
+  struct Stats {
+    std::size_t bytesInUse = 0;  // Total size of buffers handed out.
+    std::size_t buffersInUse = 0;
+    std::size_t bytesCached = 0; // Released buffers held for reuse.
+    std::size_t peakBytes = 0;   // Peak of in use plus cached.
+    std::uint64_t hits = 0;      // Requests satisfied from the cache.
+    std::uint64_t misses = 0;    // Requests that needed new memory.
+  };
+
+  /// Requests smaller than this are left to the heap.
+  static constexpr std::size_t minPooledSize = 256 * 1024;
+  static constexpr std::size_t defaultCacheLimit = std::size_t(512) * 1024 * 1024;
+
+  /// The pool shared by the decoders, HDR receivers and tile caches.
+  static BufferPool& shared();
+
+  /// Round bytes up to its size class.
+  static std::size_t sizeClass(std::size_t bytes);
+
+  BufferPool(std::size_t cacheLimit = defaultCacheLimit);
+  virtual ~BufferPool();
+
+  BufferPool(const BufferPool&) = delete;
+  BufferPool& operator=(const BufferPool&) = delete;
+
+  /// Get a buffer of at least the given size. Fresh memory is zeroed,
+  /// reused memory is not. Throws std::bad_alloc if out of memory.
+  void* allocate(std::size_t bytes);
+
+  /// Return a buffer. bytes must be the size it was allocated with.
+  void release(void* buffer, std::size_t bytes);
+
+  /// Ask for new buffers to be backed by huge pages where the OS
+  /// supports it (this is only a hint).
+  void setHugePages(bool enable);
+
+  /// Change the cache limit (releasing cached buffers if necessary).
+  void setCacheLimit(std::size_t bytes);
+
+  /// Return all cached buffers to the OS.
+  void trim();
+
+  Stats stats() const;
+
+private:
+  struct Entry {
+    void* buffer;
+    std::size_t size;
+  };
+
+  static void* map(std::size_t size, bool useHugePages);
+  void trimTo(std::size_t limit); // Caller must hold the mutex.
+
+  mutable std::mutex mutex;
+  std::list<Entry> cached; // Newest first.
+  std::size_t cacheLimit;
+  bool hugePages;
+  Stats counters;
+};
+
+/// Standard allocator that takes large allocations from BufferPool::shared().
+template <class T>
+struct PoolAllocator {
+  using value_type = T;
+
+  PoolAllocator() noexcept {}
+  template <class U>
+  PoolAllocator(const PoolAllocator<U>&) noexcept {}
+
+  T* allocate(std::size_t n) {
+    const auto bytes = n * sizeof(T);
+    if (bytes < BufferPool::minPooledSize) {
+      return static_cast<T*>(::operator new(bytes));
+    }
+    return static_cast<T*>(BufferPool::shared().allocate(bytes));
+  }
+
+  void deallocate(T* p, std::size_t n) noexcept {
+    const auto bytes = n * sizeof(T);
+    if (bytes < BufferPool::minPooledSize) {
+      ::operator delete(p);
+    } else {
+      BufferPool::shared().release(p, bytes);
+    }
+  }
+
+  template <class U>
+  bool operator==(const PoolAllocator<U>&) const noexcept { return true; }
+  template <class U>
+  bool operator!=(const PoolAllocator<U>&) const noexcept { return false; }
+};
+
+/// A vector whose storage comes from the shared buffer pool.
+template <class T>
+using PooledVector = std::vector<T, PoolAllocator<T>>;
@@ -0,0 +1,128 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "CaptureReplayServer.hpp"
+#include "PacketDescriptions.hpp"
+#include "ThreadSettings.hpp"
+
+#include <PacketSerialisation.h>
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+
+CaptureReplayServer::CaptureReplayServer(const std::string& fileName, int port, double replaySpeed, bool replayLoop)
+    : reader(fileName),
+      speed(replaySpeed),
+      loop(replayLoop),
+      listenSocket(std::make_unique<TcpSocket>()),
+      stop(false),
+      done(false) {
+  if (!listenSocket->Bind(port)) {
+    throw std::runtime_error("Replay server could not bind port " + std::to_string(port));
+  }
+  listenSocket->Listen(1);
+  BOOST_LOG_TRIVIAL(info) << "Replaying '" << fileName << "' on port " << port
+                          << (speed > 0.0 ? "" : " at maximum speed");
+  thread.reset(new std::thread(&CaptureReplayServer::run, this));
+}
+
+CaptureReplayServer::~CaptureReplayServer() {
+  {
+    std::lock_guard<std::mutex> lock(socketMutex);
+    stop = true;
+    if (clientSocket) {
+      clientSocket->Shutdown();
+    }
+  }
+  if (listenSocket) {
+    // Unblocks Accept() if the client never connected:
+    listenSocket->Shutdown();
+  }
+  thread->join();
+}
+
+void CaptureReplayServer::run() {
+  setCurrentThreadName("rui-replay");
+  auto accepted = listenSocket->Accept();
+  if (accepted == nullptr || !accepted->IsValid()) {
+    return;
+  }
+  TcpSocket* socket = nullptr;
+  {
+    // Once published the destructor is responsible for shutting it down:
+    std::lock_guard<std::mutex> lock(socketMutex);
+    if (stop) {
+      return;
+    }
+    clientSocket = std::move(accepted);
+    socket = clientSocket.get();
+  }
+  socket->SetNagleBufferingOff();
+
+  PacketMuxer sender(*socket, packets::packetTypes);
+  PacketDemuxer receiver(*socket, packets::packetTypes);
+
+  // Server side of the handshake: keep offering "ready" until the
+  // client says it is ready too:
+  std::atomic<bool> clientReady(false);
+  auto readySubscription = receiver.subscribe("ready", [&](const ComPacket::ConstSharedPacket&) {
+    clientReady = true;
+  });
+  while (!clientReady && !stop && receiver.ok()) {
+    serialise(sender, "ready", true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  serialise(sender, "ready", true);
+
+  do {
+    replay(sender);
+    reader.rewind();
+  } while (loop && !stop && sender.ok());
+  done = true;
+
+  // Keep the connection open (so the client does not start
+  // reconnecting) until we are destroyed:
+  while (!stop && sender.ok()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+}
+
+void CaptureReplayServer::replay(PacketMuxer& sender) {
+  // Map the capture's type names onto the current packet types:
+  const auto& types = packets::packetTypes;
+  std::map<std::uint32_t, std::string> names;
+  const auto& captured = reader.typeNames();
+  for (std::uint32_t t = 0; t < captured.size(); ++t) {
+    if (std::find(types.begin(), types.end(), captured[t]) != types.end()) {
+      names[t] = captured[t];
+    } else {
+      BOOST_LOG_TRIVIAL(warning) << "Packets of unknown type '" << captured[t] << "' will not be replayed.";
+    }
+  }
+
+  using Clock = std::chrono::steady_clock;
+  const auto start = Clock::now();
+  std::uint64_t packetCount = 0;
+  std::uint64_t byteCount = 0;
+  capture::Record record;
+  while (!stop && sender.ok() && reader.next(record)) {
+    auto name = names.find(record.type);
+    if (name == names.end()) {
+      continue;
+    }
+    if (speed > 0.0) {
+      std::this_thread::sleep_until(start + std::chrono::microseconds(std::int64_t(record.timeMicros / speed)));
+    }
+    sender.emplacePacket(name->second, record.data, record.size);
+    packetCount += 1;
+    byteCount += record.size;
+  }
+
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  BOOST_LOG_TRIVIAL(info) << "Replayed " << packetCount << " packets (" << byteCount / (1024.0 * 1024.0)
+                          << " MiB) in " << seconds << " s: "
+                          << byteCount / (1024.0 * 1024.0) / std::max(seconds, 1e-6) << " MiB/s, "
+                          << packetCount / std::max(seconds, 1e-6) << " packets/s";
+}
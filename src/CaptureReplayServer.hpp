@@ -0,0 +1,49 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <network/TcpSocket.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "PacketCapture.hpp"
+
+/// Stands in for the render server by replaying a capture file (see
+/// capture::PacketRecorder) over a loopback TCP connection. The client
+/// connects to it exactly as it would to a live server so VideoClient,
+/// the HDR receivers and the ControlsForm subscribers all run unchanged.
+/// Packets sent by the client are ignored.
+///
+/// Replay runs at the recorded pace scaled by speed, or as fast as
+/// possible if speed is zero (for benchmarking decode, upload and HDR
+/// reassembly throughput). The throughput achieved is logged at the end.
+class CaptureReplayServer {
+public:
+  /// Open the capture and listen on port. Throws a std::runtime_error
+  /// if the capture can not be read or the port can not be bound.
+  CaptureReplayServer(const std::string& fileName, int port, double speed, bool loop = false);
+  virtual ~CaptureReplayServer();
+
+  /// True once every packet has been sent (never if looping).
+  bool finished() const { return done; }
+
+private:
+  void run();
+  void replay(PacketMuxer& sender);
+
+  capture::Reader reader;
+  const double speed;
+  const bool loop;
+  std::unique_ptr<TcpSocket> listenSocket;
+  // Set by the replay thread and shut down by the destructor so
+  // it is only accessed (and stop set) while holding socketMutex:
+  std::mutex socketMutex;
+  std::unique_ptr<TcpSocket> clientSocket;
+  std::atomic<bool> stop;
+  std::atomic<bool> done;
+  std::unique_ptr<std::thread> thread;
+};
@@ -0,0 +1,173 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "ConnectionManager.hpp"
+#include "PacketDescriptions.hpp"
+#include "ThreadSettings.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+
+ConnectionManager::ConnectionManager(const std::string& serverHost, int serverPort, int serverBulkPort,
+                                     const ReconnectOptions& options)
+    : host(serverHost),
+      port(serverPort),
+      bulkPort(serverBulkPort),
+      opts(options),
+      commsThreads{"rui-comms"},
+      stop(false),
+      attempts(0) {}
+
+ConnectionManager::~ConnectionManager() {
+  stopReconnecting();
+  disconnect();
+}
+
+ConnectionManager::Sockets ConnectionManager::connectSockets() const {
+  Sockets s;
+  s.main = std::make_unique<TcpSocket>();
+  if (!s.main->Connect(host.c_str(), port)) {
+    BOOST_LOG_TRIVIAL(info) << "Could not connect to server " << host << ":" << port;
+    return Sockets();
+  }
+
+  if (bulkPort != 0) {
+    s.bulk = std::make_unique<TcpSocket>();
+    if (!s.bulk->Connect(host.c_str(), bulkPort)) {
+      BOOST_LOG_TRIVIAL(info) << "Could not connect to server bulk data port " << host << ":" << bulkPort;
+      return Sockets();
+    }
+    BOOST_LOG_TRIVIAL(info) << "Receiving bulk data on port " << bulkPort;
+  }
+
+  return s;
+}
+
+bool ConnectionManager::connect() {
+  disconnect();
+  auto connected = connectSockets();
+  if (connected.main == nullptr) {
+    return false;
+  }
+  BOOST_LOG_TRIVIAL(info) << "Connected to server " << host << ":" << port;
+  createMuxers(std::move(connected));
+  return true;
+}
+
+bool ConnectionManager::ok() const {
+  const bool bulkOk = bulkPort == 0 || (bulkDemuxer != nullptr && bulkDemuxer->ok());
+  return muxer != nullptr && demuxer != nullptr && muxer->ok() && demuxer->ok() && bulkOk;
+}
+
+PacketMuxer& ConnectionManager::sender() {
+  if (muxer == nullptr) {
+    throw std::logic_error("Not connected: no PacketMuxer available.");
+  }
+  return *muxer;
+}
+
+PacketDemuxer& ConnectionManager::receiver() {
+  if (demuxer == nullptr) {
+    throw std::logic_error("Not connected: no PacketDemuxer available.");
+  }
+  return *demuxer;
+}
+
+PacketDemuxer& ConnectionManager::bulkReceiver() {
+  if (bulkPort == 0) {
+    return receiver();
+  }
+  if (bulkDemuxer == nullptr) {
+    throw std::logic_error("Not connected: no bulk PacketDemuxer available.");
+  }
+  return *bulkDemuxer;
+}
+
+void ConnectionManager::disconnect() {
+  bulkDemuxer.reset();
+  demuxer.reset();
+  muxer.reset();
+  sockets = Sockets();
+}
+
+void ConnectionManager::startReconnecting() {
+  if (reconnectThread) {
+    return;
+  }
+  disconnect();
+  attempts = 0;
+  stop = false;
+  reconnectThread.reset(new std::thread(&ConnectionManager::reconnectLoop, this));
+}
+
+bool ConnectionManager::poll() {
+  Sockets connected;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    connected = std::move(connectedSockets);
+    connectedSockets = Sockets();
+  }
+  if (connected.main == nullptr) {
+    return false;
+  }
+
+  stopReconnecting();
+  createMuxers(std::move(connected));
+  return true;
+}
+
+void ConnectionManager::createMuxers(Sockets&& connected) {
+  sockets = std::move(connected);
+  // The muxers start their threads on construction and these inherit
+  // the settings of this thread (which is the UI thread on reconnect, so
+  // anything not set for the comms threads is reset to the defaults):
+  ScopedThreadSettings scope(commsThreads);
+  muxer = std::make_unique<PacketMuxer>(*sockets.main, packets::packetTypes);
+  demuxer = std::make_unique<PacketDemuxer>(*sockets.main, packets::packetTypes);
+  if (sockets.bulk) {
+    // Both connections use the same packet types so that the server can
+    // send any packet on either (bulk data is only received here):
+    bulkDemuxer = std::make_unique<PacketDemuxer>(*sockets.bulk, packets::packetTypes);
+  }
+}
+
+void ConnectionManager::reconnectLoop() {
+  setCurrentThreadName("rui-reconnect");
+  auto delay = opts.initialDelay;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (stopCondition.wait_for(lock, delay, [this]() { return stop; })) {
+        return;
+      }
+    }
+
+    auto connected = connectSockets();
+    if (connected.main != nullptr) {
+      BOOST_LOG_TRIVIAL(info) << "Reconnected to server " << host << ":" << port
+                              << " after " << attempts << " failed attempts.";
+      std::lock_guard<std::mutex> lock(mutex);
+      connectedSockets = std::move(connected);
+      return;
+    }
+
+    attempts += 1;
+    delay = std::min(2 * delay, opts.maxDelay);
+    BOOST_LOG_TRIVIAL(info) << "Reconnect attempt " << attempts << " failed. Retrying in "
+                            << delay.count() << " ms.";
+  }
+}
+
+void ConnectionManager::stopReconnecting() {
+  if (!reconnectThread) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = true;
+  }
+  stopCondition.notify_all();
+  // An attempt in progress can not be interrupted so this waits for it:
+  reconnectThread->join();
+  reconnectThread.reset();
+}
@@ -0,0 +1,120 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <PacketComms.h>
+#include <network/TcpSocket.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "ThreadSettings.hpp"
+
+/// Options that control how a lost connection is re-established.
+struct ReconnectOptions {
+  /// Try to reconnect when the connection is lost (otherwise
+  /// the session just ends).
+  bool enabled = true;
+  /// Delay before the first attempt. Doubles after each failure.
+  std::chrono::milliseconds initialDelay = std::chrono::milliseconds(500);
+  /// Upper limit on the delay between attempts.
+  std::chrono::milliseconds maxDelay = std::chrono::milliseconds(10000);
+};
+
+/// Owns the connection to the render server: the socket and the muxer and
+/// demuxer that run over it. When the connection is lost it can be closed
+/// and re-established in the background with exponential backoff, after
+/// which the owner re-subscribes and re-syncs with the server.
+///
+/// Optionally bulk HDR data can be received over a second connection.
+/// A single TCP stream delivers packets strictly in order so a burst of
+/// multi-megabyte HDR transfers otherwise delays every video packet and
+/// control reply queued behind it. With a separate connection for bulk
+/// data the two streams are independent.
+///
+/// Apart from the background connection attempts all methods must be
+/// called from the same (UI) thread.
+class ConnectionManager {
+public:
+  /// @param bulkPort If non-zero also connect to this port to receive bulk data.
+  ConnectionManager(const std::string& host, int port, int bulkPort = 0,
+                    const ReconnectOptions& options = ReconnectOptions());
+  virtual ~ConnectionManager();
+
+  /// Make a single blocking connection attempt.
+  /// @return true if the connection was made.
+  bool connect();
+
+  /// True if there is a connection and neither side has failed.
+  bool ok() const;
+
+  /// The current muxer/demuxer. Only valid while connected: all
+  /// references (including subscriptions) must be released before
+  /// disconnect() is called.
+  PacketMuxer& sender();
+  PacketDemuxer& receiver();
+  /// Demuxer for bulk (HDR) data. This is receiver() unless there
+  /// is a separate bulk connection.
+  PacketDemuxer& bulkReceiver();
+
+  /// Close the connection (if any).
+  void disconnect();
+
+  /// Start trying to reconnect in the background. Call poll() to find
+  /// out when a new connection is ready.
+  void startReconnecting();
+
+  /// True while background connection attempts are in progress.
+  bool reconnecting() const { return reconnectThread != nullptr; }
+
+  /// Check for a connection made in the background. If there is one the
+  /// muxer and demuxer are created and this returns true (once).
+  bool poll();
+
+  /// Number of failed attempts since the connection was lost.
+  unsigned failedAttempts() const { return attempts; }
+
+  const ReconnectOptions& options() const { return opts; }
+
+  /// The server's host name or address.
+  const std::string& getHost() const { return host; }
+
+  /// Set the name, affinity and priority of the muxer and demuxer threads
+  /// (which send and receive packets). Takes effect on the next connection.
+  void setCommsThreadSettings(const ThreadSettings& settings) { commsThreads = settings; }
+
+private:
+  struct Sockets {
+    std::unique_ptr<TcpSocket> main;
+    std::unique_ptr<TcpSocket> bulk;
+  };
+  /// Connect all the sockets (returning none if any one fails).
+  Sockets connectSockets() const;
+  void createMuxers(Sockets&& connected);
+  void reconnectLoop();
+  void stopReconnecting();
+
+  const std::string host;
+  const int port;
+  const int bulkPort;
+  const ReconnectOptions opts;
+  ThreadSettings commsThreads;
+
+  // The muxers must be destroyed before the socket they use:
+  Sockets sockets;
+  std::unique_ptr<PacketMuxer> muxer;
+  std::unique_ptr<PacketDemuxer> demuxer;
+  std::unique_ptr<PacketDemuxer> bulkDemuxer;
+
+  std::unique_ptr<std::thread> reconnectThread;
+  std::mutex mutex;
+  std::condition_variable stopCondition;
+  bool stop;
+  Sockets connectedSockets; // Handed over from the reconnect thread.
+  std::atomic<unsigned> attempts;
+};
@@ -0,0 +1,75 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "ControlCoalescer.hpp"
+
+#include <boost/log/trivial.hpp>
+
+ControlCoalescer::ControlCoalescer(PacketMuxer& tx, const ControlOptions& controlOptions)
+    : sender(&tx),
+      options(controlOptions),
+      lastSendTime(std::chrono::steady_clock::now() - controlOptions.minInterval) {}
+
+void ControlCoalescer::updateCamera(const packets::CameraState& state, std::uint32_t fields) {
+  lastChange = std::chrono::steady_clock::now();
+  const auto dirty = pendingCamera.dirty | fields;
+  pendingCamera = state;
+  pendingCamera.dirty = dirty;
+}
+
+void ControlCoalescer::sendCameraNow(const packets::CameraState& state, std::uint32_t fields) {
+  const auto dirty = pendingCamera.dirty | fields;
+  pendingCamera = state;
+  pendingCamera.dirty = dirty;
+  if (sender == nullptr) {
+    // Keep the changes until there is a connection to send them on:
+    return;
+  }
+  if (options.cameraStatePackets) {
+    serialise(*sender, "camera_state", pendingCamera);
+  } else {
+    sendCameraFields(pendingCamera, pendingCamera.dirty);
+  }
+  pendingCamera.dirty = 0;
+}
+
+void ControlCoalescer::sendCameraFields(const packets::CameraState& state, std::uint32_t fields) {
+  using packets::CameraState;
+  if (fields & CameraState::EnvRotation) {
+    sendNow("env_rotation", state.envRotation);
+  }
+  if (fields & CameraState::Exposure) {
+    sendNow("exposure", state.exposure);
+  }
+  if (fields & CameraState::Gamma) {
+    sendNow("gamma", state.gamma);
+  }
+  if (fields & CameraState::Fov) {
+    sendNow("fov", state.fov);
+  }
+  if (fields & CameraState::InteractiveSamples) {
+    sendNow("interactive_samples", state.interactiveSamples);
+  }
+}
+
+void ControlCoalescer::flush() {
+  if (sender == nullptr || (pending.empty() && pendingCamera.dirty == 0)) {
+    return;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  if (now - lastSendTime < options.minInterval) {
+    return;
+  }
+
+  if (pendingCamera.dirty != 0) {
+    BOOST_LOG_TRIVIAL(trace) << "Sending coalesced camera update, dirty mask: " << pendingCamera.dirty;
+    sendCameraNow(pendingCamera, 0);
+  }
+
+  for (auto& p : pending) {
+    BOOST_LOG_TRIVIAL(trace) << "Sending coalesced control update: " << p.first;
+    p.second();
+  }
+  pending.clear();
+  lastSendTime = now;
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <PacketComms.h>
+#include <PacketSerialisation.h>
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+
+#include "PacketDescriptions.hpp"
+
+/// Options that control how control updates (and other optional client
+/// messages) are sent to the server.
+struct ControlOptions {
+  /// Minimum time between sends of pending updates. Zero
+  /// sends them at most once per UI frame.
+  std::chrono::microseconds minInterval = std::chrono::microseconds(0);
+  /// Send render parameters as batched camera_state packets
+  /// (otherwise each is sent as its own packet type).
+  bool cameraStatePackets = false;
+  /// Advertise the HDR encodings we can decode in an hdr_capabilities
+  /// packet (otherwise the server sends uncompressed hdr_packet chunks).
+  bool hdrCapabilities = false;
+  /// Periodically send stream_feedback packets so the server can adapt
+  /// the video bit-rate.
+  bool streamFeedback = false;
+  /// Send a nif_prefetch hint after each load_nif.
+  bool nifPrefetch = false;
+  /// Ask for full precision hdr_tile data of the visible region (with
+  /// hdr_region_request packets) when raw values are shown zoomed in.
+  bool hdrRegionRequests = false;
+};
+
+/// Coalesces control updates (e.g. from dragging a slider) so that only
+/// the latest value of each packet type is sent, at most once per flush.
+/// Every value change restarts the server's progressive render so
+/// sending each intermediate drag event just delays the preview.
+///
+/// All methods must be called from the UI thread.
+class ControlCoalescer {
+public:
+  ControlCoalescer(PacketMuxer& sender, const ControlOptions& options = ControlOptions());
+  virtual ~ControlCoalescer() {}
+
+  /// Change the muxer that updates are sent through (e.g. after a
+  /// reconnect). While it is null updates are held until one is set.
+  void setSender(PacketMuxer* newSender) { sender = newSender; }
+  bool hasSender() const { return sender != nullptr; }
+
+  const ControlOptions& getOptions() const { return options; }
+
+  /// Record a new value to be sent at the next flush (replacing any
+  /// value of the same packet type that has not been sent yet).
+  template <class T>
+  void update(const std::string& packetType, const T& value) {
+    lastChange = std::chrono::steady_clock::now();
+    queue(packetType, value);
+  }
+
+  /// Send a value straight away discarding any pending update of the
+  /// same type (e.g. for the final value when a control is released).
+  /// If there is no connection the value is kept until the next flush.
+  template <class T>
+  void sendNow(const std::string& packetType, T value) {
+    if (sender == nullptr) {
+      queue(packetType, value);
+      return;
+    }
+    pending.erase(packetType);
+    serialise(*sender, packetType, value);
+  }
+
+  /// Record new render parameters to be sent at the next flush. state
+  /// holds the latest value of every parameter and fields flags those
+  /// that changed. Changes are accumulated until they are sent so that
+  /// one camera_state packet carries everything that changed in between.
+  void updateCamera(const packets::CameraState& state, std::uint32_t fields);
+
+  /// As updateCamera() but send everything pending immediately.
+  void sendCameraNow(const packets::CameraState& state, std::uint32_t fields);
+
+  /// Time of the last update() or updateCamera() call, i.e. when the user
+  /// last dragged a control (final values sent on release do not count).
+  std::chrono::steady_clock::time_point lastChangeTime() const { return lastChange; }
+
+  /// Send all pending updates if the minimum interval has elapsed.
+  /// Call once per UI frame.
+  void flush();
+
+private:
+  template <class T>
+  void queue(const std::string& packetType, const T& value) {
+    pending[packetType] = [this, packetType, value]() mutable {
+      serialise(*sender, packetType, value);
+    };
+  }
+
+  // Send the camera state fields using individual packet types:
+  void sendCameraFields(const packets::CameraState& state, std::uint32_t fields);
+
+  PacketMuxer* sender;
+  const ControlOptions options;
+  packets::CameraState pendingCamera;
+  std::chrono::steady_clock::time_point lastSendTime;
+  std::chrono::steady_clock::time_point lastChange;
+  std::map<std::string, std::function<void()>> pending;
+};
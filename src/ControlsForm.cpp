@@ -7,13 +7,19 @@
 #include <cereal/types/string.hpp>
 
 #include <boost/log/trivial.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
 
+#include <algorithm>
+#include <cstdio>
 #include <iomanip>
-#include <fstream>
+#include <iterator>
 
 namespace {
 std::string hdrDelayNote = "Note that the HDR values are updated infrequently"
                             " so can be many seconds out of date.";
+// Number of models after the current one in the menu to ask the server to prefetch:
+const std::size_t nifPrefetchAhead = 2;
 }
 
 std::uint32_t convertSampleValue(float value) {
@@ -24,23 +30,41 @@ std::uint32_t convertSampleValue(float value) {
 }
 
 ControlsForm::ControlsForm(nanogui::Screen* screen,
-                           PacketMuxer& sender,
+                           ControlCoalescer& controls,
                            PacketDemuxer& receiver,
+                           PacketDemuxer& bulkReceiver,
                            VideoPreviewWindow* videoPreview)
     : nanogui::FormHelper(screen),
-      hdrHeader(packets::HdrHeader{0,0,0}),
       nifChooser(nullptr),
       saveButton(nullptr),
-      preview(videoPreview)
+      nifSwitchText(nullptr),
+      nifSwitchPending(false),
+      nifSwitchSentMicros(0),
+      nifSwitchFrameCount(0),
+      preview(videoPreview),
+      hdrReceiver(bulkReceiver),
+      hdrTiles(bulkReceiver),
+      saveExrButton(nullptr),
+      controls(controls),
+      adaptiveSamplesBox(nullptr),
+      pathRate(0.f),
+      rayRate(0.f),
+      progress(0.f)
 {
   window = add_window(nanogui::Vector2i(10, 10), "Control");
 
   // Scene controls
   add_group("Scene Parameters");
-  auto* rotationWheel = new Rotator(window);
+  // Continuous control changes are coalesced (see ControlCoalescer)
+  // and the final value is always sent as soon as a control is released:
+  rotationWheel = new Rotator(window);
   rotationWheel->set_callback([&](float value) {
-    float angle = value/(2.f*M_PI) * 360.f;
-    serialise(sender, "env_rotation", angle);
+    cameraState.envRotation = value/(2.f*M_PI) * 360.f;
+    controls.updateCamera(cameraState, packets::CameraState::EnvRotation);
+  });
+  rotationWheel->set_final_callback([&](float value) {
+    cameraState.envRotation = value/(2.f*M_PI) * 360.f;
+    controls.sendCameraNow(cameraState, packets::CameraState::EnvRotation);
   });
   add_widget("Env NIF Rotation", rotationWheel);
 
@@ -49,54 +73,97 @@ ControlsForm::ControlsForm(nanogui::Screen* screen,
   nifChooser->set_side(nanogui::Popup::Side::Left);
   nifChooser->set_tooltip("Pass a JSON file using '--nif-paths' option to enable selection.");
   nifChooser->set_callback([&](int index) {
-    auto path = fileMapping.at(nifChooser->items()[index]);
-    BOOST_LOG_TRIVIAL(debug) << "Sending new NIF path: " << path;
-    serialise(sender, "load_nif", path);
+    loadNif(fileMapping.at(nifChooser->items()[index]));
   });
   nifChooser->set_font_size(16);
   add_widget("Choose NIF HDRI: ", nifChooser);
 
+  nifSwitchText = new nanogui::TextBox(window, "-");
+  nifSwitchText->set_editable(false);
+  nifSwitchText->set_units("sec");
+  nifSwitchText->set_alignment(nanogui::TextBox::Alignment::Right);
+  nifSwitchText->set_tooltip("Time from requesting the last NIF model until the first frame rendered with it was displayed.");
+  add_widget("NIF switch time:", nifSwitchText);
+
   // Camera controls
   add_group("Camera Parameters");
   fovSlider = new nanogui::Slider(window);
   fovSlider->set_fixed_width(250);
   fovSlider->set_callback([&](float value) {
-    serialise(sender, "fov", value * 360.f);
+    cameraState.fov = value * 360.f;
+    controls.updateCamera(cameraState, packets::CameraState::Fov);
+  });
+  fovSlider->set_final_callback([&](float value) {
+    cameraState.fov = value * 360.f;
+    controls.sendCameraNow(cameraState, packets::CameraState::Fov);
   });
-  fovSlider->set_value(90.f / 360.f);
-  fovSlider->callback()(fovSlider->value());
   add_widget("Field of View", fovSlider);
 
   // Subscribe to FOV updates from the server (on start-up the server can decide the initial value):
-  subs["fov"] = receiver.subscribe("fov", [this](const ComPacket::ConstSharedPacket& packet) {
+  handlers["fov"] = [this](const ComPacket::ConstSharedPacket& packet) {
     float fovRadians = 0.f;
     deserialise(packet, fovRadians);
     BOOST_LOG_TRIVIAL(trace) << "Received FOV update: " << fovRadians;
     fovSlider->set_value(fovRadians / (2.f * M_PI));
-  });
+  };
 
   // Sensor controls
   add_group("Film Parameters");
-  auto* exposureSlider = new nanogui::Slider(window);
+  exposureSlider = new nanogui::Slider(window);
   exposureSlider->set_fixed_width(250);
+  // When tone-mapping locally only the final values are sent to the server:
   exposureSlider->set_callback([&](float value) {
-    value = 4.f * (value - 0.5f);
-    serialise(sender, "exposure", value);
+    cameraState.exposure = 4.f * (value - 0.5f);
+    if (!updateLocalToneMapping()) {
+      controls.updateCamera(cameraState, packets::CameraState::Exposure);
+    }
+  });
+  exposureSlider->set_final_callback([&](float value) {
+    cameraState.exposure = 4.f * (value - 0.5f);
+    updateLocalToneMapping();
+    controls.sendCameraNow(cameraState, packets::CameraState::Exposure);
   });
-  exposureSlider->set_value(.5f);
-  exposureSlider->callback()(exposureSlider->value());
   add_widget("Exposure", exposureSlider);
 
-  auto* gammaSlider = new nanogui::Slider(window);
+  gammaSlider = new nanogui::Slider(window);
   gammaSlider->set_fixed_width(250);
   gammaSlider->set_callback([&](float value) {
-    value = 4.f * value;
-    serialise(sender, "gamma", value);
+    cameraState.gamma = 4.f * value;
+    if (!updateLocalToneMapping()) {
+      controls.updateCamera(cameraState, packets::CameraState::Gamma);
+    }
+  });
+  gammaSlider->set_final_callback([&](float value) {
+    cameraState.gamma = 4.f * value;
+    updateLocalToneMapping();
+    controls.sendCameraNow(cameraState, packets::CameraState::Gamma);
   });
-  gammaSlider->set_value(2.2f / 4.f);
-  gammaSlider->callback()(gammaSlider->value());
   add_widget("Gamma", gammaSlider);
 
+  auto* localToneMapBox = new nanogui::CheckBox(window, "Tone-map HDR locally");
+  localToneMapBox->set_tooltip("Display the raw HDR image with exposure and gamma applied on this machine so"
+                               " that they update instantly (only final values are sent to the server)."
+                               " Camera changes are not seen until the next raw image arrives. " + hdrDelayNote);
+  localToneMapBox->set_callback([this](bool checked) {
+    if (preview) {
+      preview->setLocalToneMapping(checked);
+      updateLocalToneMapping();
+    }
+  });
+  add_widget("Local display", localToneMapBox);
+
+  auto* overlayChooser = new nanogui::ComboBox(window, {"None", "Clipping", "False colour"});
+  overlayChooser->set_side(nanogui::Popup::Side::Left);
+  overlayChooser->set_tooltip("Overlay for the locally tone-mapped image: clipped highlights in magenta and crushed"
+                              " shadows in blue, or luminance from -8 to +4 stops in false colour.");
+  overlayChooser->set_callback([this](int index) {
+    if (preview) {
+      preview->setHdrOverlay(YuvImageView::HdrOverlay(index));
+    }
+  });
+  overlayChooser->set_font_size(16);
+  add_widget("HDR overlay", overlayChooser);
+
   auto* toggleButton = new nanogui::CheckBox(window);
   toggleButton->set_caption("Show raw HDR values on zoom.");
   toggleButton->set_callback([videoPreview](bool checked) {
@@ -110,71 +177,101 @@ ControlsForm::ControlsForm(nanogui::Screen* screen,
 
   add_group("Sampling Parameters");
   samplesText = new nanogui::TextBox(window, "-");
-  auto* samplesSlider = new nanogui::Slider(window);
+  samplesSlider = new nanogui::Slider(window);
   samplesSlider->set_tooltip("Reduce to improve frame-rate. Higher values improve preview quality but increase latency.");
   samplesSlider->set_fixed_width(250);
   samplesSlider->set_callback([&](float value) {
     samplesText->set_value(std::to_string(convertSampleValue(value)));
   });
   samplesSlider->set_final_callback([&](float value) {
-    const auto s = convertSampleValue(value);
-    serialise(sender, "interactive_samples", s);
-    BOOST_LOG_TRIVIAL(debug) << "Sending new interactive-sample count: " << s;
+    cameraState.interactiveSamples = convertSampleValue(value);
+    controls.sendCameraNow(cameraState, packets::CameraState::InteractiveSamples);
+    BOOST_LOG_TRIVIAL(debug) << "Sending new interactive-sample count: " << cameraState.interactiveSamples;
   });
-  samplesSlider->callback()(samplesSlider->value());
-  samplesSlider->final_callback()(samplesSlider->value());
   add_widget("Interactive samples", samplesSlider);
   samplesText->set_editable(false);
   samplesText->set_units(" per step");
   samplesText->set_alignment(nanogui::TextBox::Alignment::Right);
   add_widget("Sample count:", samplesText);
 
+  adaptiveSamplesBox = new nanogui::CheckBox(window, "Adjust automatically");
+  adaptiveSamplesBox->set_tooltip("Choose the sample count to hold the target frame rate while"
+                                  " interacting then raise it when idle.");
+  adaptiveSamplesBox->set_callback([this](bool checked) {
+    samplesSlider->set_enabled(!checked);
+    if (!checked) {
+      // Go back to the slider's value:
+      samplesSlider->final_callback()(samplesSlider->value());
+    }
+  });
+  add_widget("Adaptive samples", adaptiveSamplesBox);
+
+  auto* targetFpsBox = new nanogui::IntBox<int>(window, int(sampleController.options().targetFps));
+  targetFpsBox->set_editable(true);
+  targetFpsBox->set_min_max_values(1, 120);
+  targetFpsBox->set_spinnable(true);
+  targetFpsBox->set_units("fps");
+  targetFpsBox->set_alignment(nanogui::TextBox::Alignment::Right);
+  targetFpsBox->set_callback([this](int value) {
+    sampleController.options().targetFps = value;
+  });
+  add_widget("Target frame rate:", targetFpsBox);
+
+  auto* maxLatencyBox = new nanogui::IntBox<int>(window, int(sampleController.options().maxLatencyMs));
+  maxLatencyBox->set_editable(true);
+  maxLatencyBox->set_min_max_values(0, 5000);
+  maxLatencyBox->set_spinnable(true);
+  maxLatencyBox->set_value_increment(10);
+  maxLatencyBox->set_units("ms");
+  maxLatencyBox->set_alignment(nanogui::TextBox::Alignment::Right);
+  maxLatencyBox->set_tooltip("Also reduce samples while latency exceeds this (zero to ignore latency).");
+  maxLatencyBox->set_callback([this](int value) {
+    sampleController.options().maxLatencyMs = value;
+  });
+  add_widget("Target max latency:", maxLatencyBox);
+
+  // Send the initial value of every parameter in one update:
+  packets::CameraState initialState;
+  initialState.interactiveSamples = convertSampleValue(0.f);
+  applyCameraState(initialState);
+
   // Info/stats/status:
   add_group("Render Status");
-  auto progress = new nanogui::ProgressBar(window);
-  add_widget("Progress", progress);
+  auto progressBar = new nanogui::ProgressBar(window);
+  add_widget("Progress", progressBar);
 
-  add_button("Stop", [screen, &sender]() {
-    serialise(sender, "stop", true);
+  add_button("Stop", [screen, &controls]() {
+    controls.sendNow("stop", true);
     screen->set_visible(false);
   })->set_tooltip("Stop the remote application.");
 
   // Make a subscriber to receive progress updates:
   // (the progress pointer needs to be captured by value).
-  subs["progress"] = receiver.subscribe("progress", [progress](const ComPacket::ConstSharedPacket& packet) {
+  handlers["progress"] = [this, progressBar](const ComPacket::ConstSharedPacket& packet) {
     float progressValue = 0.f;
     deserialise(packet, progressValue);
-    progress->set_value(progressValue);
-  });
-
-  subs["hdr_header"] = receiver.subscribe("hdr_header", [&](const ComPacket::ConstSharedPacket& packet) {
-    deserialise(packet, hdrHeader);
-    hdrBuffer.resize(hdrHeader.width * hdrHeader.height * 3);
-    BOOST_LOG_TRIVIAL(debug) << "Large transfer initiated: "
-                             << hdrHeader.width << "x" << hdrHeader.height << " in " << hdrHeader.packets << " chunks.";
-    // Need to be sure the buffer is not accessed while it is incrementally updated:
-    hdrBufferMutex.lock();
-  });
+    progress = progressValue;
+    progressBar->set_value(progressValue);
+    hdrTiles.setProgress(progressValue);
+  };
 
-  subs["hdr_packet"] = receiver.subscribe("hdr_packet", [&](const ComPacket::ConstSharedPacket& packet) {
-    packets::HdrPacket p;
-    deserialise(packet, p);
-    BOOST_LOG_TRIVIAL(trace) << "Received large transfer packet number: "
-                             << p.id << " size: " << p.data.size();
-    if (hdrHeader.packets > 0) {
-      // Copy data into buffer:
-      auto offset = p.id * p.data.size();
-      std::copy(p.data.begin(), p.data.end(), hdrBuffer.data() + offset);
-      if (p.id == hdrHeader.packets - 1) {
-        // Final packet for current image has now been received:
-        hdrHeader.packets = 0;
-        preview->setRawBufferData(hdrBuffer);
-        hdrBufferMutex.unlock();
-        saveButton->set_enabled(true);
-      }
+  // Raw HDR images are reassembled off the UI thread. Consumers just
+  // share the completed image so it is never copied or locked:
+  hdrReceiver.setCompletionCallback([this](const HdrImageReceiver::ImagePtr& image) {
+    if (preview) {
+      preview->setRawImage(image);
     }
+    saveButton->set_enabled(true);
+    saveExrButton->set_enabled(true);
   });
 
+  // At high zoom the preview asks the server for full precision values of just the visible region:
+  if (preview && controls.getOptions().hdrRegionRequests) {
+    preview->setHdrTileSource(&hdrTiles, [&controls](const HdrTileCache::Region& region) {
+      controls.sendNow("hdr_region_request", packets::HdrRegionRequest{region.x, region.y, region.width, region.height});
+    });
+  }
+
   add_group("Info/Stats");
   bitRateText = new nanogui::TextBox(window, "-");
   bitRateText->set_editable(false);
@@ -188,6 +285,13 @@ ControlsForm::ControlsForm(nanogui::Screen* screen,
   frameRateText->set_alignment(nanogui::TextBox::Alignment::Right);
   add_widget("Frame rate:", frameRateText);
 
+  latencyText = new nanogui::TextBox(window, "-");
+  latencyText->set_editable(false);
+  latencyText->set_units("ms");
+  latencyText->set_alignment(nanogui::TextBox::Alignment::Right);
+  latencyText->set_tooltip("Time from the server encoding a frame to it being displayed (requires synchronised clocks).");
+  add_widget("Latency:", latencyText);
+
   auto text2 = new nanogui::TextBox(window, "-");
   text2->set_editable(false);
   text2->set_units("Mega-paths/sec");
@@ -200,23 +304,140 @@ ControlsForm::ControlsForm(nanogui::Screen* screen,
   text3->set_alignment(nanogui::TextBox::Alignment::Right);
   add_widget("Ray-cast rate:", text3);
 
-  subs["sample_rate"] = receiver.subscribe("sample_rate", [text2, text3](const ComPacket::ConstSharedPacket& packet) {
+  handlers["sample_rate"] = [this, text2, text3](const ComPacket::ConstSharedPacket& packet) {
     packets::SampleRates rates;
     deserialise(packet, rates);
+    pathRate = rates.pathRate;
+    rayRate = rates.rayRate;
     std::stringstream ss;
     ss << std::fixed << std::setprecision(1) << rates.pathRate / 1e6;
     text2->set_value(ss.str());
     ss.str(std::string());
     ss << std::fixed << std::setprecision(1) << rates.rayRate / 1e9;
     text3->set_value(ss.str());
-  });
+  };
+  subscribe(receiver);
 
   add_group("File Manager");
   saveButton = add_button("Save PFM", [&]() {
-    savePfm("image.pfm");
+    saveImage(ImageExporter::Format::Pfm);
   });
   saveButton->set_tooltip("Save raw HDR image as a portable float map (PFM). " + hdrDelayNote);
   saveButton->set_enabled(false);
+  saveExrButton = add_button("Save EXR", [&]() {
+    saveImage(ImageExporter::Format::Exr16);
+  });
+  saveExrButton->set_tooltip("Save raw HDR image as a half-float OpenEXR file. " + hdrDelayNote);
+  saveExrButton->set_enabled(false);
+
+  add_button("Save Preset", [this]() {
+    const auto file = nanogui::file_dialog({{"json", "Render parameter preset"}}, true);
+    if (!file.empty()) {
+      savePreset(file);
+    }
+  })->set_tooltip("Save the current render parameters to a JSON file.");
+  add_button("Load Preset", [this]() {
+    const auto file = nanogui::file_dialog({{"json", "Render parameter preset"}}, false);
+    if (!file.empty()) {
+      loadPreset(file);
+    }
+  })->set_tooltip("Load render parameters from a JSON file and send them to the server in one update.");
+}
+
+void ControlsForm::subscribe(PacketDemuxer& receiver) {
+  for (const auto& h : handlers) {
+    subs[h.first] = receiver.subscribe(h.first, h.second);
+  }
+}
+
+void ControlsForm::detach() {
+  subs.clear();
+  hdrReceiver.unsubscribe();
+  hdrTiles.unsubscribe();
+}
+
+void ControlsForm::attach(PacketDemuxer& receiver, PacketDemuxer& bulkReceiver) {
+  subscribe(receiver);
+  hdrReceiver.subscribe(bulkReceiver);
+  hdrTiles.subscribe(bulkReceiver);
+}
+
+void ControlsForm::resendState() {
+  if (!nifPath.empty()) {
+    loadNif(nifPath);
+  }
+  // The server may have changed the FOV since we last sent it:
+  cameraState.fov = fovSlider->value() * 360.f;
+  controls.sendCameraNow(cameraState, packets::CameraState::AllFields);
+}
+
+void ControlsForm::loadNif(const std::string& path) {
+  nifPath = path;
+  BOOST_LOG_TRIVIAL(debug) << "Sending new NIF path: " << nifPath;
+  controls.sendNow("load_nif", nifPath);
+
+  // Sent after load_nif so the server does not delay the model needed now:
+  if (controls.getOptions().nifPrefetch) {
+    const auto prefetch = nifPrefetchList(nifPath);
+    if (!prefetch.empty()) {
+      controls.sendNow("nif_prefetch", packets::NifPrefetch{prefetch});
+    }
+  }
+
+  // The switch can only be timed if there is a preview to show it:
+  if (preview == nullptr) {
+    return;
+  }
+  nifSwitchPending = true;
+  nifSwitchSent = std::chrono::steady_clock::now();
+  nifSwitchSentMicros = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  nifSwitchFrameCount = preview->getUploadedFrameCount();
+  nifSwitchText->set_value("...");
+}
+
+std::vector<std::string> ControlsForm::nifPrefetchList(const std::string& path) const {
+  // Models are usually reviewed by stepping through the menu so prefer
+  // the next ones down then the one above:
+  std::vector<std::string> paths;
+  const auto current = std::find_if(fileMapping.begin(), fileMapping.end(),
+                                    [&](const FileLookup::value_type& entry) { return entry.second == path; });
+  if (current == fileMapping.end()) {
+    return paths;
+  }
+  auto next = std::next(current);
+  for (std::size_t i = 0; i < nifPrefetchAhead && next != fileMapping.end(); ++i, ++next) {
+    paths.push_back(next->second);
+  }
+  if (current != fileMapping.begin()) {
+    paths.push_back(std::prev(current)->second);
+  }
+  // Several menu entries may refer to the same model:
+  paths.erase(std::remove(paths.begin(), paths.end(), path), paths.end());
+  return paths;
+}
+
+void ControlsForm::updateNifSwitchTime() {
+  if (!nifSwitchPending || preview == nullptr || preview->getUploadedFrameCount() == nifSwitchFrameCount) {
+    return;
+  }
+
+  // Frames that were queued or in flight when the request was sent
+  // show the old model. If the server sends frame timestamps, also skip
+  // frames it encoded before then (assumes synchronised clocks as for
+  // the latency measurement):
+  const auto received = preview->getUploadedReceiveTime();
+  const auto serverMicros = preview->getUploadedServerTimeMicros();
+  if (received < nifSwitchSent || (serverMicros >= 0 && serverMicros < nifSwitchSentMicros)) {
+    return;
+  }
+
+  nifSwitchPending = false;
+  const double seconds = std::chrono::duration<double>(preview->getUploadedTime() - nifSwitchSent).count();
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.2f", seconds);
+  nifSwitchText->set_value(text);
+  BOOST_LOG_TRIVIAL(info) << "NIF switch to '" << nifPath << "' took " << text << " seconds.";
 }
 
 void ControlsForm::set_position(const nanogui::Vector2i& pos) {
@@ -238,20 +459,92 @@ void ControlsForm::set_nif_selection(const FileLookup& nifFileMapping) {
   }
 }
 
-void ControlsForm::savePfm(const std::string& fileName) {
-  if (!hdrBuffer.empty()) {
-    // Do not want to save a partially received image:
-    std::lock_guard<std::mutex> lock(hdrBufferMutex);
-
-    // Last packet so write a PFM file:
-    std::ofstream f(fileName, std::ios::binary);
-    f << "PF\n";
-    f << std::to_string(hdrHeader.width) << " ";
-    f << std::to_string(hdrHeader.height) << "\n";
-    f << "-1.0\n";
-    for (auto r = hdrHeader.height - 1; r >= 0; --r) {
-      auto rowStart = reinterpret_cast<char*>(hdrBuffer.data() + (r * hdrHeader.width * 3));
-      f.write(rowStart, hdrHeader.width * 3 * sizeof(float));
-    }
+void ControlsForm::updateAdaptiveSamples(double fps, double latencyMs, std::int64_t framePixels) {
+  if (!adaptiveSamplesBox->checked()) {
+    return;
+  }
+
+  AdaptiveSampleController::Measurements m;
+  m.fps = fps;
+  m.latencyMs = latencyMs;
+  m.pathRate = pathRate;
+  m.pixels = framePixels;
+  const auto samples = sampleController.update(m, cameraState.interactiveSamples, controls.lastChangeTime());
+  if (samples != cameraState.interactiveSamples) {
+    cameraState.interactiveSamples = samples;
+    samplesSlider->set_value(samples / 16.f);
+    samplesText->set_value(std::to_string(samples));
+    controls.sendCameraNow(cameraState, packets::CameraState::InteractiveSamples);
+  }
+}
+
+bool ControlsForm::updateLocalToneMapping() {
+  if (preview == nullptr) {
+    return false;
+  }
+  preview->setToneMapping(cameraState.exposure, cameraState.gamma);
+  return preview->localToneMappingActive();
+}
+
+void ControlsForm::applyCameraState(const packets::CameraState& state) {
+  // Move the widgets without calling their callbacks (the
+  // wheel works in radians and the packets in degrees):
+  rotationWheel->set_value(state.envRotation / 360.f * 2.f * M_PI);
+  fovSlider->set_value(state.fov / 360.f);
+  exposureSlider->set_value(state.exposure / 4.f + 0.5f);
+  gammaSlider->set_value(state.gamma / 4.f);
+  samplesSlider->set_value(state.interactiveSamples / 16.f);
+  samplesText->set_value(std::to_string(state.interactiveSamples));
+
+  // Then send everything in a single update:
+  cameraState = state;
+  updateLocalToneMapping();
+  controls.sendCameraNow(cameraState, packets::CameraState::AllFields);
+}
+
+void ControlsForm::savePreset(const std::string& fileName) {
+  boost::property_tree::ptree pt;
+  pt.put("env_rotation", cameraState.envRotation);
+  pt.put("exposure", cameraState.exposure);
+  pt.put("gamma", cameraState.gamma);
+  pt.put("fov", fovSlider->value() * 360.f); // The server may have changed it.
+  pt.put("interactive_samples", cameraState.interactiveSamples);
+  try {
+    boost::property_tree::write_json(fileName, pt);
+    BOOST_LOG_TRIVIAL(info) << "Saved preset '" << fileName << "'";
+  } catch (const boost::property_tree::json_parser_error& e) {
+    BOOST_LOG_TRIVIAL(error) << "Could not save preset: " << e.what();
+  }
+}
+
+void ControlsForm::loadPreset(const std::string& fileName) {
+  boost::property_tree::ptree pt;
+  try {
+    boost::property_tree::read_json(fileName, pt);
+  } catch (const boost::property_tree::json_parser_error& e) {
+    BOOST_LOG_TRIVIAL(error) << "Could not load preset: " << e.what();
+    return;
+  }
+
+  // Missing entries keep their current values:
+  packets::CameraState state = cameraState;
+  state.envRotation = pt.get("env_rotation", state.envRotation);
+  state.exposure = pt.get("exposure", state.exposure);
+  state.gamma = pt.get("gamma", state.gamma);
+  state.fov = pt.get("fov", fovSlider->value() * 360.f);
+  state.interactiveSamples = std::min(16u, std::max(1u, pt.get("interactive_samples", state.interactiveSamples)));
+  BOOST_LOG_TRIVIAL(info) << "Loaded preset '" << fileName << "'";
+  applyCameraState(state);
+}
+
+void ControlsForm::saveImage(ImageExporter::Format format) {
+  // Only complete images are ever published so there is no need to worry
+  // about saving a partial transfer. The file is written in the background
+  // and the exporter shares the image so it is not copied:
+  const auto image = hdrReceiver.latestImage();
+  if (image) {
+    const auto fileName = ImageExporter::timestampedFileName("image", format);
+    BOOST_LOG_TRIVIAL(info) << "Saving HDR image to '" << fileName << "'";
+    exporter.save(image, fileName, format);
   }
 }
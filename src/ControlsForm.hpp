@@ -5,11 +5,17 @@
 #include <PacketComms.h>
 #include <nanogui/nanogui.h>
 
+#include <atomic>
 #include <map>
-#include <mutex>
 
+#include "AdaptiveSampleController.hpp"
+#include "ControlCoalescer.hpp"
+#include "HdrImageReceiver.hpp"
+#include "HdrTileCache.hpp"
+#include "ImageExporter.hpp"
 #include "PacketDescriptions.hpp"
 #include "VideoPreviewWindow.hpp"
+#include "custom_widgets/rotator.hpp"
 
 /// This control window sends and receives messages via a
 /// PacketMuxer and PacketDemuxer to enact a remote-controlled
@@ -18,14 +24,48 @@ class ControlsForm : public nanogui::FormHelper {
 public:
   using FileLookup = std::map<std::string, std::string>;
 
-  ControlsForm(nanogui::Screen* screen, PacketMuxer& sender, PacketDemuxer& receiver, VideoPreviewWindow* videoPreview);
+  /// Everything is sent through controls. Subscriptions are made on receiver
+  /// except for bulk HDR data which is received from bulkReceiver (these can
+  /// be the same demuxer).
+  ControlsForm(nanogui::Screen* screen, ControlCoalescer& controls,
+               PacketDemuxer& receiver, PacketDemuxer& bulkReceiver,
+               VideoPreviewWindow* videoPreview);
+
+  /// Release all subscriptions so that the current demuxer can be
+  /// destroyed, e.g. when the connection is lost.
+  void detach();
+
+  /// Subscribe everything to a new demuxer (e.g. after a reconnect).
+  void attach(PacketDemuxer& receiver, PacketDemuxer& bulkReceiver);
+
+  /// Send the loaded NIF model and all current render parameters
+  /// (e.g. to a server that may have restarted).
+  void resendState();
 
   void set_position(const nanogui::Vector2i& pos);
+  void set_title(const std::string& title) { window->set_title(title); }
+  nanogui::Vector2i window_size() const { return window->size(); }
 
   void set_nif_selection(const FileLookup& nifFileMapping);
 
+  /// If adaptive samples are enabled adjust the interactive sample count
+  /// from the latest measurements. Call once per UI frame.
+  void updateAdaptiveSamples(double fps, double latencyMs, std::int64_t framePixels);
+
+  /// Check whether the first frame rendered with a newly requested NIF
+  /// model has been displayed and if so show how long the switch took.
+  /// Call once per UI frame.
+  void updateNifSwitchTime();
+
+  /// Latest rates and progress reported by the server (safe to call
+  /// from any thread).
+  float getPathRate() const { return pathRate; }
+  float getRayRate() const { return rayRate; }
+  float getProgress() const { return progress; }
+
   nanogui::TextBox* bitRateText;
   nanogui::TextBox* frameRateText;
+  nanogui::TextBox* latencyText;
 
 private:
   FileLookup fileMapping;
@@ -35,15 +75,56 @@ private:
   // subscriber callbacks can access them:
   nanogui::ComboBox* nifChooser;
   nanogui::Button* saveButton;
+  Rotator* rotationWheel;
   nanogui::Slider* fovSlider;
+  nanogui::Slider* exposureSlider;
+  nanogui::Slider* gammaSlider;
+  nanogui::Slider* samplesSlider;
+  std::map<std::string, std::function<void(const ComPacket::ConstSharedPacket&)>> handlers;
   std::map<std::string, PacketSubscription> subs;
+  void subscribe(PacketDemuxer& receiver);
+  std::string nifPath; // Last model sent (empty if none).
+
+  /// Ask the server to load a NIF model (and hint which it is likely to
+  /// load next) and start timing the switch.
+  void loadNif(const std::string& path);
+  /// Paths of the models either side of path in the menu (in the order
+  /// they are likely to be chosen).
+  std::vector<std::string> nifPrefetchList(const std::string& path) const;
+
+  // Timing of the last NIF switch (from sending load_nif until the
+  // first frame rendered after it is displayed):
+  nanogui::TextBox* nifSwitchText;
+  bool nifSwitchPending;
+  std::chrono::steady_clock::time_point nifSwitchSent;
+  std::int64_t nifSwitchSentMicros; // System clock (to compare with frame timestamps).
+  std::uint64_t nifSwitchFrameCount; // Frames uploaded when load_nif was sent.
 
   nanogui::TextBox* samplesText;
 
   // Receive raw image:
   VideoPreviewWindow* preview;
-  packets::HdrHeader hdrHeader;
-  std::vector<float> hdrBuffer;
-  std::mutex hdrBufferMutex;
-  void savePfm(const std::string& filename);
+  HdrImageReceiver hdrReceiver;
+  HdrTileCache hdrTiles;
+  ImageExporter exporter;
+  nanogui::Button* saveExrButton;
+  void saveImage(ImageExporter::Format format);
+
+  // Render parameters (all sent through the coalescer):
+  ControlCoalescer& controls;
+  packets::CameraState cameraState;
+  /// Apply the current exposure and gamma to the preview's local tone-mapping.
+  /// @return true if the preview is tone-mapping locally (so drags need not be sent).
+  bool updateLocalToneMapping();
+  /// Set the widgets to match state and send all of it to the server.
+  void applyCameraState(const packets::CameraState& state);
+  void savePreset(const std::string& fileName);
+  void loadPreset(const std::string& fileName);
+
+  AdaptiveSampleController sampleController;
+  nanogui::CheckBox* adaptiveSamplesBox;
+  // Written by the demuxer thread:
+  std::atomic<float> pathRate;
+  std::atomic<float> rayRate;
+  std::atomic<float> progress;
 };
@@ -0,0 +1,24 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "DecodedVideoFrame.hpp"
+
+void DecodedVideoFrame::extract(VideoDecoder& stream, bool yuvPlanes, int rgbChannels) {
+  width = stream.getFrameWidth();
+  height = stream.getFrameHeight();
+  yuv = yuvPlanes;
+  if (yuv) {
+    pixels.resize(width * height + 2 * chromaWidth() * chromaHeight());
+    auto* y = pixels.data();
+    auto* u = y + width * height;
+    auto* v = u + chromaWidth() * chromaHeight();
+    stream.extractYuv420Planes(y, u, v);
+    coefficients = stream.getYuvToRgbCoefficients();
+  } else {
+    pixels.resize(width * height * rgbChannels);
+    if (rgbChannels == 3) {
+      stream.extractRgbImage(pixels.data(), width * rgbChannels);
+    } else {
+      stream.extractRgbaImage(pixels.data(), width * rgbChannels);
+    }
+  }
+}
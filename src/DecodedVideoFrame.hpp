@@ -0,0 +1,34 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "BufferPool.hpp"
+#include "FrameStats.hpp"
+#include "VideoDecoder.hpp"
+
+/// A decoded video frame ready for upload: either packed RGB(A) or
+/// tightly packed YUV 4:2:0 planes (Y then U then V). Kept free of any
+/// GUI dependency so that the decode path can also be benchmarked headless.
+struct DecodedVideoFrame {
+  PooledVector<std::uint8_t> pixels;
+  int width = 0;
+  int height = 0;
+  bool yuv = false;
+  YuvToRgbCoefficients coefficients;
+  std::int64_t serverTimeMicros = -1;
+  FrameTiming timing;
+
+  /// Copy (or convert) the decoder's current frame into this one. The pixel
+  /// buffer is only reallocated if the frame dimensions or format change.
+  /// @param rgbChannels Channels per pixel (3 or 4) when not extracting YUV.
+  void extract(VideoDecoder& stream, bool yuvPlanes, int rgbChannels);
+
+  const std::uint8_t* yPlane() const { return pixels.data(); }
+  const std::uint8_t* uPlane() const { return yPlane() + width * height; }
+  const std::uint8_t* vPlane() const { return uPlane() + chromaWidth() * chromaHeight(); }
+  int chromaWidth() const { return (width + 1) / 2; }
+  int chromaHeight() const { return (height + 1) / 2; }
+};
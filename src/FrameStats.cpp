@@ -0,0 +1,195 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "FrameStats.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+
+namespace {
+
+constexpr FrameStats::Stage allStages[] = {
+    FrameStats::Stage::Queue, FrameStats::Stage::Decode, FrameStats::Stage::Convert,
+    FrameStats::Stage::Handoff, FrameStats::Stage::Upload, FrameStats::Stage::Present,
+    FrameStats::Stage::Total};
+
+double millis(FrameTiming::Clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// Histogram range (in ms):
+constexpr double histogramMinMs = 0.1;
+constexpr double histogramMaxMs = 1000.0;
+
+} // end anonymous namespace
+
+const char* FrameStats::stageName(Stage stage) {
+  switch (stage) {
+    case Stage::Queue: return "queue";
+    case Stage::Decode: return "decode";
+    case Stage::Convert: return "convert";
+    case Stage::Handoff: return "handoff";
+    case Stage::Upload: return "upload";
+    case Stage::Present: return "present";
+    case Stage::Total: return "total";
+    default: return "unknown";
+  }
+}
+
+double FrameStats::stageMillis(const FrameTiming& t, Stage stage) {
+  switch (stage) {
+    case Stage::Queue: return millis(t.dequeued - t.received);
+    case Stage::Decode: return t.decodeMicros / 1000.0;
+    case Stage::Convert: return millis(t.converted - t.decoded);
+    case Stage::Handoff: return millis(t.uploadStart - t.converted);
+    case Stage::Upload: return millis(t.uploaded - t.uploadStart);
+    case Stage::Present: return millis(t.presented - t.uploaded);
+    case Stage::Total: return millis(t.presented - t.received);
+    default: return 0.0;
+  }
+}
+
+FrameStats::FrameStats(std::size_t windowFrames)
+    : window(std::max<std::size_t>(windowFrames, 1)),
+      next(0) {
+  frames.reserve(window);
+}
+
+void FrameStats::record(const FrameTiming& timing) {
+  if (frames.size() < window) {
+    frames.push_back(timing);
+  } else {
+    frames[next] = timing;
+  }
+  next = (next + 1) % window;
+}
+
+std::vector<const FrameTiming*> FrameStats::ordered() const {
+  std::vector<const FrameTiming*> result;
+  result.reserve(frames.size());
+  const std::size_t start = frames.size() < window ? 0 : next;
+  for (std::size_t i = 0; i < frames.size(); ++i) {
+    result.push_back(&frames[(start + i) % frames.size()]);
+  }
+  return result;
+}
+
+FrameStats::Summary FrameStats::summary(Stage stage) const {
+  Summary s;
+  if (frames.empty()) {
+    return s;
+  }
+
+  std::vector<double> values;
+  values.reserve(frames.size());
+  for (const auto& f : frames) {
+    values.push_back(stageMillis(f, stage));
+  }
+  std::sort(values.begin(), values.end());
+  auto percentile = [&](double p) {
+    return values[std::min(values.size() - 1, std::size_t(p * values.size()))];
+  };
+  s.p50Ms = percentile(0.5);
+  s.p99Ms = percentile(0.99);
+  s.maxMs = values.back();
+  return s;
+}
+
+std::vector<float> FrameStats::histogram(Stage stage, std::size_t binCount) const {
+  std::vector<float> bins(binCount, 0.f);
+  if (frames.empty() || binCount == 0) {
+    return bins;
+  }
+
+  const double logMin = std::log(histogramMinMs);
+  const double logRange = std::log(histogramMaxMs) - logMin;
+  for (const auto& f : frames) {
+    const double ms = std::max(stageMillis(f, stage), histogramMinMs);
+    const double position = (std::log(ms) - logMin) / logRange;
+    const auto bin = std::min(binCount - 1, std::size_t(std::max(0.0, position * binCount)));
+    bins[bin] += 1.f;
+  }
+  for (auto& b : bins) {
+    b /= frames.size();
+  }
+  return bins;
+}
+
+bool FrameStats::exportCsv(const std::string& fileName) const {
+  std::ofstream out(fileName);
+  if (!out) {
+    BOOST_LOG_TRIVIAL(error) << "Could not open '" << fileName << "' for writing.";
+    return false;
+  }
+
+  out << "frame";
+  for (auto stage : allStages) {
+    out << "," << stageName(stage) << "_ms";
+  }
+  out << "\n" << std::fixed << std::setprecision(3);
+  for (const auto* f : ordered()) {
+    out << f->frameNumber;
+    for (auto stage : allStages) {
+      out << "," << stageMillis(*f, stage);
+    }
+    out << "\n";
+  }
+
+  BOOST_LOG_TRIVIAL(info) << "Saved timings of " << frames.size() << " frames to '" << fileName << "'";
+  return bool(out);
+}
+
+bool FrameStats::exportChromeTrace(const std::string& fileName) const {
+  std::ofstream out(fileName);
+  if (!out) {
+    BOOST_LOG_TRIVIAL(error) << "Could not open '" << fileName << "' for writing.";
+    return false;
+  }
+
+  const auto frameList = ordered();
+  if (frameList.empty()) {
+    out << "{\"traceEvents\":[]}\n";
+    return bool(out);
+  }
+
+  // One track per thread that does the work:
+  enum Track { Network = 1, Decoder = 2, Ui = 3 };
+  const auto epoch = frameList.front()->received;
+  auto micros = [&](FrameTiming::Clock::time_point t) {
+    return std::chrono::duration<double, std::micro>(t - epoch).count();
+  };
+
+  out << "{\"traceEvents\":[\n" << std::fixed << std::setprecision(1);
+  const char* threadNames[] = {"", "network", "decoder", "ui"};
+  for (int track = Network; track <= Ui; ++track) {
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << track
+        << ",\"args\":{\"name\":\"" << threadNames[track] << "\"}},\n";
+  }
+
+  bool first = true;
+  auto event = [&](const char* name, int track, FrameTiming::Clock::time_point start, double durationMicros,
+                   std::uint64_t frame) {
+    out << (first ? "" : ",\n") << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << track
+        << ",\"ts\":" << micros(start) << ",\"dur\":" << std::max(0.0, durationMicros)
+        << ",\"args\":{\"frame\":" << frame << "}}";
+    first = false;
+  };
+
+  for (const auto* f : frameList) {
+    const auto n = f->frameNumber;
+    event(stageName(Stage::Queue), Network, f->received, stageMillis(*f, Stage::Queue) * 1000.0, n);
+    const auto decodeStart = f->decoded - std::chrono::microseconds(f->decodeMicros);
+    event(stageName(Stage::Decode), Decoder, decodeStart, double(f->decodeMicros), n);
+    event(stageName(Stage::Convert), Decoder, f->decoded, stageMillis(*f, Stage::Convert) * 1000.0, n);
+    event(stageName(Stage::Handoff), Ui, f->converted, stageMillis(*f, Stage::Handoff) * 1000.0, n);
+    event(stageName(Stage::Upload), Ui, f->uploadStart, stageMillis(*f, Stage::Upload) * 1000.0, n);
+    event(stageName(Stage::Present), Ui, f->uploaded, stageMillis(*f, Stage::Present) * 1000.0, n);
+  }
+  out << "\n]}\n";
+
+  BOOST_LOG_TRIVIAL(info) << "Saved trace of " << frameList.size() << " frames to '" << fileName << "'";
+  return bool(out);
+}
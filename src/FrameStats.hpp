@@ -0,0 +1,81 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// Times at which a video frame passed through each stage on its way to
+/// the screen. Each is filled in by the thread doing that stage's work
+/// as the frame moves through the pipeline.
+struct FrameTiming {
+  using Clock = std::chrono::steady_clock;
+
+  std::uint64_t frameNumber = 0;
+  Clock::time_point received;    // The last packet the frame needed arrived (demuxer callback).
+  Clock::time_point dequeued;    // That packet was taken from the queue by the decoder.
+  Clock::time_point decoded;     // The decoder returned the frame.
+  std::int64_t decodeMicros = 0; // Time spent decoding (excluding waiting for packets).
+  Clock::time_point converted;   // The frame was extracted/converted for upload.
+  Clock::time_point uploadStart; // The UI thread started the texture upload.
+  Clock::time_point uploaded;
+  Clock::time_point presented;   // The buffers were swapped after drawing the frame.
+};
+
+/// Collects the timings of the most recent frames for display
+/// (percentiles and histograms of each stage) and export.
+///
+/// Not thread safe: frames are recorded and queried on the UI thread.
+class FrameStats {
+public:
+  enum class Stage {
+    Queue,   // Waiting in the compressed packet queue.
+    Decode,  // Decoding (excluding waiting for packets).
+    Convert, // Copying or converting the decoded frame for upload.
+    Handoff, // Waiting for the UI thread to pick the frame up.
+    Upload,  // Texture upload.
+    Present, // Drawing the UI and swapping buffers.
+    Total,   // Packet received to frame presented.
+    Count
+  };
+
+  static const char* stageName(Stage stage);
+  static double stageMillis(const FrameTiming& timing, Stage stage);
+
+  struct Summary {
+    double p50Ms = 0.0;
+    double p99Ms = 0.0;
+    double maxMs = 0.0;
+  };
+
+  /// @param windowFrames Number of recent frames to keep.
+  explicit FrameStats(std::size_t windowFrames = 1024);
+
+  void record(const FrameTiming& timing);
+
+  /// Number of frames currently held.
+  std::size_t frameCount() const { return frames.size(); }
+
+  Summary summary(Stage stage) const;
+
+  /// Fraction of frames in each of binCount logarithmically spaced bins
+  /// from 0.1 ms to 1 s (times outside the range go in the end bins).
+  std::vector<float> histogram(Stage stage, std::size_t binCount) const;
+
+  /// Write one row per frame with the duration of each stage in ms.
+  bool exportCsv(const std::string& fileName) const;
+
+  /// Write the frames as a Chrome trace (chrome://tracing or Perfetto)
+  /// with one track per thread so overlapping stages can be seen.
+  bool exportChromeTrace(const std::string& fileName) const;
+
+private:
+  /// Frames in the order they were recorded.
+  std::vector<const FrameTiming*> ordered() const;
+
+  const std::size_t window;
+  std::vector<FrameTiming> frames; // Ring buffer once full.
+  std::size_t next;
+};
@@ -0,0 +1,159 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "HalfFloat.hpp"
+
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HALF_FLOAT_F16C
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define HALF_FLOAT_NEON
+#include <arm_neon.h>
+#endif
+
+float halfToFloat(std::uint16_t h) {
+  const std::uint32_t sign = std::uint32_t(h & 0x8000u) << 16;
+  std::uint32_t exponent = (h >> 10) & 0x1fu;
+  std::uint32_t mantissa = h & 0x3ffu;
+  std::uint32_t bits;
+
+  if (exponent == 0x1fu) {
+    // Inf or NaN:
+    bits = sign | 0x7f800000u | (mantissa << 13);
+  } else if (exponent == 0) {
+    if (mantissa == 0) {
+      bits = sign;
+    } else {
+      // Subnormal half is a normal float so renormalise it:
+      exponent = 127 - 15 + 1;
+      while ((mantissa & 0x400u) == 0) {
+        mantissa <<= 1;
+        exponent -= 1;
+      }
+      mantissa &= 0x3ffu;
+      bits = sign | (exponent << 23) | (mantissa << 13);
+    }
+  } else {
+    bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+  }
+
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+std::uint16_t floatToHalf(float f) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  const std::uint16_t sign = (bits >> 16) & 0x8000u;
+  const std::uint32_t magnitude = bits & 0x7fffffffu;
+
+  if (magnitude >= 0x7f800000u) {
+    // Inf or NaN (keep NaNs quiet and non-zero):
+    const std::uint16_t nan = magnitude > 0x7f800000u ? 0x200u | ((magnitude >> 13) & 0x3ffu) : 0;
+    return sign | 0x7c00u | nan;
+  }
+
+  if (magnitude >= 0x477ff000u) {
+    // Rounds to a value larger than the maximum half (65504):
+    return sign | 0x7c00u;
+  }
+
+  if (magnitude < 0x38800000u) {
+    // Result is subnormal (or zero):
+    if (magnitude < 0x33000000u) {
+      return sign;
+    }
+    const std::uint32_t exponent = magnitude >> 23;
+    const std::uint32_t mantissa = (magnitude & 0x7fffffu) | 0x800000u;
+    const std::uint32_t shift = 126 - exponent;
+    std::uint32_t half = mantissa >> shift;
+    const std::uint32_t remainder = mantissa & ((1u << shift) - 1);
+    const std::uint32_t halfway = 1u << (shift - 1);
+    if (remainder > halfway || (remainder == halfway && (half & 1))) {
+      half += 1;
+    }
+    return sign | half;
+  }
+
+  // Normal: re-bias the exponent and round the mantissa (a
+  // carry correctly propagates into the exponent):
+  std::uint32_t half = (magnitude - 0x38000000u) >> 13;
+  const std::uint32_t remainder = magnitude & 0x1fffu;
+  if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1))) {
+    half += 1;
+  }
+  return sign | half;
+}
+
+namespace {
+
+void halfPlanesToFloatScalar(const std::uint8_t* lo, const std::uint8_t* hi,
+                             float* dst, std::size_t begin, std::size_t count) {
+  for (auto i = begin; i < count; ++i) {
+    dst[i] = halfToFloat(std::uint16_t(lo[i]) | (std::uint16_t(hi[i]) << 8));
+  }
+}
+
+#if defined(HALF_FLOAT_F16C)
+
+__attribute__((target("avx,f16c")))
+void halfPlanesToFloatF16C(const std::uint8_t* lo, const std::uint8_t* hi,
+                           float* dst, std::size_t count) {
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    // Interleave the planes back into 8 little-endian halves:
+    const __m128i l = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(lo + i));
+    const __m128i h = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(hi + i));
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_unpacklo_epi8(l, h)));
+  }
+  halfPlanesToFloatScalar(lo, hi, dst, i, count);
+}
+
+bool haveF16C() {
+  static const bool supported = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+  return supported;
+}
+
+#elif defined(HALF_FLOAT_NEON)
+
+void halfPlanesToFloatNeon(const std::uint8_t* lo, const std::uint8_t* hi,
+                           float* dst, std::size_t count) {
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const uint8x8x2_t zipped = vzip_u8(vld1_u8(lo + i), vld1_u8(hi + i));
+    const float16x8_t halves = vreinterpretq_f16_u8(vcombine_u8(zipped.val[0], zipped.val[1]));
+    vst1q_f32(dst + i, vcvt_f32_f16(vget_low_f16(halves)));
+    vst1q_f32(dst + i + 4, vcvt_high_f32_f16(halves));
+  }
+  halfPlanesToFloatScalar(lo, hi, dst, i, count);
+}
+
+#endif
+
+} // end anonymous namespace
+
+void halfPlanesToFloat(const std::uint8_t* lowBytes, const std::uint8_t* highBytes,
+                       float* dst, std::size_t count) {
+#if defined(HALF_FLOAT_F16C)
+  if (haveF16C()) {
+    halfPlanesToFloatF16C(lowBytes, highBytes, dst, count);
+    return;
+  }
+#elif defined(HALF_FLOAT_NEON)
+  halfPlanesToFloatNeon(lowBytes, highBytes, dst, count);
+  return;
+#endif
+  halfPlanesToFloatScalar(lowBytes, highBytes, dst, 0, count);
+}
+
+bool halfFloatSimdAvailable() {
+#if defined(HALF_FLOAT_F16C)
+  return haveF16C();
+#elif defined(HALF_FLOAT_NEON)
+  return true;
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,22 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// Convert one IEEE half precision value to single precision.
+float halfToFloat(std::uint16_t h);
+
+/// Convert a single precision value to half precision (rounding to
+/// nearest even, overflowing to infinity).
+std::uint16_t floatToHalf(float f);
+
+/// Convert count half precision values stored as byte-shuffled planes
+/// (all low bytes followed by all high bytes) to single precision.
+/// Uses F16C (x86) or NEON (AArch64) when available.
+void halfPlanesToFloat(const std::uint8_t* lowBytes, const std::uint8_t* highBytes,
+                       float* dst, std::size_t count);
+
+/// True if halfPlanesToFloat() is using a SIMD implementation.
+bool halfFloatSimdAvailable();
@@ -0,0 +1,230 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "HdrImageReceiver.hpp"
+#include "HalfFloat.hpp"
+
+#include <PacketSerialisation.h>
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef REMOTE_UI_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+HdrImageReceiver::HdrImageReceiver(PacketDemuxer& receiver)
+    : chunksRemaining(0) {
+  subscribe(receiver);
+  BOOST_LOG_TRIVIAL(debug) << "HDR fp16 decode is " << (halfFloatSimdAvailable() ? "" : "not ") << "SIMD accelerated.";
+}
+
+void HdrImageReceiver::subscribe(PacketDemuxer& receiver) {
+  headerSubscription = receiver.subscribe("hdr_header", [this](const ComPacket::ConstSharedPacket& packet) {
+    packets::HdrHeader header;
+    deserialise(packet, header);
+    beginTransfer(header);
+  });
+
+  chunkSubscription = receiver.subscribe("hdr_packet", [this](const ComPacket::ConstSharedPacket& packet) {
+    // Deserialising into the same object each time reuses its
+    // vector's capacity so this does not allocate per chunk:
+    deserialise(packet, legacyChunk);
+    receiveChunk(legacyChunk);
+  });
+
+  encodedChunkSubscription = receiver.subscribe("hdr_packet_encoded", [this](const ComPacket::ConstSharedPacket& packet) {
+    // Reuses the data vector's capacity as for hdr_packet:
+    deserialise(packet, encodedChunk);
+    const packets::HdrChunkHeader header{encodedChunk.id, encodedChunk.encoding, encodedChunk.valueCount,
+                                         std::uint32_t(encodedChunk.data.size())};
+    receiveEncodedChunk(header, encodedChunk.data.data());
+  });
+
+  rawChunkSubscription = receiver.subscribe("hdr_packet_raw", [this](const ComPacket::ConstSharedPacket& packet) {
+    // Decoded in place from the payload (see packets::HdrChunkHeader):
+    packets::HdrChunkHeader header;
+    const auto* data = packets::parseHdrChunk(packet->getData().data(), packet->getDataSize(), header);
+    if (data == nullptr) {
+      BOOST_LOG_TRIVIAL(warning) << "Ignoring truncated HDR chunk packet of " << packet->getDataSize() << " bytes.";
+      return;
+    }
+    receiveEncodedChunk(header, data);
+  });
+}
+
+void HdrImageReceiver::unsubscribe() {
+  headerSubscription = PacketSubscription();
+  chunkSubscription = PacketSubscription();
+  encodedChunkSubscription = PacketSubscription();
+  rawChunkSubscription = PacketSubscription();
+  // A transfer in progress will not be completed on a new connection:
+  chunksRemaining = 0;
+}
+
+void HdrImageReceiver::beginTransfer(const packets::HdrHeader& header) {
+  if (chunksRemaining > 0) {
+    BOOST_LOG_TRIVIAL(warning) << "HDR transfer abandoned with " << chunksRemaining << " of "
+                               << receivedChunks.size() << " chunks missing.";
+  }
+
+  BOOST_LOG_TRIVIAL(debug) << "Large transfer initiated: "
+                           << header.width << "x" << header.height << " in " << header.packets << " chunks.";
+
+  if (header.width <= 0 || header.height <= 0 || header.packets == 0) {
+    BOOST_LOG_TRIVIAL(warning) << "Ignoring invalid HDR header.";
+    chunksRemaining = 0;
+    return;
+  }
+
+  // Reuse an incomplete back buffer or the previous front buffer (once
+  // no consumer holds it any more) to avoid reallocating ~100MB per image:
+  if (!back) {
+    if (spare && spare.use_count() == 1) {
+      back = std::move(spare);
+    } else {
+      back = std::make_shared<HdrImage>();
+    }
+  }
+  spare.reset();
+
+  back->width = header.width;
+  back->height = header.height;
+  back->pixels.resize(std::size_t(header.width) * header.height * 3);
+  receivedChunks.assign(header.packets, false);
+  chunksRemaining = header.packets;
+}
+
+float* HdrImageReceiver::chunkDestination(std::uint32_t id, std::size_t valueCount) {
+  BOOST_LOG_TRIVIAL(trace) << "Received large transfer packet number: "
+                           << id << " size: " << valueCount;
+  if (chunksRemaining == 0) {
+    // No transfer in progress (e.g. the header was invalid):
+    return nullptr;
+  }
+
+  if (id >= receivedChunks.size()) {
+    BOOST_LOG_TRIVIAL(warning) << "Ignoring HDR chunk with out of range id: " << id;
+    return nullptr;
+  }
+
+  if (receivedChunks[id]) {
+    BOOST_LOG_TRIVIAL(debug) << "Ignoring duplicate HDR chunk: " << id;
+    return nullptr;
+  }
+
+  // All chunks except the last are the same size so the
+  // last one is placed at the end of the buffer:
+  auto& pixels = back->pixels;
+  const bool last = id == receivedChunks.size() - 1;
+  const std::size_t offset = last ? pixels.size() - std::min(pixels.size(), valueCount)
+                                  : std::size_t(id) * valueCount;
+  if (offset + valueCount > pixels.size()) {
+    BOOST_LOG_TRIVIAL(warning) << "Ignoring HDR chunk " << id << " that overruns the image.";
+    return nullptr;
+  }
+
+  return pixels.data() + offset;
+}
+
+void HdrImageReceiver::chunkDone(std::uint32_t id) {
+  receivedChunks[id] = true;
+  chunksRemaining -= 1;
+
+  if (chunksRemaining == 0) {
+    publish();
+  }
+}
+
+void HdrImageReceiver::receiveChunk(const packets::HdrPacket& chunk) {
+  auto* dst = chunkDestination(chunk.id, chunk.data.size());
+  if (dst) {
+    std::copy(chunk.data.begin(), chunk.data.end(), dst);
+    chunkDone(chunk.id);
+  }
+}
+
+namespace {
+
+bool decodeHalfPlanes(const std::uint8_t* data, std::size_t size,
+                      std::size_t valueCount, float* dst) {
+  if (size != valueCount * 2) {
+    BOOST_LOG_TRIVIAL(warning) << "HDR fp16 data has " << size << " bytes, expected " << valueCount * 2;
+    return false;
+  }
+  halfPlanesToFloat(data, data + valueCount, dst, valueCount);
+  return true;
+}
+
+} // end anonymous namespace
+
+bool decodeHdrData(std::uint32_t encoding, const std::uint8_t* data, std::size_t dataSize,
+                   std::size_t valueCount, float* dst, std::vector<std::uint8_t>& scratch) {
+  switch (static_cast<packets::HdrEncoding>(encoding)) {
+    case packets::HdrEncoding::Float32:
+      if (dataSize != valueCount * sizeof(float)) {
+        BOOST_LOG_TRIVIAL(warning) << "HDR float data has " << dataSize << " bytes, expected " << valueCount * sizeof(float);
+        return false;
+      }
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      for (std::size_t i = 0; i < valueCount; ++i) {
+        const auto bits = packets::readLittleEndian32(data + i * sizeof(float));
+        std::memcpy(dst + i, &bits, sizeof(float));
+      }
+#else
+      std::memcpy(dst, data, dataSize);
+#endif
+      return true;
+    case packets::HdrEncoding::Float16:
+      return decodeHalfPlanes(data, dataSize, valueCount, dst);
+#ifdef REMOTE_UI_HAVE_ZSTD
+    case packets::HdrEncoding::Float16Zstd: {
+      scratch.resize(valueCount * 2);
+      const auto size = ZSTD_decompress(scratch.data(), scratch.size(), data, dataSize);
+      if (ZSTD_isError(size)) {
+        BOOST_LOG_TRIVIAL(warning) << "HDR data decompression failed: " << ZSTD_getErrorName(size);
+        return false;
+      }
+      return decodeHalfPlanes(scratch.data(), size, valueCount, dst);
+    }
+#endif
+    default:
+      BOOST_LOG_TRIVIAL(warning) << "Unsupported HDR data encoding: " << encoding;
+      return false;
+  }
+}
+
+void HdrImageReceiver::receiveEncodedChunk(const packets::HdrChunkHeader& chunk, const std::uint8_t* data) {
+  auto* dst = chunkDestination(chunk.id, chunk.valueCount);
+  if (dst == nullptr) {
+    return;
+  }
+
+  // A chunk that fails to decode is treated as dropped:
+  if (decodeHdrData(chunk.encoding, data, chunk.dataSize, chunk.valueCount, dst, scratch)) {
+    chunkDone(chunk.id);
+  }
+}
+
+std::uint32_t HdrImageReceiver::supportedEncodings() {
+  using packets::HdrEncoding;
+  std::uint32_t encodings = packets::encodingBit(HdrEncoding::Float32) | packets::encodingBit(HdrEncoding::Float16);
+#ifdef REMOTE_UI_HAVE_ZSTD
+  encodings |= packets::encodingBit(HdrEncoding::Float16Zstd);
+#endif
+  return encodings;
+}
+
+void HdrImageReceiver::publish() {
+  // Swap the completed image to the front. The old front is kept (if
+  // nobody else is using it by the next transfer) as the next back buffer:
+  auto previous = std::atomic_exchange(&front, ImagePtr(back));
+  spare = std::const_pointer_cast<HdrImage>(previous);
+  BOOST_LOG_TRIVIAL(debug) << "Large transfer complete: " << back->width << "x" << back->height;
+  back.reset();
+
+  if (onComplete) {
+    onComplete(latestImage());
+  }
+}
@@ -0,0 +1,91 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <PacketComms.h>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "BufferPool.hpp"
+#include "PacketDescriptions.hpp"
+
+/// A complete HDR image received from the server.
+struct HdrImage {
+  std::int32_t width = 0;
+  std::int32_t height = 0;
+  /// Packed RGB floats, top row first.
+  PooledVector<float> pixels;
+};
+
+/// Decode valueCount floats in the given packets::HdrEncoding to dst.
+/// scratch is used (and resized) if the encoding needs a temporary buffer.
+/// @return false (after logging why) if the data could not be decoded.
+bool decodeHdrData(std::uint32_t encoding, const std::uint8_t* data, std::size_t dataSize,
+                   std::size_t valueCount, float* dst, std::vector<std::uint8_t>& scratch);
+
+/// Reassembles the chunked HDR image that the server sends as an
+/// hdr_header followed by hdr_packet chunks.
+///
+/// Chunks are written by id into a back buffer and tracked in a
+/// bitmap so they may arrive in any order. When every chunk has been
+/// received the back buffer is published with an atomic pointer swap:
+/// consumers just take a shared_ptr to the latest complete image so
+/// no locks are held across the transfer and nothing is copied. If a
+/// new header arrives before a transfer completes the partial image
+/// is discarded and the previous complete image remains current.
+///
+/// Chunks may also arrive as hdr_packet_encoded or hdr_packet_raw in
+/// any of the encodings returned by supportedEncodings() (which the
+/// client advertises to the server before syncing).
+class HdrImageReceiver {
+public:
+  using ImagePtr = std::shared_ptr<const HdrImage>;
+  using Callback = std::function<void(const ImagePtr&)>;
+
+  HdrImageReceiver(PacketDemuxer& receiver);
+  virtual ~HdrImageReceiver() {}
+
+  /// Receive images from a different demuxer (e.g. after a reconnect).
+  /// Must not be called while subscribed: call unsubscribe() first.
+  /// The latest completed image is kept.
+  void subscribe(PacketDemuxer& receiver);
+  void unsubscribe();
+
+  /// The most recently completed image (or null if none has been
+  /// received yet). Safe to call from any thread.
+  ImagePtr latestImage() const { return std::atomic_load(&front); }
+
+  /// Set a function to be called (on the demuxer thread) each
+  /// time a new image is complete.
+  void setCompletionCallback(Callback callback) { onComplete = callback; }
+
+  /// Bitmask of packets::HdrEncoding values this build can decode.
+  static std::uint32_t supportedEncodings();
+
+private:
+  void beginTransfer(const packets::HdrHeader& header);
+  float* chunkDestination(std::uint32_t id, std::size_t valueCount);
+  void chunkDone(std::uint32_t id);
+  void receiveChunk(const packets::HdrPacket& chunk);
+  void receiveEncodedChunk(const packets::HdrChunkHeader& chunk, const std::uint8_t* data);
+  void publish();
+
+  // Everything below is only accessed on the demuxer thread
+  // except for 'front' which is only accessed atomically:
+  ImagePtr front;
+  std::shared_ptr<HdrImage> back;
+  std::shared_ptr<HdrImage> spare;
+  std::vector<bool> receivedChunks;
+  std::uint32_t chunksRemaining;
+  std::vector<std::uint8_t> scratch; // Decompression buffer.
+  packets::HdrPacket legacyChunk;
+  packets::HdrEncodedPacket encodedChunk;
+  Callback onComplete;
+  PacketSubscription headerSubscription;
+  PacketSubscription chunkSubscription;
+  PacketSubscription encodedChunkSubscription;
+  PacketSubscription rawChunkSubscription;
+};
@@ -0,0 +1,118 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "HdrTileCache.hpp"
+#include "HdrImageReceiver.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+
+namespace {
+
+// Tiles are small (a zoomed in view) so a few are enough to
+// cover panning back and forth without re-requesting:
+constexpr std::size_t maxTiles = 16;
+constexpr int maxTileSize = 4096;
+
+} // end anonymous namespace
+
+HdrTileCache::HdrTileCache(PacketDemuxer& receiver)
+    : currentProgress(0.f),
+      useCounter(0) {
+  subscribe(receiver);
+}
+
+void HdrTileCache::subscribe(PacketDemuxer& receiver) {
+  tileSubscription = receiver.subscribe("hdr_tile", [this](const ComPacket::ConstSharedPacket& packet) {
+    packets::HdrTileHeader header;
+    const auto* data = packets::parseHdrTile(packet->getData().data(), packet->getDataSize(), header);
+    if (data == nullptr) {
+      BOOST_LOG_TRIVIAL(warning) << "Ignoring truncated HDR tile packet of " << packet->getDataSize() << " bytes.";
+      return;
+    }
+    receiveTile(header, data);
+  });
+}
+
+void HdrTileCache::unsubscribe() {
+  tileSubscription = PacketSubscription();
+  // The server may have restarted so nothing cached can be trusted:
+  std::lock_guard<std::mutex> lock(mutex);
+  tiles.clear();
+  currentProgress = 0.f;
+}
+
+void HdrTileCache::setProgress(float progress) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (progress < currentProgress) {
+    BOOST_LOG_TRIVIAL(debug) << "Render restarted: discarding " << tiles.size() << " HDR tiles.";
+    tiles.clear();
+  }
+  currentProgress = progress;
+}
+
+void HdrTileCache::invalidate() {
+  std::lock_guard<std::mutex> lock(mutex);
+  tiles.clear();
+}
+
+std::vector<HdrTileCache::TileView> HdrTileCache::snapshot() {
+  std::vector<TileView> views;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    views.reserve(tiles.size());
+    for (const auto& t : tiles) {
+      views.push_back(TileView{t.first, t.second.progress, t.second.pixels});
+    }
+  }
+  std::stable_sort(views.begin(), views.end(), [](const TileView& a, const TileView& b) {
+    return a.progress > b.progress;
+  });
+  return views;
+}
+
+bool HdrTileCache::covers(const Region& region) {
+  std::lock_guard<std::mutex> lock(mutex);
+  for (auto& t : tiles) {
+    if (isFresh(t.second) && t.first.contains(region)) {
+      t.second.lastUsed = ++useCounter;
+      return true;
+    }
+  }
+  return false;
+}
+
+void HdrTileCache::receiveTile(const packets::HdrTileHeader& header, const std::uint8_t* data) {
+  BOOST_LOG_TRIVIAL(trace) << "Received HDR tile: " << header.width << "x" << header.height
+                           << " at (" << header.x << ", " << header.y << ") progress: " << header.progress;
+  if (header.width <= 0 || header.height <= 0 ||
+      header.width > maxTileSize || header.height > maxTileSize ||
+      header.x < 0 || header.y < 0) {
+    BOOST_LOG_TRIVIAL(warning) << "Ignoring HDR tile with invalid region.";
+    return;
+  }
+
+  // Decode without holding the lock:
+  // (Readers may still hold the pixels of a tile this replaces so they are
+  // never modified once the tile is cached):
+  auto pixels = std::make_shared<PooledVector<float>>(std::size_t(header.width) * header.height * 3);
+  if (!decodeHdrData(header.encoding, data, header.dataSize, pixels->size(), pixels->data(), scratch)) {
+    return;
+  }
+  Tile tile;
+  tile.progress = header.progress;
+  tile.pixels = std::move(pixels);
+
+  const Region region{header.x, header.y, header.width, header.height};
+  std::lock_guard<std::mutex> lock(mutex);
+  tile.lastUsed = ++useCounter;
+  tiles[region] = std::move(tile);
+
+  // Evict least recently used:
+  while (tiles.size() > maxTiles) {
+    auto oldest = std::min_element(tiles.begin(), tiles.end(), [](const auto& a, const auto& b) {
+      return a.second.lastUsed < b.second.lastUsed;
+    });
+    tiles.erase(oldest);
+  }
+}
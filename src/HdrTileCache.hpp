@@ -0,0 +1,97 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <PacketComms.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include "BufferPool.hpp"
+#include "PacketDescriptions.hpp"
+
+/// Cache of full precision HDR tiles that the server sends (as hdr_tile)
+/// in answer to hdr_region_request packets. This lets the preview show
+/// live raw pixel values at high zoom without transferring whole images.
+///
+/// Each tile is valid for the render progress at which the server read
+/// it: once progress moves on the tile is stale (but is still used until
+/// it is replaced). If progress goes backwards the render was restarted
+/// so every tile is discarded.
+///
+/// Tiles are written on the demuxer thread and read on the UI thread so
+/// all access is serialised by a mutex (which is only held briefly).
+class HdrTileCache {
+public:
+  struct Region {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+
+    bool contains(int px, int py) const {
+      return px >= x && py >= y && px < x + width && py < y + height;
+    }
+
+    bool contains(const Region& r) const {
+      return r.x >= x && r.y >= y && r.x + r.width <= x + width && r.y + r.height <= y + height;
+    }
+
+    bool operator<(const Region& r) const {
+      return std::tie(x, y, width, height) < std::tie(r.x, r.y, r.width, r.height);
+    }
+
+    bool operator==(const Region& r) const {
+      return std::tie(x, y, width, height) == std::tie(r.x, r.y, r.width, r.height);
+    }
+  };
+
+  HdrTileCache(PacketDemuxer& receiver);
+  virtual ~HdrTileCache() {}
+
+  /// Receive tiles from a different demuxer (e.g. after a reconnect).
+  /// Call unsubscribe() first (which also discards all tiles).
+  void subscribe(PacketDemuxer& receiver);
+  void unsubscribe();
+
+  /// Record the latest render progress (as received in "progress" packets).
+  void setProgress(float progress);
+
+  /// Discard all tiles.
+  void invalidate();
+
+  /// A cached tile that can be read without holding the cache's lock.
+  struct TileView {
+    Region region;
+    float progress;
+    std::shared_ptr<const PooledVector<float>> pixels; // Packed RGB.
+  };
+
+  /// Get every cached tile, newest render progress first, so that many
+  /// pixels can be looked up (see PixelInspector) without locking for each.
+  std::vector<TileView> snapshot();
+
+  /// True if an up to date tile covers the whole region.
+  bool covers(const Region& region);
+
+private:
+  struct Tile {
+    float progress;
+    std::uint64_t lastUsed;
+    std::shared_ptr<const PooledVector<float>> pixels;
+  };
+
+  void receiveTile(const packets::HdrTileHeader& header, const std::uint8_t* data);
+  bool isFresh(const Tile& tile) const { return tile.progress >= currentProgress; }
+
+  std::mutex mutex;
+  std::map<Region, Tile> tiles;
+  float currentProgress;
+  std::uint64_t useCounter;
+  std::vector<std::uint8_t> scratch; // Decompression buffer (demuxer thread only).
+  PacketSubscription tileSubscription;
+};
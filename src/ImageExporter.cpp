@@ -0,0 +1,248 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "ImageExporter.hpp"
+#include "HalfFloat.hpp"
+#include "ThreadSettings.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// Large stdio buffer so that a 100MB image is written in a few big
+// requests rather than one per row:
+constexpr std::size_t writeBufferSize = 8 * 1024 * 1024;
+
+struct FileCloser {
+  void operator()(std::FILE* f) const { std::fclose(f); }
+};
+
+void checkedWrite(const void* data, std::size_t size, std::FILE* f) {
+  if (std::fwrite(data, 1, size, f) != size) {
+    throw std::runtime_error("Write failed.");
+  }
+}
+
+// Helpers to build the little-endian OpenEXR header:
+void put32(std::vector<std::uint8_t>& out, std::uint32_t v) {
+  for (int i = 0; i < 4; ++i) {
+    out.push_back((v >> (8 * i)) & 0xff);
+  }
+}
+
+void putFloat(std::vector<std::uint8_t>& out, float f) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &f, sizeof(bits));
+  put32(out, bits);
+}
+
+void putString(std::vector<std::uint8_t>& out, const char* s) {
+  out.insert(out.end(), s, s + std::strlen(s) + 1);
+}
+
+void putAttribute(std::vector<std::uint8_t>& out, const char* name, const char* type, std::uint32_t size) {
+  putString(out, name);
+  putString(out, type);
+  put32(out, size);
+}
+
+} // end anonymous namespace
+
+ImageExporter::ImageExporter()
+    : busy(0),
+      stop(false),
+      writerThread(&ImageExporter::run, this) {}
+
+ImageExporter::~ImageExporter() {
+  std::size_t unfinished = 0;
+  {
+    std::lock_guard<std::mutex> lock(jobMutex);
+    stop = true;
+    unfinished = jobs.size() + busy;
+  }
+  jobReady.notify_all();
+  // Queued images are still written before we return (the writer only
+  // exits once the queue is empty):
+  if (unfinished != 0) {
+    BOOST_LOG_TRIVIAL(info) << "Waiting for " << unfinished << " HDR image(s) to be saved...";
+  }
+  writerThread.join();
+}
+
+void ImageExporter::save(const HdrImageReceiver::ImagePtr& image, const std::string& fileName, Format format) {
+  if (!image) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(jobMutex);
+    jobs.push_back(Job{image, fileName, format});
+  }
+  jobReady.notify_one();
+}
+
+std::size_t ImageExporter::pending() {
+  std::lock_guard<std::mutex> lock(jobMutex);
+  return jobs.size() + busy;
+}
+
+std::string ImageExporter::timestampedFileName(const std::string& prefix, Format format) {
+  return timestampedFileName(prefix, std::string(format == Format::Pfm ? ".pfm" : ".exr"));
+}
+
+std::string ImageExporter::timestampedFileName(const std::string& prefix, const std::string& extension) {
+  using namespace std::chrono;
+  const auto now = system_clock::now();
+  const auto millis = duration_cast<milliseconds>(now.time_since_epoch()).count() % 1000;
+  const std::time_t t = system_clock::to_time_t(now);
+  std::tm local;
+#ifdef _WIN32
+  localtime_s(&local, &t);
+#else
+  localtime_r(&t, &local);
+#endif
+  std::stringstream ss;
+  ss << prefix << "_" << std::put_time(&local, "%Y%m%d_%H%M%S")
+     << "_" << std::setw(3) << std::setfill('0') << millis << extension;
+  return ss.str();
+}
+
+void ImageExporter::run() {
+  setCurrentThreadName("rui-export");
+  // stdio only uses the requested size if we supply the buffer (glibc
+  // otherwise picks st_blksize). It is reused for every file and must
+  // outlive each FILE that uses it:
+  std::unique_ptr<char[]> writeBuffer(new char[writeBufferSize]);
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(jobMutex);
+      jobReady.wait(lock, [this]() { return stop || !jobs.empty(); });
+      if (jobs.empty()) {
+        return;
+      }
+      job = std::move(jobs.front());
+      jobs.pop_front();
+      busy = 1;
+    }
+
+    const auto startTime = std::chrono::steady_clock::now();
+    try {
+      std::unique_ptr<std::FILE, FileCloser> f(std::fopen(job.fileName.c_str(), "wb"));
+      if (!f) {
+        throw std::runtime_error("Could not open file.");
+      }
+      std::setvbuf(f.get(), writeBuffer.get(), _IOFBF, writeBufferSize);
+      if (job.format == Format::Pfm) {
+        writePfm(*job.image, f.get());
+      } else {
+        writeExr16(*job.image, f.get());
+      }
+      if (std::fclose(f.release()) != 0) {
+        throw std::runtime_error("Close failed.");
+      }
+      const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+      BOOST_LOG_TRIVIAL(info) << "Saved HDR image '" << job.fileName << "' in " << seconds << " seconds.";
+    } catch (const std::exception& e) {
+      BOOST_LOG_TRIVIAL(error) << "Failed to save HDR image '" << job.fileName << "': " << e.what();
+    }
+
+    // Release our reference before reporting we are idle so the
+    // receiver can reuse the buffer:
+    job.image.reset();
+    std::lock_guard<std::mutex> lock(jobMutex);
+    busy = 0;
+  }
+}
+
+void ImageExporter::writePfm(const HdrImage& image, std::FILE* f) {
+  std::stringstream header;
+  header << "PF\n" << image.width << " " << image.height << "\n-1.0\n";
+  const auto h = header.str();
+  checkedWrite(h.data(), h.size(), f);
+
+  // PFM rows are stored bottom to top:
+  const std::size_t rowSize = std::size_t(image.width) * 3;
+  for (auto r = image.height - 1; r >= 0; --r) {
+    checkedWrite(image.pixels.data() + r * rowSize, rowSize * sizeof(float), f);
+  }
+}
+
+void ImageExporter::writeExr16(const HdrImage& image, std::FILE* f) {
+  const std::uint32_t w = image.width;
+  const std::uint32_t h = image.height;
+
+  // Single part scan-line file with no compression:
+  std::vector<std::uint8_t> header;
+  put32(header, 20000630); // Magic number.
+  put32(header, 2);        // Version 2, no flags.
+
+  // Channels must be listed in alphabetical order:
+  putAttribute(header, "channels", "chlist", 3 * 18 + 1);
+  for (const char* name : {"B", "G", "R"}) {
+    putString(header, name);
+    put32(header, 1); // HALF
+    put32(header, 0); // pLinear and reserved bytes.
+    put32(header, 1); // x sampling
+    put32(header, 1); // y sampling
+  }
+  header.push_back(0);
+
+  putAttribute(header, "compression", "compression", 1);
+  header.push_back(0); // NO_COMPRESSION
+  for (const char* window : {"dataWindow", "displayWindow"}) {
+    putAttribute(header, window, "box2i", 16);
+    put32(header, 0);
+    put32(header, 0);
+    put32(header, w - 1);
+    put32(header, h - 1);
+  }
+  putAttribute(header, "lineOrder", "lineOrder", 1);
+  header.push_back(0); // INCREASING_Y
+  putAttribute(header, "pixelAspectRatio", "float", 4);
+  putFloat(header, 1.f);
+  putAttribute(header, "screenWindowCenter", "v2f", 8);
+  putFloat(header, 0.f);
+  putFloat(header, 0.f);
+  putAttribute(header, "screenWindowWidth", "float", 4);
+  putFloat(header, 1.f);
+  header.push_back(0); // End of header.
+
+  // Offset table (one entry per scan-line block) follows the header:
+  const std::uint32_t rowDataSize = w * 3 * sizeof(std::uint16_t);
+  const std::uint64_t blockSize = 8 + rowDataSize;
+  const std::uint64_t firstBlock = header.size() + std::uint64_t(h) * 8;
+  for (std::uint32_t r = 0; r < h; ++r) {
+    const std::uint64_t offset = firstBlock + r * blockSize;
+    put32(header, offset & 0xffffffffu);
+    put32(header, offset >> 32);
+  }
+  checkedWrite(header.data(), header.size(), f);
+
+  // Each block is the row number, data size, then
+  // each channel's row in turn (in chlist order):
+  std::vector<std::uint8_t> block;
+  block.reserve(blockSize);
+  for (std::uint32_t r = 0; r < h; ++r) {
+    block.clear();
+    put32(block, r);
+    put32(block, rowDataSize);
+    const float* row = image.pixels.data() + std::size_t(r) * w * 3;
+    for (int c = 2; c >= 0; --c) {
+      for (std::uint32_t x = 0; x < w; ++x) {
+        const auto half = floatToHalf(row[x * 3 + c]);
+        block.push_back(half & 0xff);
+        block.push_back(half >> 8);
+      }
+    }
+    checkedWrite(block.data(), block.size(), f);
+  }
+}
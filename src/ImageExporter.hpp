@@ -0,0 +1,56 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "HdrImageReceiver.hpp"
+
+/// Writes HDR images to disk on a background thread so that saving
+/// never blocks the UI. Images are shared (not copied) with the
+/// receiver: a saved image stays alive until it has been written.
+class ImageExporter {
+public:
+  enum class Format {
+    Pfm,   // Portable float map (32-bit float RGB).
+    Exr16  // Uncompressed OpenEXR with half-float RGB channels.
+  };
+
+  ImageExporter();
+  /// Blocks until every queued image has been written.
+  virtual ~ImageExporter();
+
+  /// Queue an image to be written. Returns immediately.
+  void save(const HdrImageReceiver::ImagePtr& image, const std::string& fileName, Format format);
+
+  /// Make a file name of the form <prefix>_YYYYMMDD_HHMMSS_mmm.<ext>
+  /// from the current local time.
+  static std::string timestampedFileName(const std::string& prefix, Format format);
+  /// As above with an explicit extension (including the dot).
+  static std::string timestampedFileName(const std::string& prefix, const std::string& extension);
+
+  /// Number of images waiting to be (or being) written.
+  std::size_t pending();
+
+private:
+  struct Job {
+    HdrImageReceiver::ImagePtr image;
+    std::string fileName;
+    Format format;
+  };
+
+  void run();
+  static void writePfm(const HdrImage& image, std::FILE* f);
+  static void writeExr16(const HdrImage& image, std::FILE* f);
+
+  std::mutex jobMutex;
+  std::condition_variable jobReady;
+  std::deque<Job> jobs;
+  std::size_t busy;
+  bool stop;
+  std::thread writerThread;
+};
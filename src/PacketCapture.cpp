@@ -0,0 +1,250 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "PacketCapture.hpp"
+#include "PacketDescriptions.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace capture {
+
+namespace {
+
+const char magic[8] = {'R', 'U', 'I', 'C', 'A', 'P', '1', '\0'};
+constexpr std::size_t recordHeaderSize = 16;
+// Grow the file by at least this much at a time:
+constexpr std::size_t growthStep = 64 * 1024 * 1024;
+
+void writeLittleEndian32(std::uint8_t* p, std::uint32_t v) {
+  for (int i = 0; i < 4; ++i) {
+    p[i] = static_cast<std::uint8_t>(v >> (8 * i));
+  }
+}
+
+std::uint64_t readLittleEndian64(const std::uint8_t* p) {
+  return std::uint64_t(packets::readLittleEndian32(p)) |
+         (std::uint64_t(packets::readLittleEndian32(p + 4)) << 32);
+}
+
+std::string fileError(const std::string& what, const std::string& fileName) {
+  return what + " '" + fileName + "': " + std::strerror(errno);
+}
+
+} // end anonymous namespace
+
+Writer::Writer(const std::string& name, const std::vector<std::string>& typeNames)
+    : fileName(name),
+      fd(-1),
+      mapping(nullptr),
+      capacity(0),
+      used(0),
+      records(0),
+      started(false),
+      failed(false) {
+  fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw std::runtime_error(fileError("Could not create capture file", fileName));
+  }
+
+  std::size_t headerSize = sizeof(magic) + 4;
+  for (const auto& n : typeNames) {
+    headerSize += 4 + n.size();
+  }
+  try {
+    reserve(headerSize);
+  } catch (const std::runtime_error&) {
+    close(fd);
+    throw;
+  }
+
+  std::memcpy(mapping, magic, sizeof(magic));
+  auto* p = mapping + sizeof(magic);
+  writeLittleEndian32(p, typeNames.size());
+  p += 4;
+  for (const auto& n : typeNames) {
+    writeLittleEndian32(p, n.size());
+    std::memcpy(p + 4, n.data(), n.size());
+    p += 4 + n.size();
+  }
+  used = headerSize;
+  BOOST_LOG_TRIVIAL(info) << "Recording received packets to '" << fileName << "'";
+}
+
+Writer::~Writer() {
+  if (mapping != nullptr) {
+    munmap(mapping, capacity);
+  }
+  if (fd >= 0) {
+    // Trim the unused part of the last growth step:
+    if (ftruncate(fd, used) != 0) {
+      BOOST_LOG_TRIVIAL(warning) << fileError("Could not trim capture file", fileName);
+    }
+    close(fd);
+  }
+  BOOST_LOG_TRIVIAL(info) << "Recorded " << records << " packets (" << used << " bytes) to '" << fileName << "'";
+}
+
+void Writer::reserve(std::size_t bytes) {
+  if (used + bytes <= capacity) {
+    return;
+  }
+
+  const auto newCapacity = std::max(capacity + growthStep, used + bytes);
+  if (mapping != nullptr) {
+    munmap(mapping, capacity);
+    mapping = nullptr;
+  }
+  if (ftruncate(fd, newCapacity) != 0) {
+    throw std::runtime_error(fileError("Could not grow capture file", fileName));
+  }
+  void* m = mmap(nullptr, newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED) {
+    throw std::runtime_error(fileError("Could not map capture file", fileName));
+  }
+  mapping = static_cast<std::uint8_t*>(m);
+  capacity = newCapacity;
+}
+
+void Writer::write(std::uint32_t type, const std::uint8_t* data, std::size_t size) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (failed) {
+    return;
+  }
+  const auto now = std::chrono::steady_clock::now();
+  if (!started) {
+    started = true;
+    startTime = now;
+  }
+  const std::uint64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(now - startTime).count();
+
+  try {
+    reserve(recordHeaderSize + size);
+  } catch (const std::runtime_error& e) {
+    // This is called on demuxer threads so just stop recording:
+    BOOST_LOG_TRIVIAL(error) << e.what() << ". Recording stopped.";
+    failed = true;
+    return;
+  }
+  auto* p = mapping + used;
+  writeLittleEndian32(p, micros & 0xffffffff);
+  writeLittleEndian32(p + 4, micros >> 32);
+  writeLittleEndian32(p + 8, type);
+  writeLittleEndian32(p + 12, size);
+  std::memcpy(p + recordHeaderSize, data, size);
+  used += recordHeaderSize + size;
+  records += 1;
+}
+
+Reader::Reader(const std::string& fileName)
+    : fd(-1),
+      mapping(nullptr),
+      size(0),
+      firstRecord(0),
+      offset(0) {
+  fd = open(fileName.c_str(), O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    throw std::runtime_error(fileError("Could not open capture file", fileName));
+  }
+  size = info.st_size;
+  if (size < sizeof(magic) + 4) {
+    close(fd);
+    throw std::runtime_error("Capture file '" + fileName + "' is too small.");
+  }
+
+  void* m = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (m == MAP_FAILED) {
+    close(fd);
+    throw std::runtime_error(fileError("Could not map capture file", fileName));
+  }
+  mapping = static_cast<const std::uint8_t*>(m);
+
+  try {
+    readHeader(fileName);
+  } catch (const std::runtime_error&) {
+    munmap(m, size);
+    close(fd);
+    throw;
+  }
+}
+
+void Reader::readHeader(const std::string& fileName) {
+  if (std::memcmp(mapping, magic, sizeof(magic)) != 0) {
+    throw std::runtime_error("'" + fileName + "' is not a capture file.");
+  }
+  std::size_t p = sizeof(magic);
+  const auto count = packets::readLittleEndian32(mapping + p);
+  p += 4;
+  for (std::uint32_t i = 0; i < count; ++i) {
+    if (p + 4 > size) {
+      throw std::runtime_error("Capture file '" + fileName + "' has a truncated header.");
+    }
+    const auto length = packets::readLittleEndian32(mapping + p);
+    if (p + 4 + length > size) {
+      throw std::runtime_error("Capture file '" + fileName + "' has a truncated header.");
+    }
+    names.emplace_back(reinterpret_cast<const char*>(mapping + p + 4), length);
+    p += 4 + length;
+  }
+  firstRecord = offset = p;
+}
+
+Reader::~Reader() {
+  if (mapping != nullptr) {
+    munmap(const_cast<std::uint8_t*>(mapping), size);
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+bool Reader::next(Record& record) {
+  if (offset + recordHeaderSize > size) {
+    return false;
+  }
+  const auto* p = mapping + offset;
+  record.timeMicros = readLittleEndian64(p);
+  record.type = packets::readLittleEndian32(p + 8);
+  record.size = packets::readLittleEndian32(p + 12);
+  if (record.size > size - offset - recordHeaderSize) {
+    BOOST_LOG_TRIVIAL(warning) << "Capture file is truncated.";
+    return false;
+  }
+  record.data = p + recordHeaderSize;
+  offset += recordHeaderSize + record.size;
+  return true;
+}
+
+PacketRecorder::PacketRecorder(const std::string& fileName)
+    : writer(fileName, packets::packetTypes) {}
+
+PacketRecorder::~PacketRecorder() {
+  unsubscribe();
+}
+
+void PacketRecorder::subscribe(PacketDemuxer& receiver) {
+  const auto& types = packets::packetTypes;
+  for (std::uint32_t t = 0; t < types.size(); ++t) {
+    // The sync packet is part of the handshake which replay does itself:
+    if (types[t] == "ready") {
+      continue;
+    }
+    subscriptions.push_back(receiver.subscribe(types[t], [this, t](const ComPacket::ConstSharedPacket& packet) {
+      writer.write(t, packet->getData().data(), packet->getDataSize());
+    }));
+  }
+}
+
+void PacketRecorder::unsubscribe() {
+  subscriptions.clear();
+}
+
+} // end namespace capture
@@ -0,0 +1,108 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <PacketComms.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// Capture files hold every packet received in a session so that it can be
+/// replayed offline (see CaptureReplayServer). The layout is little-endian:
+///
+///   char[8]  magic "RUICAP1\0"
+///   uint32   number of packet type names N
+///   N times: uint32 length, name bytes
+///   records: uint64 receive time (microseconds since the first record),
+///            uint32 packet type (index into the names above),
+///            uint32 payload size, payload bytes
+///
+/// Types are stored by name so captures remain valid if packet types
+/// are added to packets::packetTypes later.
+namespace capture {
+
+struct Record {
+  std::uint64_t timeMicros;
+  std::uint32_t type;
+  std::uint32_t size;
+  const std::uint8_t* data; // Points into the mapped file.
+};
+
+/// Appends records to a memory-mapped capture file, growing the file (and
+/// mapping) in large steps so that recording costs little more than a memcpy
+/// per packet. Safe to write from several (demuxer) threads.
+class Writer {
+public:
+  /// Throws a std::runtime_error if the file can not be created.
+  Writer(const std::string& fileName, const std::vector<std::string>& typeNames);
+  virtual ~Writer();
+
+  void write(std::uint32_t type, const std::uint8_t* data, std::size_t size);
+
+  std::uint64_t recordCount() const { return records; }
+
+private:
+  void reserve(std::size_t bytes);
+
+  const std::string fileName;
+  int fd;
+  std::uint8_t* mapping;
+  std::size_t capacity;
+  std::size_t used;
+  std::atomic<std::uint64_t> records;
+  bool started;
+  bool failed;
+  std::chrono::steady_clock::time_point startTime;
+  std::mutex mutex;
+};
+
+/// Reads a capture file through a read-only memory mapping.
+class Reader {
+public:
+  /// Throws a std::runtime_error if the file can not be read or is invalid.
+  Reader(const std::string& fileName);
+  virtual ~Reader();
+
+  const std::vector<std::string>& typeNames() const { return names; }
+
+  /// Read the next record. Its data remains valid for the reader's lifetime.
+  /// @return false at the end of the capture (or if it is truncated).
+  bool next(Record& record);
+
+  /// Go back to the first record.
+  void rewind() { offset = firstRecord; }
+
+private:
+  void readHeader(const std::string& fileName);
+
+  int fd;
+  const std::uint8_t* mapping;
+  std::size_t size;
+  std::size_t firstRecord;
+  std::size_t offset;
+  std::vector<std::string> names;
+};
+
+/// Subscribes to every packet type on one or more demuxers
+/// and writes everything received to a capture file.
+class PacketRecorder {
+public:
+  PacketRecorder(const std::string& fileName);
+  virtual ~PacketRecorder();
+
+  /// Record packets from receiver (may be called for several demuxers).
+  void subscribe(PacketDemuxer& receiver);
+  /// Release all subscriptions (e.g. before the demuxers are destroyed).
+  void unsubscribe();
+
+private:
+  Writer writer;
+  std::vector<PacketSubscription> subscriptions;
+};
+
+} // end namespace capture
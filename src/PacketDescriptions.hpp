@@ -2,6 +2,9 @@
 
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <cereal/types/string.hpp>
@@ -9,6 +12,10 @@
 
 namespace packets {
 
+// If the client connects a separate bulk data connection (see
+// ConnectionManager) the server must send hdr_header, hdr_packet,
+// hdr_packet_encoded, hdr_packet_raw and hdr_tile on it and everything else on the
+// main connection. Both connections use this list of packet types.
 const std::vector<std::string> packetTypes {
     "stop",                // Tell server to stop rendering and exit (client -> server)
     "detach",              // Detach the remote-ui but continue: server can destroy the
@@ -29,6 +36,19 @@ const std::vector<std::string> packetTypes {
                            // HDR image (server -> client).
     "interactive_samples", // New value for interactive samples per step (client -> server)
     "ready",               // Used to sync with the other side once all other subscribers are ready (bi-directional)
+    "frame_timestamp",     // Server wall-clock time for a render_preview frame (server -> client)
+    "hdr_capabilities",    // HDR encodings the client can decode, sent before syncing ready (client -> server)
+    "hdr_packet_encoded",  // Alternative to hdr_packet in one of the negotiated encodings (server -> client)
+    "hdr_region_request",  // Ask for full precision HDR data for a region of the image (client -> server)
+    "hdr_tile",            // HDR data for a requested region. Fixed raw layout (see HdrTileHeader) (server -> client)
+    "camera_state",        // All tunable render parameters in one update (client -> server)
+    "stream_feedback",     // Preview stream reception statistics for bit-rate adaptation (client -> server)
+    "video_udp_setup",     // Ask for render_preview to be sent as UDP datagrams to a port (client -> server)
+    "video_nack",          // Request retransmission of lost video datagrams (client -> server)
+    "video_keyframe_request", // Ask the encoder for a key-frame after unrecoverable loss (client -> server)
+    "nif_prefetch",        // NIF models likely to be loaded next, sent after each load_nif (client -> server)
+    "hdr_packet_raw",      // As hdr_packet_encoded but in a fixed raw layout instead of cereal
+                           // (see HdrChunkHeader) (server -> client)
 };
 
 // Struct and serialize function for HDR
@@ -57,6 +77,158 @@ void serialize(T& ar, HdrPacket& p) {
   ar(p.id, p.data);
 }
 
+// Encodings for HDR image chunks. The server may send chunks as
+// hdr_packet_encoded or hdr_packet_raw in any encoding the client has
+// advertised in its hdr_capabilities packet (otherwise it must use
+// hdr_packet):
+enum class HdrEncoding : std::uint32_t {
+  Float32 = 0,    // Raw little-endian floats (the zero-copy form of hdr_packet).
+  Float16 = 1,    // IEEE half floats as byte-shuffled planes: all
+                  // the low bytes followed by all the high bytes.
+  Float16Zstd = 2 // Float16 data compressed with zstd.
+};
+
+inline std::uint32_t encodingBit(HdrEncoding e) {
+  return 1u << static_cast<std::uint32_t>(e);
+}
+
+struct HdrCapabilities {
+  std::uint32_t encodings; // Bitmask of encodingBit() values.
+};
+
+template <typename T>
+void serialize(T& ar, HdrCapabilities& c) {
+  ar(c.encodings);
+}
+
+struct HdrEncodedPacket {
+  std::uint32_t id;
+  std::uint32_t encoding;   // An HdrEncoding value.
+  std::uint32_t valueCount; // Number of floats in the decoded chunk.
+  std::vector<std::uint8_t> data;
+};
+
+template <typename T>
+void serialize(T& ar, HdrEncodedPacket& p) {
+  ar(p.id, p.encoding, p.valueCount, p.data);
+}
+
+// hdr_packet_raw carries the same fields as hdr_packet_encoded but is
+// not serialised with cereal. It has a fixed header of little-endian
+// 32-bit fields followed immediately by the chunk data so that it can
+// be decoded in place from the packet's payload without intermediate
+// allocations or copies:
+struct HdrChunkHeader {
+  std::uint32_t id;
+  std::uint32_t encoding;   // An HdrEncoding value.
+  std::uint32_t valueCount; // Number of floats in the decoded chunk.
+  std::uint32_t dataSize;   // Number of data bytes following the header.
+};
+
+constexpr std::size_t hdrChunkHeaderSize = 4 * sizeof(std::uint32_t);
+
+inline std::uint32_t readLittleEndian32(const std::uint8_t* p) {
+  return std::uint32_t(p[0]) | (std::uint32_t(p[1]) << 8) |
+         (std::uint32_t(p[2]) << 16) | (std::uint32_t(p[3]) << 24);
+}
+
+/// Parse the header of an hdr_packet_raw payload.
+/// @return Pointer to the chunk data or nullptr if the payload is too
+/// small to contain the header and the amount of data it declares.
+inline const std::uint8_t* parseHdrChunk(const std::uint8_t* payload, std::size_t size,
+                                         HdrChunkHeader& header) {
+  if (payload == nullptr || size < hdrChunkHeaderSize) {
+    return nullptr;
+  }
+  header.id = readLittleEndian32(payload);
+  header.encoding = readLittleEndian32(payload + 4);
+  header.valueCount = readLittleEndian32(payload + 8);
+  header.dataSize = readLittleEndian32(payload + 12);
+  if (header.dataSize > size - hdrChunkHeaderSize) {
+    return nullptr;
+  }
+  return payload + hdrChunkHeaderSize;
+}
+
+// Struct and serialize function to request the HDR values of a region
+// of the image (in pixels, origin top-left). The server answers with one
+// or more hdr_tile packets covering the region:
+struct HdrRegionRequest {
+  std::int32_t x;
+  std::int32_t y;
+  std::int32_t width;
+  std::int32_t height;
+};
+
+template <typename T>
+void serialize(T& ar, HdrRegionRequest& r) {
+  ar(r.x, r.y, r.width, r.height);
+}
+
+// hdr_tile has the same kind of fixed little-endian layout as
+// hdr_packet_raw: this header followed by the tile's RGB values
+// (width * height * 3 of them) in one of the negotiated encodings:
+struct HdrTileHeader {
+  std::int32_t x;
+  std::int32_t y;
+  std::int32_t width;
+  std::int32_t height;
+  float progress;         // Render progress when the tile was read (as sent in "progress").
+  std::uint32_t encoding; // An HdrEncoding value.
+  std::uint32_t dataSize; // Number of data bytes following the header.
+};
+
+constexpr std::size_t hdrTileHeaderSize = 7 * sizeof(std::uint32_t);
+
+/// Parse the header of an hdr_tile payload.
+/// @return Pointer to the tile data or nullptr if the payload is too
+/// small to contain the header and the amount of data it declares.
+inline const std::uint8_t* parseHdrTile(const std::uint8_t* payload, std::size_t size,
+                                        HdrTileHeader& header) {
+  if (payload == nullptr || size < hdrTileHeaderSize) {
+    return nullptr;
+  }
+  header.x = readLittleEndian32(payload);
+  header.y = readLittleEndian32(payload + 4);
+  header.width = readLittleEndian32(payload + 8);
+  header.height = readLittleEndian32(payload + 12);
+  const auto progressBits = readLittleEndian32(payload + 16);
+  std::memcpy(&header.progress, &progressBits, sizeof(float));
+  header.encoding = readLittleEndian32(payload + 20);
+  header.dataSize = readLittleEndian32(payload + 24);
+  if (header.dataSize > size - hdrTileHeaderSize) {
+    return nullptr;
+  }
+  return payload + hdrTileHeaderSize;
+}
+
+// Struct and serialize function to update several render parameters
+// at once (so the server only restarts its render once). Only the
+// fields flagged in the dirty mask have changed: the server should
+// ignore the others:
+struct CameraState {
+  enum Field : std::uint32_t {
+    EnvRotation = 1 << 0,
+    Exposure = 1 << 1,
+    Gamma = 1 << 2,
+    Fov = 1 << 3,
+    InteractiveSamples = 1 << 4,
+    AllFields = (1 << 5) - 1
+  };
+
+  std::uint32_t dirty = 0;   // Bitmask of Field values.
+  float envRotation = 0.f;   // Same units as the env_rotation packet (degrees).
+  float exposure = 0.f;      // Same units as the exposure packet.
+  float gamma = 2.2f;        // Same units as the gamma packet.
+  float fov = 90.f;          // Same units as the fov packet sent by the client (degrees).
+  std::uint32_t interactiveSamples = 1;
+};
+
+template <typename T>
+void serialize(T& ar, CameraState& c) {
+  ar(c.dirty, c.envRotation, c.exposure, c.gamma, c.fov, c.interactiveSamples);
+}
+
 // Struct and serialize function to send
 // telemetry in a single packet:
 struct SampleRates {
@@ -69,4 +241,110 @@ void serialize(T& ar, SampleRates& s) {
   ar(s.pathRate, s.rayRate);
 }
 
+// Struct and serialize function for the time at which the
+// server encoded a video frame. Used to measure end-to-end
+// latency so assumes both clocks are synchronised (e.g. NTP):
+struct FrameTimestamp {
+  std::int64_t pts;          // Presentation timestamp of the frame (in the video stream's time base).
+  std::int64_t microseconds; // Server system-clock time since epoch.
+};
+
+template <typename T>
+void serialize(T& ar, FrameTimestamp& t) {
+  ar(t.pts, t.microseconds);
+}
+
+// Struct and serialize function for the client's view of the preview
+// stream, sent periodically so that the server can adapt the encoder's
+// bit-rate or resolution (e.g. when latency builds up on a slow link):
+struct StreamFeedback {
+  float receiveRateMbps;        // Filtered rate at which video data is arriving.
+  float frameRate;              // Filtered rate at which frames are decoded.
+  float decodeTimeMs;           // Filtered decode time per frame (excluding waiting for data).
+  float latencyMs;              // Filtered encode to display latency (negative if unknown).
+  std::uint32_t queueDepth;     // Compressed packets waiting to be decoded.
+  std::uint64_t droppedPackets; // Total packets dropped because the queue was full.
+  std::int32_t width;           // Size of the frames being decoded (zero until the first).
+  std::int32_t height;
+};
+
+template <typename T>
+void serialize(T& ar, StreamFeedback& f) {
+  ar(f.receiveRateMbps, f.frameRate, f.decodeTimeMs, f.latencyMs,
+     f.queueDepth, f.droppedPackets, f.width, f.height);
+}
+
+// Remote paths of the NIF models the user is most likely to load next
+// (most likely first). Sent after load_nif so that the server can load
+// them into a cache in the background once the current model is ready.
+// It is only a hint: the server may ignore it or warm fewer models:
+struct NifPrefetch {
+  std::vector<std::string> paths;
+};
+
+template <typename T>
+void serialize(T& ar, NifPrefetch& p) {
+  ar(p.paths);
+}
+
+// Sent by the client to receive render_preview over UDP (see
+// VideoDatagramHeader). The server sends to this port at the address
+// the client connected from. Controls and everything else stay on TCP:
+struct VideoUdpSetup {
+  std::uint16_t port;
+};
+
+template <typename T>
+void serialize(T& ar, VideoUdpSetup& s) {
+  ar(s.port);
+}
+
+// Datagram sequence numbers the client has detected as missing.
+// The server resends any that it still has:
+struct VideoNack {
+  std::vector<std::uint32_t> sequences;
+};
+
+template <typename T>
+void serialize(T& ar, VideoNack& n) {
+  ar(n.sequences);
+}
+
+// Each render_preview packet sent over UDP is split into one or more
+// datagrams. Every datagram starts with this header (packed little-endian)
+// followed by its fragment of the packet's payload:
+struct VideoDatagramHeader {
+  enum Flags : std::uint32_t {
+    KeyFrame = 1 << 0, // The packet starts a key-frame (decoding can restart here).
+  };
+
+  std::uint32_t sequence;      // Increments by one for every new datagram (retransmits keep their number).
+  std::uint32_t packetId;      // Increments by one for every render_preview packet.
+  std::uint16_t fragment;      // Index of this fragment within the packet.
+  std::uint16_t fragmentCount; // Number of fragments the packet was split into.
+  std::uint32_t flags;         // Bitmask of Flags values.
+};
+
+constexpr std::size_t videoDatagramHeaderSize = 4 * sizeof(std::uint32_t);
+
+/// Parse the header of a video datagram.
+/// @return Pointer to the fragment's data or nullptr if the datagram is
+/// too small to contain a header or the header is inconsistent.
+inline const std::uint8_t* parseVideoDatagram(const std::uint8_t* datagram, std::size_t size,
+                                              VideoDatagramHeader& header) {
+  if (datagram == nullptr || size < videoDatagramHeaderSize) {
+    return nullptr;
+  }
+  header.sequence = readLittleEndian32(datagram);
+  header.packetId = readLittleEndian32(datagram + 4);
+  const auto fragmentBits = readLittleEndian32(datagram + 8);
+  header.fragment = fragmentBits & 0xffff;
+  header.fragmentCount = fragmentBits >> 16;
+  header.flags = readLittleEndian32(datagram + 12);
+  if (header.fragmentCount == 0 || header.fragment >= header.fragmentCount) {
+    return nullptr;
+  }
+  return datagram + videoDatagramHeaderSize;
+}
+
 } // end namespace packets
@@ -0,0 +1,104 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "PerformanceOverlay.hpp"
+#include "BufferPool.hpp"
+#include "ImageExporter.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+namespace {
+
+constexpr auto updateInterval = std::chrono::milliseconds(250);
+constexpr std::size_t histogramBins = 24;
+
+std::string formatMillis(double ms) {
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(ms < 10.0 ? 2 : 1) << ms;
+  return ss.str();
+}
+
+std::string formatBufferPoolStats(const BufferPool::Stats& s) {
+  const auto requests = s.hits + s.misses;
+  std::stringstream ss;
+  ss << "Buffers: " << (s.bytesInUse >> 20) << " MiB in use, " << (s.bytesCached >> 20) << " MiB cached";
+  if (requests > 0) {
+    ss << ", " << (100 * s.hits / requests) << "% reused";
+  }
+  return ss.str();
+}
+
+} // end anonymous namespace
+
+PerformanceOverlay::PerformanceOverlay(nanogui::Widget* parent, const FrameStats& frameStats)
+    : nanogui::Window(parent, "Frame Timings (ms)"),
+      stats(frameStats),
+      frameCountLabel(nullptr),
+      bufferPoolLabel(nullptr) {
+  using namespace nanogui;
+  set_layout(new GroupLayout(10));
+
+  auto* table = new Widget(this);
+  auto* grid = new GridLayout(Orientation::Horizontal, 4, Alignment::Middle, 0, 4);
+  grid->set_col_alignment({Alignment::Minimum, Alignment::Maximum, Alignment::Maximum, Alignment::Fill});
+  table->set_layout(grid);
+
+  new Label(table, "Stage", "sans-bold");
+  new Label(table, "p50", "sans-bold");
+  new Label(table, "p99", "sans-bold");
+  new Label(table, "0.1 ms - 1 s", "sans-bold");
+  for (int s = 0; s < int(FrameStats::Stage::Count); ++s) {
+    new Label(table, FrameStats::stageName(FrameStats::Stage(s)));
+    Row row;
+    row.p50 = new Label(table, "-");
+    row.p99 = new Label(table, "-");
+    row.histogram = new Graph(table, "");
+    row.histogram->set_fixed_size(Vector2i(160, 24));
+    rows.push_back(row);
+  }
+
+  frameCountLabel = new Label(this, "No frames yet.");
+  bufferPoolLabel = new Label(this, formatBufferPoolStats(BufferPool::shared().stats()));
+
+  auto* buttons = new Widget(this);
+  buttons->set_layout(new GridLayout(Orientation::Horizontal, 2, Alignment::Fill, 0, 6));
+  auto* csvButton = new Button(buttons, "Export CSV");
+  csvButton->set_tooltip("Save the timings of each recent frame as CSV.");
+  csvButton->set_callback([this]() {
+    stats.exportCsv(ImageExporter::timestampedFileName("frame_timings", ".csv"));
+  });
+  auto* traceButton = new Button(buttons, "Export Trace");
+  traceButton->set_tooltip("Save recent frames as a Chrome trace (open in chrome://tracing or Perfetto).");
+  traceButton->set_callback([this]() {
+    stats.exportChromeTrace(ImageExporter::timestampedFileName("frame_trace", ".json"));
+  });
+}
+
+void PerformanceOverlay::update() {
+  const auto now = std::chrono::steady_clock::now();
+  if (!visible() || now - lastUpdate < updateInterval) {
+    return;
+  }
+  lastUpdate = now;
+  bufferPoolLabel->set_caption(formatBufferPoolStats(BufferPool::shared().stats()));
+
+  if (stats.frameCount() == 0) {
+    return;
+  }
+
+  for (std::size_t s = 0; s < rows.size(); ++s) {
+    const auto stage = FrameStats::Stage(s);
+    const auto summary = stats.summary(stage);
+    rows[s].p50->set_caption(formatMillis(summary.p50Ms));
+    rows[s].p99->set_caption(formatMillis(summary.p99Ms));
+    // Scale so the tallest bin fills the graph:
+    auto bins = stats.histogram(stage, histogramBins);
+    const float tallest = *std::max_element(bins.begin(), bins.end());
+    for (auto& b : bins) {
+      b /= tallest;
+    }
+    rows[s].histogram->set_values(bins);
+  }
+  frameCountLabel->set_caption("Last " + std::to_string(stats.frameCount()) + " frames.");
+}
@@ -0,0 +1,37 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <nanogui/nanogui.h>
+
+#include <chrono>
+#include <vector>
+
+#include "FrameStats.hpp"
+
+/// Window showing the median and 99th percentile time of each stage of
+/// the video pipeline with a histogram of each, plus buttons to export
+/// the per-frame timings. Shows whether a slow preview is due to the
+/// network, the decoder or the GPU. Also shows the state of the shared
+/// frame buffer pool (see BufferPool).
+class PerformanceOverlay : public nanogui::Window {
+public:
+  PerformanceOverlay(nanogui::Widget* parent, const FrameStats& stats);
+
+  /// Refresh the displayed figures (at a limited rate so that
+  /// the text is readable). Call once per UI frame.
+  void update();
+
+private:
+  struct Row {
+    nanogui::Label* p50;
+    nanogui::Label* p99;
+    nanogui::Graph* histogram;
+  };
+
+  const FrameStats& stats;
+  std::vector<Row> rows;
+  nanogui::Label* frameCountLabel;
+  nanogui::Label* bufferPoolLabel;
+  std::chrono::steady_clock::time_point lastUpdate;
+};
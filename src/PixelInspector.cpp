@@ -0,0 +1,376 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "PixelInspector.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__)
+#define REGION_STATS_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#define REGION_STATS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// Rec. 709 luminance weights (as used by the false colour overlay):
+constexpr float lumaR = 0.2126f;
+constexpr float lumaG = 0.7152f;
+constexpr float lumaB = 0.0722f;
+
+// The histogram bin is taken straight from the float's bits: the exponent
+// gives 2 * floor(log2(v)) and one is added if the mantissa is at least
+// that of sqrt(2), i.e. for the upper half stop [sqrt(2), 2) * 2^e. Zero
+// and negative values give a negative bin:
+constexpr std::int32_t binOffset = (127 + RegionStats::minStop) * 2;
+constexpr std::int32_t mantissaMask = 0x7fffff;
+constexpr std::int32_t sqrt2Mantissa = 0x3504f3; // Mantissa bits of 1.41421356f.
+
+int clampBin(std::int32_t bin) {
+  return std::min(std::max(bin, 0), RegionStats::histogramBins - 1);
+}
+
+int histogramBin(float luminance) {
+  std::int32_t bits;
+  std::memcpy(&bits, &luminance, sizeof(bits));
+  const std::int32_t upperHalf = (bits & mantissaMask) >= sqrt2Mantissa ? 1 : 0;
+  return clampBin((bits >> 23) * 2 + upperHalf - binOffset);
+}
+
+char* writeDigits(unsigned long long value, char* p, char* end) {
+  char digits[20];
+  int n = 0;
+  do {
+    digits[n++] = char('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  while (n > 0 && p < end) {
+    *p++ = digits[--n];
+  }
+  return p;
+}
+
+struct Accumulator {
+  float min[3];
+  float max[3];
+  double sum[3];
+  double luminanceSum;
+
+  Accumulator() : luminanceSum(0.0) {
+    for (int c = 0; c < 3; ++c) {
+      min[c] = std::numeric_limits<float>::infinity();
+      max[c] = -std::numeric_limits<float>::infinity();
+      sum[c] = 0.0;
+    }
+  }
+};
+
+void accumulateScalar(const float* rgb, std::size_t count, Accumulator& acc, std::uint32_t* histogram) {
+  for (std::size_t i = 0; i < count; ++i, rgb += 3) {
+    for (int c = 0; c < 3; ++c) {
+      acc.min[c] = std::min(acc.min[c], rgb[c]);
+      acc.max[c] = std::max(acc.max[c], rgb[c]);
+      acc.sum[c] += rgb[c];
+    }
+    const float luminance = lumaR * rgb[0] + lumaG * rgb[1] + lumaB * rgb[2];
+    acc.luminanceSum += luminance;
+    histogram[histogramBin(luminance)] += 1;
+  }
+}
+
+#if defined(REGION_STATS_SSE2)
+
+float horizontalMin(__m128 v) {
+  v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+  v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+  return _mm_cvtss_f32(v);
+}
+
+float horizontalMax(__m128 v) {
+  v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+  v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+  return _mm_cvtss_f32(v);
+}
+
+float horizontalSum(__m128 v) {
+  float lanes[4];
+  _mm_storeu_ps(lanes, v);
+  return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+}
+
+// Process one row of count pixels, four at a time. Sums are kept in
+// single precision for one row only so precision is not lost over a
+// large region:
+void accumulateRow(const float* rgb, std::size_t count, Accumulator& acc, std::uint32_t* histogram) {
+  __m128 minR = _mm_set1_ps(acc.min[0]), minG = _mm_set1_ps(acc.min[1]), minB = _mm_set1_ps(acc.min[2]);
+  __m128 maxR = _mm_set1_ps(acc.max[0]), maxG = _mm_set1_ps(acc.max[1]), maxB = _mm_set1_ps(acc.max[2]);
+  __m128 sumR = _mm_setzero_ps(), sumG = _mm_setzero_ps(), sumB = _mm_setzero_ps(), sumL = _mm_setzero_ps();
+  const __m128 wR = _mm_set1_ps(lumaR), wG = _mm_set1_ps(lumaG), wB = _mm_set1_ps(lumaB);
+  const __m128i offset = _mm_set1_epi32(binOffset);
+  const __m128i mask = _mm_set1_epi32(mantissaMask);
+  const __m128i threshold = _mm_set1_epi32(sqrt2Mantissa - 1);
+  alignas(16) std::int32_t bins[4];
+
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4, rgb += 12) {
+    // De-interleave R0 G0 B0 R1 | G1 B1 R2 G2 | B2 R3 G3 B3:
+    const __m128 v0 = _mm_loadu_ps(rgb);
+    const __m128 v1 = _mm_loadu_ps(rgb + 4);
+    const __m128 v2 = _mm_loadu_ps(rgb + 8);
+    const __m128 r = _mm_shuffle_ps(_mm_shuffle_ps(v0, v0, _MM_SHUFFLE(3, 3, 0, 0)),
+                                    _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+    const __m128 g = _mm_shuffle_ps(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(0, 0, 1, 1)),
+                                    _mm_shuffle_ps(v1, v2, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+    const __m128 b = _mm_shuffle_ps(_mm_shuffle_ps(v0, v1, _MM_SHUFFLE(1, 1, 2, 2)),
+                                    _mm_shuffle_ps(v2, v2, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+    minR = _mm_min_ps(minR, r);
+    minG = _mm_min_ps(minG, g);
+    minB = _mm_min_ps(minB, b);
+    maxR = _mm_max_ps(maxR, r);
+    maxG = _mm_max_ps(maxG, g);
+    maxB = _mm_max_ps(maxB, b);
+    sumR = _mm_add_ps(sumR, r);
+    sumG = _mm_add_ps(sumG, g);
+    sumB = _mm_add_ps(sumB, b);
+    const __m128 l = _mm_add_ps(_mm_add_ps(_mm_mul_ps(wR, r), _mm_mul_ps(wG, g)), _mm_mul_ps(wB, b));
+    sumL = _mm_add_ps(sumL, l);
+    // As histogramBin() (the comparison gives -1 for the upper half stop):
+    const __m128i bits = _mm_castps_si128(l);
+    const __m128i upperHalf = _mm_cmpgt_epi32(_mm_and_si128(bits, mask), threshold);
+    const __m128i stops = _mm_slli_epi32(_mm_srai_epi32(bits, 23), 1);
+    _mm_store_si128(reinterpret_cast<__m128i*>(bins), _mm_sub_epi32(_mm_sub_epi32(stops, upperHalf), offset));
+    for (int k = 0; k < 4; ++k) {
+      histogram[clampBin(bins[k])] += 1;
+    }
+  }
+
+  acc.min[0] = horizontalMin(minR);
+  acc.min[1] = horizontalMin(minG);
+  acc.min[2] = horizontalMin(minB);
+  acc.max[0] = horizontalMax(maxR);
+  acc.max[1] = horizontalMax(maxG);
+  acc.max[2] = horizontalMax(maxB);
+  acc.sum[0] += horizontalSum(sumR);
+  acc.sum[1] += horizontalSum(sumG);
+  acc.sum[2] += horizontalSum(sumB);
+  acc.luminanceSum += horizontalSum(sumL);
+  accumulateScalar(rgb, count - i, acc, histogram);
+}
+
+#elif defined(REGION_STATS_NEON)
+
+void accumulateRow(const float* rgb, std::size_t count, Accumulator& acc, std::uint32_t* histogram) {
+  float32x4_t minR = vdupq_n_f32(acc.min[0]), minG = vdupq_n_f32(acc.min[1]), minB = vdupq_n_f32(acc.min[2]);
+  float32x4_t maxR = vdupq_n_f32(acc.max[0]), maxG = vdupq_n_f32(acc.max[1]), maxB = vdupq_n_f32(acc.max[2]);
+  float32x4_t sumR = vdupq_n_f32(0.f), sumG = vdupq_n_f32(0.f), sumB = vdupq_n_f32(0.f), sumL = vdupq_n_f32(0.f);
+  const int32x4_t offset = vdupq_n_s32(binOffset);
+  const int32x4_t mask = vdupq_n_s32(mantissaMask);
+  const int32x4_t threshold = vdupq_n_s32(sqrt2Mantissa);
+  std::int32_t bins[4];
+
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4, rgb += 12) {
+    const float32x4x3_t v = vld3q_f32(rgb);
+    minR = vminq_f32(minR, v.val[0]);
+    minG = vminq_f32(minG, v.val[1]);
+    minB = vminq_f32(minB, v.val[2]);
+    maxR = vmaxq_f32(maxR, v.val[0]);
+    maxG = vmaxq_f32(maxG, v.val[1]);
+    maxB = vmaxq_f32(maxB, v.val[2]);
+    sumR = vaddq_f32(sumR, v.val[0]);
+    sumG = vaddq_f32(sumG, v.val[1]);
+    sumB = vaddq_f32(sumB, v.val[2]);
+    float32x4_t l = vmulq_n_f32(v.val[0], lumaR);
+    l = vmlaq_n_f32(l, v.val[1], lumaG);
+    l = vmlaq_n_f32(l, v.val[2], lumaB);
+    sumL = vaddq_f32(sumL, l);
+    // As histogramBin() (the comparison gives -1 for the upper half stop):
+    const int32x4_t bits = vreinterpretq_s32_f32(l);
+    const int32x4_t upperHalf = vreinterpretq_s32_u32(vcgeq_s32(vandq_s32(bits, mask), threshold));
+    const int32x4_t stops = vshlq_n_s32(vshrq_n_s32(bits, 23), 1);
+    vst1q_s32(bins, vsubq_s32(vsubq_s32(stops, upperHalf), offset));
+    for (int k = 0; k < 4; ++k) {
+      histogram[clampBin(bins[k])] += 1;
+    }
+  }
+
+  acc.min[0] = vminvq_f32(minR);
+  acc.min[1] = vminvq_f32(minG);
+  acc.min[2] = vminvq_f32(minB);
+  acc.max[0] = vmaxvq_f32(maxR);
+  acc.max[1] = vmaxvq_f32(maxG);
+  acc.max[2] = vmaxvq_f32(maxB);
+  acc.sum[0] += vaddvq_f32(sumR);
+  acc.sum[1] += vaddvq_f32(sumG);
+  acc.sum[2] += vaddvq_f32(sumB);
+  acc.luminanceSum += vaddvq_f32(sumL);
+  accumulateScalar(rgb, count - i, acc, histogram);
+}
+
+#else
+
+void accumulateRow(const float* rgb, std::size_t count, Accumulator& acc, std::uint32_t* histogram) {
+  accumulateScalar(rgb, count, acc, histogram);
+}
+
+#endif
+
+} // end anonymous namespace
+
+void formatFixed2(float value, char* out, std::size_t size) {
+  if (size == 0) {
+    return;
+  }
+  // Leave anything unusual (or too large to scale exactly) to the C library:
+  if (!std::isfinite(value) || std::fabs(value) >= 1e9f) {
+    std::snprintf(out, size, "%.2f", value);
+    return;
+  }
+
+  char* p = out;
+  char* const end = out + size - 1;
+  const auto hundredths = static_cast<unsigned long long>(std::llround(std::fabs(double(value)) * 100.0));
+  if (value < 0.f && hundredths != 0 && p < end) {
+    *p++ = '-';
+  }
+  p = writeDigits(hundredths / 100, p, end);
+  const unsigned fraction = hundredths % 100;
+  if (p + 3 <= end) {
+    *p++ = '.';
+    *p++ = char('0' + fraction / 10);
+    *p++ = char('0' + fraction % 10);
+  }
+  *p = '\0';
+}
+
+void formatUnsigned(unsigned value, char* out, std::size_t size) {
+  if (size == 0) {
+    return;
+  }
+  *writeDigits(value, out, out + size - 1) = '\0';
+}
+
+RegionStats computeRegionStats(const float* rgb, int width, int height, const HdrTileCache::Region& region) {
+  RegionStats stats;
+  const int x0 = std::max(region.x, 0);
+  const int y0 = std::max(region.y, 0);
+  const int x1 = std::min(region.x + region.width, width);
+  const int y1 = std::min(region.y + region.height, height);
+  stats.region = HdrTileCache::Region{x0, y0, std::max(x1 - x0, 0), std::max(y1 - y0, 0)};
+  if (stats.region.width == 0 || stats.region.height == 0) {
+    return stats;
+  }
+
+  Accumulator acc;
+  for (int y = y0; y < y1; ++y) {
+    accumulateRow(rgb + (std::size_t(y) * width + x0) * 3, x1 - x0, acc, stats.histogram.data());
+  }
+
+  stats.pixelCount = std::size_t(stats.region.width) * stats.region.height;
+  for (int c = 0; c < 3; ++c) {
+    stats.min[c] = acc.min[c];
+    stats.max[c] = acc.max[c];
+    stats.mean[c] = acc.sum[c] / stats.pixelCount;
+  }
+  stats.meanLuminance = acc.luminanceSum / stats.pixelCount;
+  return stats;
+}
+
+bool regionStatsSimdAvailable() {
+#if defined(REGION_STATS_SSE2) || defined(REGION_STATS_NEON)
+  return true;
+#else
+  return false;
+#endif
+}
+
+PixelInspector::PixelInspector()
+    : width(0),
+      height(0),
+      channels(0),
+      yuv(false),
+      chromaWidth(0),
+      pixels(nullptr),
+      uPlane(nullptr),
+      vPlane(nullptr),
+      rawImageMatches(false) {}
+
+void PixelInspector::setFrame(const DecodedVideoFrame& frame) {
+  width = frame.width;
+  height = frame.height;
+  yuv = frame.yuv;
+  pixels = frame.pixels.data();
+  if (yuv) {
+    channels = 3;
+    chromaWidth = frame.chromaWidth();
+    uPlane = frame.uPlane();
+    vPlane = frame.vPlane();
+    coefficients = frame.coefficients;
+  } else {
+    const auto area = std::size_t(width) * height;
+    channels = area ? int(frame.pixels.size() / area) : 0;
+  }
+  rawImageMatches = rawImage && rawImage->width == width && rawImage->height == height;
+}
+
+void PixelInspector::setRawImage(const HdrImageReceiver::ImagePtr& image) {
+  rawImage = image;
+  rawImageMatches = rawImage && rawImage->width == width && rawImage->height == height;
+}
+
+void PixelInspector::setTiles(std::vector<HdrTileCache::TileView>&& newTiles) {
+  tiles = std::move(newTiles);
+}
+
+bool PixelInspector::rawValue(int x, int y, float rgb[3]) const {
+  // There are only a few tiles so a linear search is fine:
+  const HdrTileCache::TileView* tile = nullptr;
+  for (const auto& t : tiles) {
+    if (t.region.contains(x, y)) {
+      tile = &t;
+      break;
+    }
+  }
+
+  const float* src = nullptr;
+  if (tile) {
+    const auto& r = tile->region;
+    src = tile->pixels->data() + (std::size_t(y - r.y) * r.width + (x - r.x)) * 3;
+  } else if (rawImageMatches) {
+    src = rawImage->pixels.data() + (std::size_t(y) * width + x) * 3;
+  } else {
+    return false;
+  }
+  std::copy(src, src + 3, rgb);
+  return true;
+}
+
+void PixelInspector::inspect(int x, int y, bool raw, char** out, std::size_t size) const {
+  if (x < 0 || y < 0 || x >= width || y >= height || pixels == nullptr) {
+    return;
+  }
+
+  float rgb[3];
+  if (raw && rawValue(x, y, rgb)) {
+    for (int c = 0; c < 3; ++c) {
+      formatFixed2(rgb[c], out[c], size);
+    }
+  } else if (yuv) {
+    const std::size_t cIndex = (x / 2) + std::size_t(chromaWidth) * (y / 2);
+    std::uint8_t value[3];
+    yuvToRgb(coefficients, pixels[x + std::size_t(width) * y], uPlane[cIndex], vPlane[cIndex], value);
+    for (int c = 0; c < 3; ++c) {
+      formatUnsigned(value[c], out[c], size);
+    }
+  } else {
+    const std::size_t index = (x + std::size_t(width) * y) * channels;
+    for (int c = 0; c < channels; ++c) {
+      formatUnsigned(pixels[index + c], out[c], size);
+    }
+  }
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "DecodedVideoFrame.hpp"
+#include "HdrImageReceiver.hpp"
+#include "HdrTileCache.hpp"
+
+/// Write value with two decimal places (as "%.2f" would) to out which
+/// holds size bytes. Much cheaper than snprintf for the values shown
+/// on hundreds of pixels at high zoom.
+void formatFixed2(float value, char* out, std::size_t size);
+
+/// Write a non-negative integer in decimal to out (as "%i" would).
+void formatUnsigned(unsigned value, char* out, std::size_t size);
+
+/// Statistics of the raw HDR values in a region of an image.
+struct RegionStats {
+  /// Luminance histogram bins: two per stop (split at sqrt(2) * 2^e)
+  /// starting from 2^minStop (values outside the range are counted in
+  /// the first or last bin).
+  static constexpr int histogramBins = 64;
+  static constexpr int minStop = -16;
+
+  HdrTileCache::Region region;
+  std::size_t pixelCount = 0;
+  float min[3] = {0.f, 0.f, 0.f};
+  float max[3] = {0.f, 0.f, 0.f};
+  double mean[3] = {0.0, 0.0, 0.0};
+  double meanLuminance = 0.0;
+  std::array<std::uint32_t, histogramBins> histogram{};
+};
+
+/// Compute the statistics of a region of a packed RGB float image (the
+/// region is clipped to the image). Uses SSE2 (x86) or NEON (AArch64).
+RegionStats computeRegionStats(const float* rgb, int width, int height, const HdrTileCache::Region& region);
+
+/// True if computeRegionStats() is using a SIMD implementation.
+bool regionStatsSimdAvailable();
+
+/// Looks up the values shown for each pixel at high zoom.
+///
+/// Works from a snapshot taken on the UI thread once per draw: the
+/// frame being displayed (whose layout is cached when it changes), the
+/// latest raw HDR image and the HDR tiles that were cached at the time.
+/// Lookups are then lock and allocation free and can not race with the
+/// decode or demuxer threads.
+class PixelInspector {
+public:
+  PixelInspector();
+
+  /// Use the given frame for video pixel values. It must not be modified
+  /// until the next call (the triple buffer's read buffer satisfies this).
+  void setFrame(const DecodedVideoFrame& frame);
+
+  /// Raw HDR values are only used if the image matches the frame size.
+  void setRawImage(const HdrImageReceiver::ImagePtr& image);
+  void setTiles(std::vector<HdrTileCache::TileView>&& tiles);
+
+  /// Format the value of each channel of pixel (x, y) to out. Raw HDR
+  /// values (from the newest tile covering the pixel or else the raw
+  /// image) are used if raw is true and available.
+  void inspect(int x, int y, bool raw, char** out, std::size_t size) const;
+
+private:
+  bool rawValue(int x, int y, float rgb[3]) const;
+
+  // Layout of the current frame:
+  int width;
+  int height;
+  int channels;
+  bool yuv;
+  int chromaWidth;
+  const std::uint8_t* pixels;
+  const std::uint8_t* uPlane;
+  const std::uint8_t* vPlane;
+  YuvToRgbCoefficients coefficients;
+
+  HdrImageReceiver::ImagePtr rawImage;
+  bool rawImageMatches;
+  std::vector<HdrTileCache::TileView> tiles; // Newest first.
+};
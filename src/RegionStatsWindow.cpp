@@ -0,0 +1,78 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "RegionStatsWindow.hpp"
+
+#include <algorithm>
+#include <string>
+
+namespace {
+
+std::string formatValue(double value) {
+  char text[32];
+  formatFixed2(float(value), text, sizeof(text));
+  return text;
+}
+
+} // end anonymous namespace
+
+RegionStatsWindow::RegionStatsWindow(nanogui::Widget* parent)
+    : nanogui::Window(parent, "Region Statistics") {
+  using namespace nanogui;
+  set_layout(new GroupLayout(10));
+
+  regionLabel = new Label(this, "Shift-drag over the preview to select a region.");
+
+  auto* table = new Widget(this);
+  auto* grid = new GridLayout(Orientation::Horizontal, 4, Alignment::Maximum, 0, 6);
+  grid->set_col_alignment({Alignment::Minimum, Alignment::Maximum, Alignment::Maximum, Alignment::Maximum});
+  table->set_layout(grid);
+  new Label(table, "", "sans-bold");
+  new Label(table, "R", "sans-bold");
+  new Label(table, "G", "sans-bold");
+  new Label(table, "B", "sans-bold");
+  const char* rowNames[3] = {"min", "max", "mean"};
+  for (int r = 0; r < 3; ++r) {
+    new Label(table, rowNames[r], "sans-bold");
+    for (int c = 0; c < 3; ++c) {
+      channelLabels[r][c] = new Label(table, "-");
+    }
+  }
+
+  luminanceLabel = new Label(this, "Mean luminance: -");
+  new Label(this, "Luminance (" + std::to_string(RegionStats::minStop) + " to +" +
+                  std::to_string(RegionStats::minStop + RegionStats::histogramBins / 2) + " stops)", "sans-bold");
+  histogram = new Graph(this, "");
+  histogram->set_fixed_size(Vector2i(220, 48));
+  set_visible(false);
+}
+
+void RegionStatsWindow::update(const RegionStats& stats) {
+  if (stats.region.width <= 0 || stats.region.height <= 0) {
+    set_visible(false);
+    return;
+  }
+  const bool wasVisible = visible();
+  set_visible(true);
+
+  regionLabel->set_caption(std::to_string(stats.region.width) + "x" + std::to_string(stats.region.height) +
+                           " at (" + std::to_string(stats.region.x) + ", " + std::to_string(stats.region.y) + ")" +
+                           (stats.pixelCount == 0 ? ": no raw image." : ""));
+  for (int c = 0; c < 3; ++c) {
+    channelLabels[0][c]->set_caption(stats.pixelCount ? formatValue(stats.min[c]) : "-");
+    channelLabels[1][c]->set_caption(stats.pixelCount ? formatValue(stats.max[c]) : "-");
+    channelLabels[2][c]->set_caption(stats.pixelCount ? formatValue(stats.mean[c]) : "-");
+  }
+  luminanceLabel->set_caption("Mean luminance: " + (stats.pixelCount ? formatValue(stats.meanLuminance) : "-"));
+
+  // Scale so the tallest bin fills the graph:
+  std::vector<float> bins(stats.histogram.begin(), stats.histogram.end());
+  const float tallest = std::max(1.f, *std::max_element(bins.begin(), bins.end()));
+  for (auto& b : bins) {
+    b /= tallest;
+  }
+  histogram->set_values(bins);
+
+  if (!wasVisible) {
+    screen()->perform_layout();
+  }
+}
@@ -0,0 +1,24 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <nanogui/nanogui.h>
+
+#include "PixelInspector.hpp"
+
+/// Window showing the statistics of the raw HDR values in the region
+/// selected on the preview (see VideoPreviewWindow::setRegionStatsCallback):
+/// the minimum, maximum and mean of each channel and a histogram of
+/// luminance in stops. Hidden while nothing is selected.
+class RegionStatsWindow : public nanogui::Window {
+public:
+  RegionStatsWindow(nanogui::Widget* parent);
+
+  void update(const RegionStats& stats);
+
+private:
+  nanogui::Label* regionLabel;
+  nanogui::Label* channelLabels[3][3]; // [min, max, mean][channel]
+  nanogui::Label* luminanceLabel;
+  nanogui::Graph* histogram;
+};
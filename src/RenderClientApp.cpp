@@ -1,37 +1,75 @@
 // Copyright (c) 2022 Graphcore Ltd. All rights reserved.
 
 #include "RenderClientApp.hpp"
+#include "ThreadSettings.hpp"
 
 #include <GLFW/glfw3.h>
-#include <PacketSerialisation.h>
 
-#include <iomanip>
+#include <boost/log/trivial.hpp>
 
-RenderClientApp::RenderClientApp(const nanogui::Vector2i& size, PacketMuxer& tx, PacketDemuxer& rx)
-    : nanogui::Screen(size, "IPU Neural Render Preview", false),
-      sender(tx),
-      preview(nullptr),
-      form(nullptr) {
+namespace {
+// Interval between housekeeping redraws when redraws are event-driven:
+constexpr auto tickInterval = std::chrono::milliseconds(250);
+const int margin = 10;
+} // end anonymous namespace
 
-  form = new ControlsForm(this, tx, rx, preview);
+RenderClientApp::RenderClientApp(const nanogui::Vector2i& size,
+                                 const std::vector<SessionConnection>& connections,
+                                 const VideoPreviewOptions& videoOptions,
+                                 const ControlOptions& controlOptions,
+                                 const TelemetryOptions& telemetryOptions)
+    : nanogui::Screen(size, "IPU Neural Render Preview", false),
+      eventDriven(false),
+      redrawPending(false),
+      stopTicker(false) {
+  auto frameReady = [this]() {
+    if (eventDriven) {
+      requestRedraw();
+    }
+  };
+  auto options = videoOptions;
+  for (const auto& c : connections) {
+    sessions.push_back(std::make_unique<RenderSession>(this, c.name, *c.connection, options, controlOptions,
+                                                       telemetryOptions, c.recorder, frameReady));
+    // Each session needs its own port for UDP video:
+    if (options.udp.port != 0) {
+      options.udp.port += 1;
+    }
+  }
 
-  syncWithServer(tx, rx, "ready");
+  if (!telemetryOptions.csvFile.empty() || telemetryOptions.metricsPort != 0) {
+    std::vector<TelemetryExporter::Source> sources;
+    for (const auto& s : sessions) {
+      sources.push_back({s->getName().empty() ? "default" : s->getName(), &s->getTelemetry()});
+    }
+    telemetryExporter.reset(new TelemetryExporter(sources, telemetryOptions));
+  }
 
-  preview = new VideoPreviewWindow(this, "Render Preview", rx);
+  position_windows();
+}
 
-  // Have to manually set positions due to bug in ComboBox:
-  const int margin = 10;
+void RenderClientApp::position_windows() {
   nanogui::Vector2i pos(margin, margin);
-  preview->set_position(pos);
-  pos[0] += margin + preview->width();
-  form->set_position(nanogui::Vector2i(pos));
+  for (auto& s : sessions) {
+    const auto covered = s->position_windows(pos);
+    pos[1] += covered.y() + margin;
+  }
   perform_layout();
 }
 
 RenderClientApp::~RenderClientApp() {
-  // Tell the server we are disconnecting so
-  // it can cleanly tear down its communications:
-  serialise(sender, "detach", true);
+  if (ticker) {
+    {
+      std::lock_guard<std::mutex> lock(tickerMutex);
+      stopTicker = true;
+    }
+    tickerCondition.notify_all();
+    ticker->join();
+  }
+  // The exporter reads the sessions' telemetry:
+  telemetryExporter.reset();
+  // Sessions must go while their windows (which the screen owns) exist:
+  sessions.clear();
 }
 
 bool RenderClientApp::keyboard_event(int key, int scancode, int action, int modifiers) {
@@ -41,7 +79,25 @@ bool RenderClientApp::keyboard_event(int key, int scancode, int action, int modi
 
   if (action == GLFW_PRESS) {
     if (key == GLFW_KEY_R) {
-      preview->reset();
+      for (auto& s : sessions) {
+        s->resetView();
+      }
+      return true;
+    }
+    if (key == GLFW_KEY_P) {
+      // Toggle the frame timing overlays:
+      for (auto& s : sessions) {
+        s->toggleStatsOverlay();
+      }
+      perform_layout();
+      return true;
+    }
+    if (key == GLFW_KEY_T) {
+      // Toggle the telemetry graphs:
+      for (auto& s : sessions) {
+        s->toggleTelemetry();
+      }
+      perform_layout();
       return true;
     }
     if (key == GLFW_KEY_ESCAPE) {
@@ -54,22 +110,62 @@ bool RenderClientApp::keyboard_event(int key, int scancode, int action, int modi
 }
 
 void RenderClientApp::draw(NVGcontext* ctx) {
-  if (preview != nullptr && form != nullptr) {
-    // Update bandwidth text before display:
-    std::stringstream ss;
-    ss << std::fixed << std::setprecision(2)
-       << preview->getVideoBandwidthMbps();
-    form->bitRateText->set_value(ss.str());
-    // Update frame rate text:
-    ss.str(std::string());
-    ss << std::fixed << std::setprecision(2)
-       << preview->getFrameRate();
-    form->frameRateText->set_value(ss.str());
+  bool layoutChanged = false;
+  for (auto& s : sessions) {
+    s->update();
+    // Previews resize themselves once the video dimensions are known:
+    layoutChanged |= s->needsLayout();
+  }
+  if (layoutChanged) {
+    position_windows();
   }
   Screen::draw(ctx);
 }
 
+void RenderClientApp::draw_all() {
+  // Called by every main loop iteration but the screen only redraws if asked:
+  if (redrawPending.exchange(false)) {
+    redraw();
+  }
+  Screen::draw_all();
+
+  for (auto& s : sessions) {
+    s->framePresented();
+  }
+}
+
+void RenderClientApp::enableEventDrivenRedraw() {
+  if (eventDriven) {
+    return;
+  }
+#if defined(NANOGUI_USE_OPENGL) || defined(NANOGUI_USE_GLES)
+  // Present on vertical sync so frames are paced by the display:
+  glfwMakeContextCurrent(glfw_window());
+  glfwSwapInterval(1);
+#endif
+  eventDriven = true;
+
+  // Status text, stream feedback and the connection checks all happen
+  // in draw() so keep that ticking over at a low rate:
+  ticker.reset(new std::thread([this]() {
+    setCurrentThreadName("rui-redraw");
+    std::unique_lock<std::mutex> lock(tickerMutex);
+    while (!tickerCondition.wait_for(lock, tickInterval, [this]() { return bool(stopTicker); })) {
+      requestRedraw();
+    }
+  }));
+}
+
+void RenderClientApp::requestRedraw() {
+  // Posting an empty event is thread safe in GLFW. The flag is picked
+  // up by draw_all() when the main loop wakes:
+  redrawPending = true;
+  glfwPostEmptyEvent();
+}
+
 void RenderClientApp::set_nif_selection(const ControlsForm::FileLookup& nifFileMapping) {
-  form->set_nif_selection(nifFileMapping);
+  for (auto& s : sessions) {
+    s->set_nif_selection(nifFileMapping);
+  }
   perform_layout();
 }
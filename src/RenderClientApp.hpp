@@ -2,26 +2,72 @@
 
 #pragma once
 
-#include <PacketComms.h>
 #include <nanogui/nanogui.h>
 
-#include "ControlsForm.hpp"
-#include "VideoPreviewWindow.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
-/// A screen containing all the application's other windows.
+#include "RenderSession.hpp"
+
+/// A server to open a session with.
+struct SessionConnection {
+  /// Shown in the session's window titles (may be empty if there is only one).
+  std::string name;
+  /// Must already be connected and must outlive the app.
+  ConnectionManager* connection = nullptr;
+  /// If set everything received in the session is recorded.
+  capture::PacketRecorder* recorder = nullptr;
+};
+
+/// A screen containing a RenderSession (preview and controls) for each
+/// render server so that several can be monitored side by side. Each
+/// session has its own connection and decode thread but they share this
+/// window, its GL context and one UI loop in which all the sessions'
+/// newly decoded frames are uploaded and presented together.
 class RenderClientApp : public nanogui::Screen {
 public:
-  RenderClientApp(const nanogui::Vector2i& size, PacketMuxer& sender, PacketDemuxer& receiver);
+  RenderClientApp(const nanogui::Vector2i& size, const std::vector<SessionConnection>& connections,
+                  const VideoPreviewOptions& videoOptions,
+                  const ControlOptions& controlOptions = ControlOptions(),
+                  const TelemetryOptions& telemetryOptions = TelemetryOptions());
   virtual ~RenderClientApp();
 
   virtual bool keyboard_event(int key, int scancode, int action, int modifiers);
 
   virtual void draw(NVGcontext* ctx);
 
+  /// Draws and presents the screen then records the timing of any
+  /// video frames that were displayed.
+  virtual void draw_all();
+
+  /// Set the NIF model menu of every session.
   void set_nif_selection(const ControlsForm::FileLookup& nifFileMapping);
 
+  /// Only redraw when a new video frame is ready, on input and at a
+  /// low fixed rate (for status text and housekeeping) instead of at
+  /// the main loop's refresh rate, and sync buffer swaps to the display.
+  /// Use with nanogui::mainloop(-1) so that the loop sleeps otherwise.
+  void enableEventDrivenRedraw();
+
 private:
-  PacketMuxer& sender;
-  VideoPreviewWindow* preview;
-  ControlsForm* form;
+  /// Lay each session's windows out side by side with one session per row.
+  void position_windows();
+
+  std::vector<std::unique_ptr<RenderSession>> sessions;
+  std::unique_ptr<TelemetryExporter> telemetryExporter;
+
+  // Event-driven redraw: redraws are requested from other threads by
+  // setting redrawPending and posting an empty event to wake the loop.
+  std::atomic<bool> eventDriven;
+  std::atomic<bool> redrawPending;
+  std::atomic<bool> stopTicker;
+  std::mutex tickerMutex;
+  std::condition_variable tickerCondition;
+  std::unique_ptr<std::thread> ticker;
+  void requestRedraw();
 };
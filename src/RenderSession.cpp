@@ -0,0 +1,309 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "RenderSession.hpp"
+
+#include <PacketSerialisation.h>
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+// Interval between stream_feedback packets:
+constexpr auto feedbackInterval = std::chrono::milliseconds(500);
+// Interval between updates of the stats text:
+constexpr auto statsInterval = std::chrono::milliseconds(250);
+// Reconnect again if the server has not said it is ready within this time of reconnecting:
+constexpr auto resyncTimeout = std::chrono::seconds(10);
+const std::string previewTitle = "Render Preview";
+const std::string formTitle = "Control";
+const int margin = 10;
+// Approximate width of the region statistics window (placed top right of the preview):
+const int regionStatsWidth = 260;
+} // end anonymous namespace
+
+RenderSession::RenderSession(nanogui::Screen* screen, const std::string& sessionName,
+                             ConnectionManager& connectionManager,
+                             const VideoPreviewOptions& videoOptions,
+                             const ControlOptions& controlOptions,
+                             const TelemetryOptions& telemetryOptions,
+                             capture::PacketRecorder* packetRecorder,
+                             std::function<void()> frameReady)
+    : name(sessionName),
+      connection(connectionManager),
+      sessionActive(false),
+      reportedAttempts(0),
+      resyncing(false),
+      serverReady(false),
+      controls(connectionManager.sender(), controlOptions),
+      recorder(packetRecorder),
+      preview(nullptr),
+      previewWidth(0),
+      statsOverlay(nullptr),
+      regionStats(nullptr),
+      telemetry(telemetryOptions.historySize),
+      telemetryWindow(nullptr),
+      telemetryInterval(telemetryOptions.interval) {
+  const std::string suffix = name.empty() ? "" : " - " + name;
+
+  // The preview initialises its stream asynchronously so it can be created
+  // first (the form needs it) and subscribe before we sync with the server:
+  auto& rx = connection.receiver();
+  auto previewOptions = videoOptions;
+  previewOptions.frameReady = frameReady;
+  previewOptions.udp.serverHost = connection.getHost();
+  preview = new VideoPreviewWindow(screen, previewTitle + suffix, rx, connection.sender(), previewOptions);
+  form.reset(new ControlsForm(screen, controls, rx, connection.bulkReceiver(), preview));
+  form->set_title(formTitle + suffix);
+  startRecording();
+  handshake();
+  sessionActive = true;
+
+  statsOverlay = new PerformanceOverlay(screen, frameStats);
+  statsOverlay->set_title(statsOverlay->title() + suffix);
+  statsOverlay->set_visible(false);
+
+  regionStats = new RegionStatsWindow(screen);
+  regionStats->set_title(regionStats->title() + suffix);
+  preview->setRegionStatsCallback([this](const RegionStats& stats) { regionStats->update(stats); });
+
+  telemetryWindow = new TelemetryWindow(screen, telemetry, telemetryOptions.graphSamples, telemetryInterval);
+  telemetryWindow->set_title(telemetryWindow->title() + suffix);
+  telemetryWindow->set_visible(false);
+}
+
+RenderSession::~RenderSession() {
+  // The decode thread may call back into the owner so stop it first:
+  preview->detach();
+
+  // Tell the server we are disconnecting so
+  // it can cleanly tear down its communications:
+  if (sessionActive && connection.ok()) {
+    serialise(connection.sender(), "detach", true);
+  }
+
+  readySubscription = PacketSubscription();
+
+  // The form's handlers refer to its widgets and the preview (which the
+  // screen owns) so it must unsubscribe and go before the screen does:
+  form->detach();
+  form.reset();
+}
+
+void RenderSession::sendCapabilities() {
+  if (!controls.getOptions().hdrCapabilities) {
+    return;
+  }
+  // Advertise the HDR encodings we can decode so the server
+  // can choose the most compact one during the handshake:
+  serialise(connection.sender(), "hdr_capabilities", packets::HdrCapabilities{HdrImageReceiver::supportedEncodings()});
+}
+
+void RenderSession::handshake() {
+  sendCapabilities();
+  syncWithServer(connection.sender(), connection.receiver(), "ready");
+}
+
+void RenderSession::setPreviewStatus(const std::string& status) {
+  preview->set_title(previewTitle + (name.empty() ? "" : " - " + name) + status);
+}
+
+void RenderSession::checkConnection() {
+  if (connection.reconnecting()) {
+    if (connection.poll()) {
+      resumeSession();
+    } else if (connection.failedAttempts() != reportedAttempts) {
+      reportedAttempts = connection.failedAttempts();
+      setPreviewStatus(" (reconnecting, attempt " + std::to_string(reportedAttempts + 1) + ")");
+    }
+    return;
+  }
+
+  if (resyncing) {
+    if (serverReady) {
+      finishResume();
+    } else if (!connection.ok()) {
+      connectionLost("Lost connection to the server");
+    } else if (std::chrono::steady_clock::now() - resyncStart >= resyncTimeout) {
+      connectionLost("Server did not become ready after reconnecting");
+    }
+    return;
+  }
+
+  // A stalled video stream usually means the link has gone even if
+  // the socket has not noticed yet (e.g. on Wi-Fi):
+  if (!sessionActive || (connection.ok() && !preview->streamLost())) {
+    return;
+  }
+  connectionLost("Lost connection to the server");
+}
+
+void RenderSession::connectionLost(const std::string& reason) {
+  BOOST_LOG_TRIVIAL(warning) << reason << (name.empty() ? "" : " " + name) << ".";
+  suspendSession();
+  if (connection.options().enabled) {
+    connection.startReconnecting();
+    reportedAttempts = 0;
+    setPreviewStatus(" (reconnecting)");
+  } else {
+    setPreviewStatus(" (disconnected)");
+  }
+}
+
+void RenderSession::suspendSession() {
+  // Everything referring to the muxers must let go before they are destroyed:
+  sessionActive = false;
+  resyncing = false;
+  readySubscription = PacketSubscription();
+  if (recorder) {
+    recorder->unsubscribe();
+  }
+  controls.setSender(nullptr);
+  form->detach();
+  preview->detach();
+  connection.disconnect();
+}
+
+void RenderSession::resumeSession() {
+  // Subscribe before syncing (as on start-up) so nothing the
+  // server sends once it is ready can be missed:
+  form->attach(connection.receiver(), connection.bulkReceiver());
+  preview->attach(connection.receiver(), connection.sender());
+  startRecording();
+
+  // The same handshake as on start-up but polled from update() instead
+  // of blocking this (UI) thread. Control changes are held until it is
+  // done:
+  sendCapabilities();
+  serverReady = false;
+  readySubscription = connection.receiver().subscribe("ready", [this](const ComPacket::ConstSharedPacket&) {
+    serverReady = true;
+  });
+  resyncing = true;
+  resyncStart = std::chrono::steady_clock::now();
+  setPreviewStatus(" (waiting for server)");
+}
+
+void RenderSession::finishResume() {
+  readySubscription = PacketSubscription();
+  resyncing = false;
+  serialise(connection.sender(), "ready", true);
+  controls.setSender(&connection.sender());
+  form->resendState();
+  sessionActive = true;
+  setPreviewStatus("");
+  BOOST_LOG_TRIVIAL(info) << "Session resumed" << (name.empty() ? "" : ": " + name) << ".";
+}
+
+void RenderSession::startRecording() {
+  if (recorder == nullptr) {
+    return;
+  }
+  recorder->subscribe(connection.receiver());
+  if (&connection.bulkReceiver() != &connection.receiver()) {
+    recorder->subscribe(connection.bulkReceiver());
+  }
+}
+
+nanogui::Vector2i RenderSession::position_windows(const nanogui::Vector2i& topLeft) {
+  // Have to manually set positions due to bug in ComboBox:
+  nanogui::Vector2i pos = topLeft;
+  preview->set_position(pos);
+  statsOverlay->set_position(pos + nanogui::Vector2i(margin, 30));
+  telemetryWindow->set_position(pos + nanogui::Vector2i(margin, 60));
+  regionStats->set_position(pos + nanogui::Vector2i(std::max(margin, preview->width() - regionStatsWidth), 30));
+  pos[0] += margin + preview->width();
+  form->set_position(pos);
+  previewWidth = preview->width();
+  return nanogui::Vector2i(pos.x() + form->window_size().x() - topLeft.x(),
+                           std::max(preview->height(), form->window_size().y()));
+}
+
+void RenderSession::update() {
+  checkConnection();
+
+  // Send the latest values of any controls that changed since last frame:
+  controls.flush();
+
+  updateStatsText();
+  form->updateNifSwitchTime();
+
+  const auto& videoSize = preview->getVideoSize();
+  form->updateAdaptiveSamples(preview->getFrameRate(), preview->getLatencyMs(),
+                              std::int64_t(videoSize.x()) * videoSize.y());
+
+  if (sessionActive && controls.getOptions().streamFeedback) {
+    sendStreamFeedback();
+  }
+  recordTelemetry();
+  statsOverlay->update();
+  telemetryWindow->update();
+}
+
+void RenderSession::framePresented() {
+  FrameTiming timing;
+  if (preview->takeUploadedTiming(timing)) {
+    timing.presented = FrameTiming::Clock::now();
+    frameStats.record(timing);
+  }
+}
+
+void RenderSession::updateStatsText() {
+  const auto now = std::chrono::steady_clock::now();
+  if (now - lastStatsTime < statsInterval) {
+    return;
+  }
+  lastStatsTime = now;
+
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.2f", preview->getVideoBandwidthMbps());
+  form->bitRateText->set_value(text);
+  std::snprintf(text, sizeof(text), "%.2f", preview->getFrameRate());
+  form->frameRateText->set_value(text);
+  // Latency is only available if the server sends frame timestamps:
+  if (preview->getLatencyMs() >= 0.0) {
+    std::snprintf(text, sizeof(text), "%.1f", preview->getLatencyMs());
+    form->latencyText->set_value(text);
+  }
+}
+
+void RenderSession::recordTelemetry() {
+  const auto now = std::chrono::steady_clock::now();
+  if (now - lastTelemetryTime < telemetryInterval) {
+    return;
+  }
+  lastTelemetryTime = now;
+
+  using Channel = TelemetryHistory::Channel;
+  TelemetryHistory::Sample sample;
+  sample.timeMicros = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+  sample[Channel::PathRate] = form->getPathRate();
+  sample[Channel::RayRate] = form->getRayRate();
+  sample[Channel::VideoRate] = preview->getVideoBandwidthMbps();
+  sample[Channel::FrameRate] = preview->getFrameRate();
+  sample[Channel::QueueDepth] = preview->getQueueDepth();
+  sample[Channel::Progress] = form->getProgress();
+  telemetry.record(sample);
+}
+
+void RenderSession::sendStreamFeedback() {
+  const auto now = std::chrono::steady_clock::now();
+  if (now - lastFeedbackTime < feedbackInterval) {
+    return;
+  }
+  lastFeedbackTime = now;
+
+  const auto& videoSize = preview->getVideoSize();
+  packets::StreamFeedback feedback;
+  feedback.receiveRateMbps = preview->getVideoBandwidthMbps();
+  feedback.frameRate = preview->getFrameRate();
+  feedback.decodeTimeMs = preview->getDecodeTimeMs();
+  feedback.latencyMs = preview->getLatencyMs();
+  feedback.queueDepth = preview->getQueueDepth();
+  feedback.droppedPackets = preview->getDroppedPacketCount();
+  feedback.width = videoSize.x();
+  feedback.height = videoSize.y();
+  serialise(connection.sender(), "stream_feedback", feedback);
+}
@@ -0,0 +1,123 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <nanogui/nanogui.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "ConnectionManager.hpp"
+#include "ControlCoalescer.hpp"
+#include "ControlsForm.hpp"
+#include "FrameStats.hpp"
+#include "PacketCapture.hpp"
+#include "PerformanceOverlay.hpp"
+#include "RegionStatsWindow.hpp"
+#include "TelemetryExporter.hpp"
+#include "TelemetryWindow.hpp"
+#include "VideoPreviewWindow.hpp"
+
+/// Everything needed to view and control one render server: its
+/// connection, a preview window (with its own decode thread), a control
+/// form and the frame statistics. The windows belong to the screen
+/// they are created on so a session must be destroyed before it.
+///
+/// If the connection is lost (or the video stream stalls) the session is
+/// suspended and, if enabled, the connection is re-established in the
+/// background. The windows stay open throughout: once reconnected they
+/// are re-subscribed, the session re-syncs with the server and the
+/// current control state is sent again.
+///
+/// All methods must be called on the UI thread.
+class RenderSession {
+public:
+  /// The connection must already be established. The name is added to
+  /// window titles (so can be empty if there is only one session). If a
+  /// recorder is given everything received is written to it. frameReady
+  /// is called on the decode thread whenever a new frame can be shown.
+  RenderSession(nanogui::Screen* screen, const std::string& name, ConnectionManager& connection,
+                const VideoPreviewOptions& videoOptions, const ControlOptions& controlOptions,
+                const TelemetryOptions& telemetryOptions,
+                capture::PacketRecorder* recorder, std::function<void()> frameReady);
+  virtual ~RenderSession();
+
+  /// Per UI frame work: check the connection, send control changes and
+  /// stream feedback and refresh the status text. Call before drawing.
+  void update();
+
+  /// Record the timing of any frame that the last draw presented.
+  void framePresented();
+
+  /// Place the windows side by side with the top left at pos.
+  /// @return The size of the area they cover.
+  nanogui::Vector2i position_windows(const nanogui::Vector2i& pos);
+
+  /// True if the preview has changed size since the windows were placed.
+  bool needsLayout() const { return preview->width() != previewWidth; }
+
+  void set_nif_selection(const ControlsForm::FileLookup& nifFileMapping) { form->set_nif_selection(nifFileMapping); }
+  void resetView() { preview->reset(); }
+  void toggleStatsOverlay() { statsOverlay->set_visible(!statsOverlay->visible()); }
+  void toggleTelemetry() { telemetryWindow->set_visible(!telemetryWindow->visible()); }
+
+  const std::string& getName() const { return name; }
+  /// Recorded on the UI thread but can be read from any thread.
+  const TelemetryHistory& getTelemetry() const { return telemetry; }
+
+private:
+  /// Periodically report preview stream statistics so the server can
+  /// adapt the video bit-rate.
+  void sendStreamFeedback();
+
+  /// Update the stream statistics shown in the form (at a limited rate).
+  void updateStatsText();
+
+  /// Record a telemetry sample once per telemetry interval.
+  void recordTelemetry();
+
+  void sendCapabilities();
+  /// Send our capabilities and wait for the server to be ready. Blocks
+  /// so is only used on start-up (see resumeSession()).
+  void handshake();
+  /// Detect a lost connection and resume the session once reconnected.
+  void checkConnection();
+  void suspendSession();
+  /// Suspend the session and start reconnecting (if enabled).
+  void connectionLost(const std::string& reason);
+  /// Subscribe to the new connection and start the ready handshake
+  /// without waiting for the server (see finishResume()).
+  void resumeSession();
+  /// Complete the resume once the server has said it is ready.
+  void finishResume();
+  void startRecording();
+  void setPreviewStatus(const std::string& status);
+
+  const std::string name;
+  ConnectionManager& connection;
+  bool sessionActive;
+  unsigned reportedAttempts;
+  // Non-blocking ready handshake after a reconnect (so a server that
+  // accepts the connection but never becomes ready can not hang the UI):
+  bool resyncing;
+  std::atomic<bool> serverReady; // Set by the demuxer thread.
+  PacketSubscription readySubscription;
+  std::chrono::steady_clock::time_point resyncStart;
+  ControlCoalescer controls;
+  capture::PacketRecorder* recorder;
+  VideoPreviewWindow* preview;
+  std::unique_ptr<ControlsForm> form; // A FormHelper (not a widget) so not owned by the screen.
+  int previewWidth;
+  FrameStats frameStats;
+  PerformanceOverlay* statsOverlay;
+  RegionStatsWindow* regionStats;
+  TelemetryHistory telemetry;
+  TelemetryWindow* telemetryWindow;
+  const std::chrono::milliseconds telemetryInterval;
+  std::chrono::steady_clock::time_point lastFeedbackTime;
+  std::chrono::steady_clock::time_point lastStatsTime;
+  std::chrono::steady_clock::time_point lastTelemetryTime;
+};
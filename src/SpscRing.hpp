@@ -0,0 +1,150 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+/// Bounded single-producer/single-consumer lock-free ring buffer.
+///
+/// Exactly one thread may call push() and exactly one (other) thread
+/// may call pop() and waitNotEmpty(). Neither side ever takes a lock on
+/// the fast path: the mutex/condition variable pair is only touched
+/// when the consumer has gone to sleep on an empty ring, so the cost of
+/// a wakeup is one atomic load for the producer most of the time.
+template <class T>
+class SpscRing {
+public:
+  /// Capacity is rounded up to the next power of two.
+  explicit SpscRing(std::size_t minCapacity)
+      : slots(roundUpPow2(minCapacity)),
+        mask(slots.size() - 1),
+        head(0),
+        tail(0),
+        highWater(0),
+        consumerWaiting(false) {}
+
+  SpscRing(const SpscRing&) = delete;
+  SpscRing& operator=(const SpscRing&) = delete;
+
+  /// Producer side: returns false (and leaves value untouched) if the ring is full.
+  bool push(T&& value) {
+    const auto t = tail.load(std::memory_order_relaxed);
+    const auto h = head.load(std::memory_order_acquire);
+    if (t - h == slots.size()) {
+      return false;
+    }
+    slots[t & mask] = std::move(value);
+    tail.store(t + 1, std::memory_order_release);
+
+    const auto depth = t + 1 - h;
+    if (depth > highWater.load(std::memory_order_relaxed)) {
+      highWater.store(depth, std::memory_order_relaxed);
+    }
+
+    // Make the new tail visible before checking if the consumer sleeps:
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (consumerWaiting.load(std::memory_order_relaxed)) {
+      std::lock_guard<std::mutex> lock(wakeMutex);
+      wakeCondition.notify_one();
+    }
+    return true;
+  }
+
+  bool push(const T& value) {
+    T copy(value);
+    return push(std::move(copy));
+  }
+
+  /// Consumer side: returns false if the ring is empty.
+  bool pop(T& value) {
+    const auto h = head.load(std::memory_order_relaxed);
+    const auto t = tail.load(std::memory_order_acquire);
+    if (h == t) {
+      return false;
+    }
+    auto& slot = slots[h & mask];
+    value = std::move(slot);
+    slot = T(); // Do not keep a reference to consumed items.
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Consumer side: copy the next item without removing it.
+  /// @return false if the ring is empty.
+  bool peek(T& value) const {
+    const auto h = head.load(std::memory_order_relaxed);
+    const auto t = tail.load(std::memory_order_acquire);
+    if (h == t) {
+      return false;
+    }
+    value = slots[h & mask];
+    return true;
+  }
+
+  /// Consumer side: block until the ring is not empty or the timeout expires.
+  /// @return true if there is data available.
+  template <class Rep, class Period>
+  bool waitNotEmpty(const std::chrono::duration<Rep, Period>& timeout) {
+    if (!empty()) {
+      return true;
+    }
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    consumerWaiting.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool ready = wakeCondition.wait_for(lock, timeout, [this]() { return !empty(); });
+    consumerWaiting.store(false, std::memory_order_relaxed);
+    return ready;
+  }
+
+  /// Wake a consumer blocked in waitNotEmpty() (e.g. at shutdown).
+  void notify() {
+    std::lock_guard<std::mutex> lock(wakeMutex);
+    wakeCondition.notify_all();
+  }
+
+  bool empty() const { return size() == 0; }
+
+  /// Number of items currently queued (approximate while both sides are active).
+  std::size_t size() const {
+    const auto t = tail.load(std::memory_order_acquire);
+    const auto h = head.load(std::memory_order_acquire);
+    return t - h;
+  }
+
+  std::size_t capacity() const { return slots.size(); }
+
+  /// Largest queue depth that has been observed by the producer.
+  std::size_t highWaterMark() const { return highWater.load(std::memory_order_relaxed); }
+
+private:
+  static std::size_t roundUpPow2(std::size_t n) {
+    if (n == 0) {
+      throw std::invalid_argument("SpscRing capacity must be non-zero.");
+    }
+    std::size_t c = 1;
+    while (c < n) {
+      c <<= 1;
+    }
+    return c;
+  }
+
+  std::vector<T> slots;
+  const std::size_t mask;
+
+  // Keep the indices on separate cache lines so producer
+  // and consumer do not false-share:
+  alignas(64) std::atomic<std::size_t> head; // Next slot to pop (written by consumer).
+  alignas(64) std::atomic<std::size_t> tail; // Next slot to push (written by producer).
+  alignas(64) std::atomic<std::size_t> highWater;
+
+  std::atomic<bool> consumerWaiting;
+  std::mutex wakeMutex;
+  std::condition_variable wakeCondition;
+};
@@ -0,0 +1,213 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "TelemetryExporter.hpp"
+#include "ThreadSettings.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// How often new samples are appended to the CSV file:
+constexpr auto csvFlushInterval = std::chrono::seconds(5);
+// Wake up this often to check for shutdown:
+constexpr int pollTimeoutMs = 250;
+// Give up on clients that do not send their request in time:
+constexpr int requestTimeoutMs = 1000;
+
+std::string socketError(const std::string& what) {
+  return "Telemetry: " + what + ": " + std::strerror(errno);
+}
+
+// A client hanging up must not raise SIGPIPE:
+#if defined(MSG_NOSIGNAL)
+constexpr int sendFlags = MSG_NOSIGNAL;
+#else
+constexpr int sendFlags = 0;
+#endif
+
+void writeAll(int fd, const std::string& data) {
+#if defined(SO_NOSIGPIPE)
+  int noSigPipe = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+  std::size_t sent = 0;
+  while (sent < data.size()) {
+    const auto n = send(fd, data.data() + sent, data.size() - sent, sendFlags);
+    if (n <= 0) {
+      return;
+    }
+    sent += n;
+  }
+}
+
+} // end anonymous namespace
+
+TelemetryExporter::TelemetryExporter(const std::vector<Source>& telemetrySources, const TelemetryOptions& options)
+    : sources(telemetrySources),
+      csvWritten(sources.size(), 0),
+      csv(nullptr),
+      listenFd(-1),
+      stop(false) {
+  if (!options.csvFile.empty()) {
+    csv = std::fopen(options.csvFile.c_str(), "a");
+    if (csv == nullptr) {
+      throw std::runtime_error("Could not open telemetry file '" + options.csvFile + "': " + std::strerror(errno));
+    }
+    // Only a new (or empty) file needs the header:
+    std::fseek(csv, 0, SEEK_END);
+    if (std::ftell(csv) == 0) {
+      std::fprintf(csv, "session,time_us");
+      for (std::size_t c = 0; c < TelemetryHistory::channelCount; ++c) {
+        std::fprintf(csv, ",%s", TelemetryHistory::channelName(TelemetryHistory::Channel(c)));
+      }
+      std::fprintf(csv, "\n");
+    }
+    BOOST_LOG_TRIVIAL(info) << "Appending telemetry to '" << options.csvFile << "'";
+  }
+
+  if (options.metricsPort != 0) {
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<std::uint16_t>(options.metricsPort));
+    if (inet_pton(AF_INET, options.metricsAddress.c_str(), &address.sin_addr) != 1) {
+      if (csv) {
+        std::fclose(csv);
+      }
+      throw std::runtime_error("Telemetry: invalid metrics address '" + options.metricsAddress + "'");
+    }
+
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listenFd, 4) != 0) {
+      const auto error = socketError("could not listen on " + options.metricsAddress + ":" +
+                                     std::to_string(options.metricsPort));
+      if (listenFd >= 0) {
+        close(listenFd);
+      }
+      if (csv) {
+        std::fclose(csv);
+      }
+      throw std::runtime_error(error);
+    }
+    BOOST_LOG_TRIVIAL(info) << "Serving telemetry metrics on " << options.metricsAddress << ":" << options.metricsPort;
+  }
+
+  thread.reset(new std::thread(&TelemetryExporter::run, this));
+}
+
+TelemetryExporter::~TelemetryExporter() {
+  stop = true;
+  thread->join();
+  if (csv) {
+    writeCsv();
+    std::fclose(csv);
+  }
+  if (listenFd >= 0) {
+    close(listenFd);
+  }
+}
+
+void TelemetryExporter::run() {
+  setCurrentThreadName("rui-telemetry");
+  auto lastFlush = std::chrono::steady_clock::now();
+  while (!stop) {
+    if (listenFd >= 0) {
+      pollfd fd{listenFd, POLLIN, 0};
+      if (poll(&fd, 1, pollTimeoutMs) > 0 && (fd.revents & POLLIN)) {
+        const int client = accept(listenFd, nullptr, nullptr);
+        if (client >= 0) {
+          serveClient(client);
+          close(client);
+        }
+      }
+    } else {
+      std::this_thread::sleep_for(std::chrono::milliseconds(pollTimeoutMs));
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (csv && now - lastFlush >= csvFlushInterval) {
+      writeCsv();
+      lastFlush = now;
+    }
+  }
+}
+
+void TelemetryExporter::writeCsv() {
+  for (std::size_t s = 0; s < sources.size(); ++s) {
+    const auto& history = *sources[s].history;
+    const auto recorded = history.recordedCount();
+    if (recorded - csvWritten[s] > history.capacity()) {
+      BOOST_LOG_TRIVIAL(warning) << "Telemetry samples were overwritten before they were exported.";
+    }
+    // Exactly the samples up to the count read above (any recorded
+    // meanwhile are written next time):
+    for (const auto& sample : history.read(csvWritten[s], recorded)) {
+      std::fprintf(csv, "%s,%lld", sources[s].session.c_str(), static_cast<long long>(sample.timeMicros));
+      for (auto v : sample.values) {
+        std::fprintf(csv, ",%g", v);
+      }
+      std::fprintf(csv, "\n");
+    }
+    csvWritten[s] = recorded;
+  }
+  std::fflush(csv);
+}
+
+std::string TelemetryExporter::metricsText() const {
+  std::stringstream ss;
+  for (std::size_t c = 0; c < TelemetryHistory::channelCount; ++c) {
+    const auto channel = TelemetryHistory::Channel(c);
+    const std::string name = std::string("remote_ui_") + TelemetryHistory::channelName(channel);
+    ss << "# TYPE " << name << " gauge\n";
+    for (const auto& source : sources) {
+      const auto latest = source.history->recent(1);
+      if (latest.empty()) {
+        continue;
+      }
+      // Timestamps are in milliseconds:
+      ss << name << "{session=\"" << source.session << "\"} " << latest.back()[channel]
+         << ' ' << latest.back().timeMicros / 1000 << '\n';
+    }
+  }
+  return ss.str();
+}
+
+void TelemetryExporter::serveClient(int fd) {
+  // Every request gets the metrics so just wait for the end of the headers:
+  std::string request;
+  char buffer[1024];
+  pollfd pfd{fd, POLLIN, 0};
+  while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+    if (poll(&pfd, 1, requestTimeoutMs) <= 0) {
+      return;
+    }
+    const auto n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) {
+      return;
+    }
+    request.append(buffer, n);
+  }
+
+  const auto body = metricsText();
+  std::stringstream response;
+  response << "HTTP/1.1 200 OK\r\n"
+           << "Content-Type: text/plain; version=0.0.4\r\n"
+           << "Content-Length: " << body.size() << "\r\n"
+           << "Connection: close\r\n\r\n"
+           << body;
+  writeAll(fd, response.str());
+}
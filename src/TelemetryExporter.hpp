@@ -0,0 +1,64 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TelemetryHistory.hpp"
+
+/// Options for recording and exporting telemetry (see TelemetryHistory).
+struct TelemetryOptions {
+  /// Time between samples.
+  std::chrono::milliseconds interval = std::chrono::milliseconds(1000);
+  /// Samples kept per session (the oldest are overwritten).
+  std::size_t historySize = 16384;
+  /// Samples shown in the telemetry graphs.
+  std::size_t graphSamples = 600;
+  /// If not empty append every sample to this CSV file.
+  std::string csvFile;
+  /// If non-zero serve the latest values as Prometheus text format
+  /// metrics on this port (at any path, e.g. /metrics).
+  int metricsPort = 0;
+  /// Local IPv4 address the metrics are served on. Only on loopback by
+  /// default: use e.g. "0.0.0.0" to allow scraping from other hosts.
+  std::string metricsAddress = "127.0.0.1";
+};
+
+/// Exports the telemetry of one or more sessions on a background thread:
+/// new samples are appended to a CSV file every few seconds and a minimal
+/// HTTP server answers each request with the latest sample of every
+/// session in the Prometheus text exposition format.
+class TelemetryExporter {
+public:
+  struct Source {
+    std::string session; // Label identifying the session.
+    const TelemetryHistory* history;
+  };
+
+  /// The histories must outlive the exporter. Throws a std::runtime_error
+  /// if the CSV file can not be opened or the port can not be bound.
+  TelemetryExporter(const std::vector<Source>& sources, const TelemetryOptions& options);
+  virtual ~TelemetryExporter();
+
+  /// The metrics text that is served.
+  std::string metricsText() const;
+
+private:
+  void run();
+  void writeCsv();
+  void serveClient(int fd);
+
+  const std::vector<Source> sources;
+  std::vector<std::uint64_t> csvWritten; // Samples written per source.
+  std::FILE* csv;
+  int listenFd;
+  std::atomic<bool> stop;
+  std::unique_ptr<std::thread> thread;
+};
@@ -0,0 +1,99 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "TelemetryHistory.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+std::size_t roundUpPow2(std::size_t n) {
+  if (n == 0) {
+    throw std::invalid_argument("TelemetryHistory capacity must be non-zero.");
+  }
+  std::size_t c = 1;
+  while (c < n) {
+    c <<= 1;
+  }
+  return c;
+}
+
+} // end anonymous namespace
+
+const char* TelemetryHistory::channelName(Channel c) {
+  switch (c) {
+    case Channel::PathRate: return "path_rate";
+    case Channel::RayRate: return "ray_rate";
+    case Channel::VideoRate: return "video_rate_mbps";
+    case Channel::FrameRate: return "frame_rate";
+    case Channel::QueueDepth: return "decode_queue_depth";
+    case Channel::Progress: return "progress";
+    default: return "unknown";
+  }
+}
+
+TelemetryHistory::TelemetryHistory(std::size_t minCapacity)
+    : slots(new Slot[roundUpPow2(minCapacity)]),
+      mask(roundUpPow2(minCapacity) - 1),
+      writes(0) {
+  for (std::size_t i = 0; i <= mask; ++i) {
+    slots[i].sequence.store(0, std::memory_order_relaxed);
+    slots[i].timeMicros.store(0, std::memory_order_relaxed);
+    for (auto& v : slots[i].values) {
+      v.store(0.f, std::memory_order_relaxed);
+    }
+  }
+}
+
+void TelemetryHistory::record(const Sample& sample) {
+  const auto index = writes.load(std::memory_order_relaxed);
+  auto& slot = slots[index & mask];
+  const auto sequence = slot.sequence.load(std::memory_order_relaxed);
+  slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot.timeMicros.store(sample.timeMicros, std::memory_order_relaxed);
+  for (std::size_t c = 0; c < channelCount; ++c) {
+    slot.values[c].store(sample.values[c], std::memory_order_relaxed);
+  }
+  slot.sequence.store(sequence + 2, std::memory_order_release);
+  writes.store(index + 1, std::memory_order_release);
+}
+
+bool TelemetryHistory::read(std::uint64_t index, Sample& sample) const {
+  const auto& slot = slots[index & mask];
+  // Sequence the slot has once sample 'index' (and no later one) is written:
+  const std::uint64_t expected = 2 * (index / capacity() + 1);
+  if (slot.sequence.load(std::memory_order_acquire) != expected) {
+    return false;
+  }
+  sample.timeMicros = slot.timeMicros.load(std::memory_order_relaxed);
+  for (std::size_t c = 0; c < channelCount; ++c) {
+    sample.values[c] = slot.values[c].load(std::memory_order_relaxed);
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return slot.sequence.load(std::memory_order_relaxed) == expected;
+}
+
+std::vector<TelemetryHistory::Sample> TelemetryHistory::recent(std::size_t maxSamples) const {
+  const auto end = recordedCount();
+  return read(end - std::min<std::uint64_t>(maxSamples, end), end);
+}
+
+std::vector<TelemetryHistory::Sample> TelemetryHistory::read(std::uint64_t first, std::uint64_t end) const {
+  end = std::min(end, recordedCount());
+  if (end > capacity()) {
+    first = std::max(first, end - capacity());
+  }
+  std::vector<Sample> samples;
+  if (first >= end) {
+    return samples;
+  }
+  samples.reserve(end - first);
+  Sample s;
+  for (auto i = first; i < end; ++i) {
+    if (read(i, s)) {
+      samples.push_back(s);
+    }
+  }
+  return samples;
+}
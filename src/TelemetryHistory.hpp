@@ -0,0 +1,84 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+/// Fixed-size history of server and stream telemetry sampled at a regular
+/// interval so that throughput changes can be correlated with client-side
+/// stalls over a long render.
+///
+/// Samples are kept in a ring that overwrites the oldest once full. One
+/// thread records and any number of threads (e.g. graphs on the UI thread
+/// and an exporter thread) can read concurrently without locks: each slot
+/// is guarded by a sequence number (a seqlock) so a reader simply skips a
+/// slot that was overwritten while it was being copied.
+class TelemetryHistory {
+public:
+  enum class Channel {
+    PathRate,   // Paths traced per second (reported by the server).
+    RayRate,    // Rays cast per second (reported by the server).
+    VideoRate,  // Preview video bit-rate (Mbps).
+    FrameRate,  // Preview frames decoded per second.
+    QueueDepth, // Video packets waiting to be decoded.
+    Progress,   // Render progress (0 to 1).
+    Count
+  };
+  static constexpr std::size_t channelCount = std::size_t(Channel::Count);
+
+  struct Sample {
+    std::int64_t timeMicros = 0; // System clock time since epoch.
+    std::array<float, channelCount> values{};
+
+    float& operator[](Channel c) { return values[std::size_t(c)]; }
+    float operator[](Channel c) const { return values[std::size_t(c)]; }
+  };
+
+  /// Name of a channel for export (e.g. "path_rate").
+  static const char* channelName(Channel c);
+
+  /// Capacity is rounded up to the next power of two.
+  explicit TelemetryHistory(std::size_t minCapacity);
+  virtual ~TelemetryHistory() {}
+
+  TelemetryHistory(const TelemetryHistory&) = delete;
+  TelemetryHistory& operator=(const TelemetryHistory&) = delete;
+
+  /// Add a sample (overwriting the oldest if full). Only one
+  /// thread may record.
+  void record(const Sample& sample);
+
+  /// Copy up to maxSamples of the newest samples, oldest first.
+  /// Safe to call from any thread.
+  std::vector<Sample> recent(std::size_t maxSamples) const;
+
+  /// Copy samples number first to end - 1 (as counted by recordedCount()),
+  /// oldest first. Those that are not recorded yet or have already been
+  /// overwritten are skipped. Safe to call from any thread.
+  std::vector<Sample> read(std::uint64_t first, std::uint64_t end) const;
+
+  /// Total number of samples ever recorded (so readers can tell which
+  /// samples are new since they last looked).
+  std::uint64_t recordedCount() const { return writes.load(std::memory_order_acquire); }
+
+  std::size_t capacity() const { return mask + 1; }
+
+private:
+  struct Slot {
+    std::atomic<std::uint64_t> sequence; // Twice the number of writes (odd while writing).
+    std::atomic<std::int64_t> timeMicros;
+    std::array<std::atomic<float>, channelCount> values;
+  };
+
+  /// Copy sample number index. Returns false if it has been overwritten.
+  bool read(std::uint64_t index, Sample& sample) const;
+
+  std::unique_ptr<Slot[]> slots;
+  const std::size_t mask;
+  std::atomic<std::uint64_t> writes;
+};
@@ -0,0 +1,95 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "TelemetryWindow.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+struct ChannelDisplay {
+  const char* title;
+  const char* units;
+  float scale; // Applied to the recorded value for display.
+};
+
+ChannelDisplay channelDisplay(TelemetryHistory::Channel c) {
+  using Channel = TelemetryHistory::Channel;
+  switch (c) {
+    case Channel::PathRate: return {"Path-trace rate", "Mpaths/s", 1e-6f};
+    case Channel::RayRate: return {"Ray-cast rate", "Grays/s", 1e-9f};
+    case Channel::VideoRate: return {"Video rate", "Mbps", 1.f};
+    case Channel::FrameRate: return {"Frame rate", "fps", 1.f};
+    case Channel::QueueDepth: return {"Decode queue", "packets", 1.f};
+    case Channel::Progress: return {"Progress", "%", 100.f};
+    default: return {"", "", 1.f};
+  }
+}
+
+std::string formatDuration(std::chrono::milliseconds d) {
+  const auto seconds = d.count() / 1000;
+  char text[32];
+  if (seconds >= 3600) {
+    std::snprintf(text, sizeof(text), "%.1f hours", seconds / 3600.0);
+  } else if (seconds >= 60) {
+    std::snprintf(text, sizeof(text), "%.0f minutes", seconds / 60.0);
+  } else {
+    std::snprintf(text, sizeof(text), "%lld seconds", static_cast<long long>(seconds));
+  }
+  return text;
+}
+
+} // end anonymous namespace
+
+TelemetryWindow::TelemetryWindow(nanogui::Widget* parent, const TelemetryHistory& telemetry,
+                                 std::size_t samples, std::chrono::milliseconds interval)
+    : nanogui::Window(parent, "Telemetry"),
+      history(telemetry),
+      graphSamples(samples),
+      shownCount(0) {
+  using namespace nanogui;
+  set_layout(new GroupLayout(10, 2, 8));
+
+  new Label(this, "Last " + formatDuration(interval * graphSamples), "sans-bold");
+  for (std::size_t c = 0; c < TelemetryHistory::channelCount; ++c) {
+    labels.push_back(new Label(this, std::string(channelDisplay(TelemetryHistory::Channel(c)).title) + ": -"));
+    auto* graph = new Graph(this, "");
+    graph->set_fixed_size(Vector2i(320, 36));
+    graphs.push_back(graph);
+  }
+}
+
+void TelemetryWindow::update() {
+  if (!visible() || history.recordedCount() == shownCount) {
+    return;
+  }
+  shownCount = history.recordedCount();
+
+  const auto samples = history.recent(graphSamples);
+  if (samples.empty()) {
+    return;
+  }
+
+  std::vector<float> values(samples.size());
+  for (std::size_t c = 0; c < TelemetryHistory::channelCount; ++c) {
+    const auto channel = TelemetryHistory::Channel(c);
+    const auto display = channelDisplay(channel);
+    float peak = 0.f;
+    for (std::size_t i = 0; i < samples.size(); ++i) {
+      values[i] = std::max(samples[i][channel], 0.f) * display.scale;
+      peak = std::max(peak, values[i]);
+    }
+
+    // Scale so the peak fills the graph (progress always spans 0 to 100%):
+    const float top = channel == TelemetryHistory::Channel::Progress ? 100.f : std::max(peak, 1e-6f);
+    for (auto& v : values) {
+      v /= top;
+    }
+    graphs[c]->set_values(values);
+
+    char text[96];
+    std::snprintf(text, sizeof(text), "%s: %.1f %s (peak %.1f)", display.title,
+                  samples.back()[channel] * display.scale, display.units, peak);
+    labels[c]->set_caption(text);
+  }
+}
@@ -0,0 +1,31 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <nanogui/nanogui.h>
+
+#include <chrono>
+#include <vector>
+
+#include "TelemetryHistory.hpp"
+
+/// Window with a graph of the recent history of each telemetry channel
+/// (see TelemetryHistory) and its current and peak values, so that a drop
+/// in server throughput can be lined up with the video stream stalling.
+class TelemetryWindow : public nanogui::Window {
+public:
+  /// Graphs show the last graphSamples samples taken every interval.
+  TelemetryWindow(nanogui::Widget* parent, const TelemetryHistory& history,
+                  std::size_t graphSamples, std::chrono::milliseconds interval);
+
+  /// Refresh the graphs (only if visible and a new sample was recorded).
+  /// Call once per UI frame.
+  void update();
+
+private:
+  const TelemetryHistory& history;
+  const std::size_t graphSamples;
+  std::vector<nanogui::Label*> labels;
+  std::vector<nanogui::Graph*> graphs;
+  std::uint64_t shownCount;
+};
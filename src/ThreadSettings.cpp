@@ -0,0 +1,238 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "ThreadSettings.hpp"
+
+#include <boost/log/trivial.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <pthread/qos.h>
+#endif
+
+namespace {
+
+// Size of a Linux cpu_set_t:
+constexpr int maxCpus = 1024;
+
+#if defined(__linux__)
+// High priority is a nice value (which needs CAP_SYS_NICE or a suitable
+// RLIMIT_NICE) and real-time a low SCHED_FIFO priority so that kernel
+// threads still pre-empt us:
+constexpr int highNice = -10;
+constexpr int realtimePriority = 10;
+
+// The affinity and nice value the process was started with (e.g. by
+// taskset or nice). Captured during static initialisation, before any
+// thread can have been changed:
+struct ProcessDefaults {
+  ProcessDefaults() {
+    haveAffinity = sched_getaffinity(0, sizeof(affinity), &affinity) == 0;
+    errno = 0;
+    nice = getpriority(PRIO_PROCESS, 0);
+    if (errno != 0) {
+      nice = 0;
+    }
+  }
+  bool haveAffinity;
+  cpu_set_t affinity;
+  int nice;
+};
+const ProcessDefaults processDefaults;
+
+pid_t currentThreadId() {
+  return pid_t(syscall(SYS_gettid));
+}
+
+void setNice(int nice) {
+  if (setpriority(PRIO_PROCESS, currentThreadId(), nice) != 0) {
+    BOOST_LOG_TRIVIAL(warning) << "Could not set thread nice value to " << nice << ": " << std::strerror(errno);
+  }
+}
+#endif
+
+void setAffinity(const std::vector<int>& cpus) {
+#if defined(__linux__)
+  cpu_set_t set;
+  if (cpus.empty()) {
+    if (!processDefaults.haveAffinity) {
+      return;
+    }
+    set = processDefaults.affinity;
+  } else {
+    CPU_ZERO(&set);
+    for (auto c : cpus) {
+      CPU_SET(c, &set);
+    }
+  }
+  const int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (error != 0) {
+    BOOST_LOG_TRIVIAL(warning) << "Could not set thread CPU affinity: " << std::strerror(error);
+  }
+#else
+  if (!cpus.empty()) {
+    BOOST_LOG_TRIVIAL(warning) << "Pinning threads to CPUs is not supported on this platform.";
+  }
+#endif
+}
+
+void setPriority(ThreadPriority priority) {
+#if defined(__linux__)
+  sched_param param;
+  if (priority == ThreadPriority::Realtime) {
+    param.sched_priority = realtimePriority;
+    const int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error == 0) {
+      return;
+    }
+    BOOST_LOG_TRIVIAL(warning) << "Could not use real-time scheduling (" << std::strerror(error)
+                               << "): using high priority instead.";
+  }
+  // Otherwise use the normal scheduler even if the creating thread did not:
+  param.sched_priority = 0;
+  const int error = pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+  if (error != 0) {
+    BOOST_LOG_TRIVIAL(warning) << "Could not reset thread scheduling policy: " << std::strerror(error);
+  }
+  setNice(priority == ThreadPriority::Normal ? processDefaults.nice : highNice);
+#elif defined(__APPLE__)
+  // The closest equivalent of high and real-time is the highest quality
+  // of service class:
+  const auto qos = priority == ThreadPriority::Normal ? qos_class_main() : QOS_CLASS_USER_INTERACTIVE;
+  const int error = pthread_set_qos_class_self_np(qos, 0);
+  if (error != 0) {
+    BOOST_LOG_TRIVIAL(warning) << "Could not set thread priority: " << std::strerror(error);
+  }
+#else
+  if (priority != ThreadPriority::Normal) {
+    BOOST_LOG_TRIVIAL(warning) << "Setting thread priority is not supported on this platform.";
+  }
+#endif
+}
+
+} // end anonymous namespace
+
+std::vector<int> parseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (item.empty()) {
+      continue;
+    }
+    try {
+      std::size_t end = 0;
+      const int first = std::stoi(item, &end);
+      int last = first;
+      if (end < item.size()) {
+        if (item[end] != '-') {
+          throw std::invalid_argument(item);
+        }
+        std::size_t lastEnd = 0;
+        last = std::stoi(item.substr(end + 1), &lastEnd);
+        if (end + 1 + lastEnd != item.size()) {
+          throw std::invalid_argument(item);
+        }
+      }
+      if (first < 0 || last < first || last >= maxCpus) {
+        throw std::invalid_argument(item);
+      }
+      for (int c = first; c <= last; ++c) {
+        cpus.push_back(c);
+      }
+    } catch (const std::logic_error&) {
+      throw std::runtime_error("Invalid CPU list '" + list + "' (expected e.g. '0,2-3')");
+    }
+  }
+  return cpus;
+}
+
+ThreadPriority parseThreadPriority(const std::string& priority) {
+  if (priority == "normal") {
+    return ThreadPriority::Normal;
+  }
+  if (priority == "high") {
+    return ThreadPriority::High;
+  }
+  if (priority == "realtime") {
+    return ThreadPriority::Realtime;
+  }
+  throw std::runtime_error("Invalid thread priority '" + priority + "' (expected 'normal', 'high' or 'realtime')");
+}
+
+void setCurrentThreadName(const std::string& name) {
+  if (name.empty()) {
+    return;
+  }
+  // Linux limits names to 15 characters (plus the terminator):
+  const std::string truncated = name.substr(0, 15);
+#if defined(__APPLE__)
+  pthread_setname_np(truncated.c_str());
+#else
+  pthread_setname_np(pthread_self(), truncated.c_str());
+#endif
+}
+
+void applyToCurrentThread(const ThreadSettings& settings) {
+  setCurrentThreadName(settings.name);
+  setAffinity(settings.cpus);
+  setPriority(settings.priority);
+}
+
+struct ScopedThreadSettings::Saved {
+  char name[64];
+#if defined(__linux__)
+  bool haveAffinity;
+  cpu_set_t affinity;
+  int policy;
+  sched_param param;
+  int nice;
+#elif defined(__APPLE__)
+  qos_class_t qos;
+#endif
+};
+
+ScopedThreadSettings::ScopedThreadSettings(const ThreadSettings& settings)
+    : saved(new Saved()) {
+  if (pthread_getname_np(pthread_self(), saved->name, sizeof(saved->name)) != 0) {
+    saved->name[0] = '\0';
+  }
+#if defined(__linux__)
+  saved->haveAffinity = pthread_getaffinity_np(pthread_self(), sizeof(saved->affinity), &saved->affinity) == 0;
+  if (pthread_getschedparam(pthread_self(), &saved->policy, &saved->param) != 0) {
+    saved->policy = SCHED_OTHER;
+    saved->param.sched_priority = 0;
+  }
+  errno = 0;
+  saved->nice = getpriority(PRIO_PROCESS, currentThreadId());
+  if (errno != 0) {
+    saved->nice = 0;
+  }
+#elif defined(__APPLE__)
+  saved->qos = qos_class_self();
+#endif
+  applyToCurrentThread(settings);
+}
+
+ScopedThreadSettings::~ScopedThreadSettings() {
+  setCurrentThreadName(saved->name);
+#if defined(__linux__)
+  if (saved->haveAffinity) {
+    pthread_setaffinity_np(pthread_self(), sizeof(saved->affinity), &saved->affinity);
+  }
+  pthread_setschedparam(pthread_self(), saved->policy, &saved->param);
+  setpriority(PRIO_PROCESS, currentThreadId(), saved->nice);
+#elif defined(__APPLE__)
+  pthread_set_qos_class_self_np(saved->qos, 0);
+#endif
+}
@@ -0,0 +1,61 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class ThreadPriority {
+  Normal,  ///< The process default (e.g. SCHED_OTHER at its initial nice value on Linux).
+  High,    ///< Raise the priority within the normal scheduler.
+  Realtime ///< Real-time (FIFO) scheduling where permitted, else High.
+};
+
+/// Name, CPU affinity and priority for one of the client's threads so
+/// that latency critical threads (UI, decode and packet receive) can be
+/// kept apart from each other and from other work on a busy machine.
+struct ThreadSettings {
+  /// Shown in debuggers and profilers (truncated to 15 characters).
+  /// Empty leaves the name unchanged.
+  std::string name;
+  /// Cores the thread may run on (empty for any the process may use).
+  std::vector<int> cpus;
+  ThreadPriority priority = ThreadPriority::Normal;
+};
+
+/// Parse a list of cores such as "0,2-3" (empty for any core). Throws
+/// a std::runtime_error if the list is invalid.
+std::vector<int> parseCpuList(const std::string& list);
+
+/// Parse "normal", "high" or "realtime". Throws a std::runtime_error
+/// for anything else.
+ThreadPriority parseThreadPriority(const std::string& priority);
+
+/// Name the calling thread.
+void setCurrentThreadName(const std::string& name);
+
+/// Apply settings to the calling thread. An empty CPU list or Normal
+/// priority resets the thread to the process defaults rather than
+/// keeping whatever it inherited from the thread that created it.
+/// Anything the OS does not support or permit is logged and skipped
+/// (so this never throws).
+void applyToCurrentThread(const ThreadSettings& settings);
+
+/// Applies settings to the calling thread for the lifetime of the object
+/// and then restores the previous ones. Threads created meanwhile inherit
+/// the settings, which is how threads owned by libraries (e.g. the
+/// packetcomms receive threads) are configured. Naming this way only
+/// works on Linux: elsewhere library threads keep their own names.
+class ScopedThreadSettings {
+public:
+  ScopedThreadSettings(const ThreadSettings& settings);
+  virtual ~ScopedThreadSettings();
+
+  ScopedThreadSettings(const ScopedThreadSettings&) = delete;
+  ScopedThreadSettings& operator=(const ScopedThreadSettings&) = delete;
+
+private:
+  struct Saved;
+  std::unique_ptr<Saved> saved;
+};
@@ -0,0 +1,68 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/// Lock-free triple buffer for handing data from one producer thread
+/// to one consumer thread.
+///
+/// The producer always owns a "write" buffer and the consumer always
+/// owns a "read" buffer. The third buffer is the most recently published
+/// one. Publishing and consuming are single atomic exchanges, so neither
+/// side ever waits for the other and the consumer always gets the newest
+/// complete buffer (intermediate ones are silently overwritten).
+template <class T>
+class TripleBuffer {
+public:
+  TripleBuffer() : writeIndex(0), readyState(1), readIndex(2) {}
+
+  TripleBuffer(const TripleBuffer&) = delete;
+  TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+  /// Producer: buffer that can be freely written before calling publish().
+  T& writeBuffer() { return buffers[writeIndex]; }
+
+  /// Producer: make the write buffer available to the consumer and
+  /// take ownership of a different buffer for the next write.
+  void publish() {
+    const auto previous = readyState.exchange(writeIndex | newDataFlag, std::memory_order_acq_rel);
+    writeIndex = previous & indexMask;
+  }
+
+  /// Consumer: if a buffer has been published since the last call then
+  /// swap it in as the read buffer.
+  /// @return true if the read buffer now contains new data.
+  bool consume() {
+    if ((readyState.load(std::memory_order_relaxed) & newDataFlag) == 0) {
+      return false;
+    }
+    const auto previous = readyState.exchange(readIndex, std::memory_order_acq_rel);
+    readIndex = previous & indexMask;
+    return true;
+  }
+
+  /// Consumer: the most recently consumed buffer.
+  T& readBuffer() { return buffers[readIndex]; }
+  const T& readBuffer() const { return buffers[readIndex]; }
+
+  /// Apply a function to all three buffers. Only safe to call when
+  /// neither the producer nor the consumer are active (e.g. to allocate).
+  template <class F>
+  void forEach(F&& f) {
+    for (auto& b : buffers) {
+      f(b);
+    }
+  }
+
+private:
+  static constexpr std::uint8_t indexMask = 0x3;
+  static constexpr std::uint8_t newDataFlag = 0x4;
+
+  std::array<T, 3> buffers;
+  std::uint8_t writeIndex;              // Only accessed by producer.
+  std::atomic<std::uint8_t> readyState; // Shared: index of ready buffer plus new-data flag.
+  std::uint8_t readIndex;               // Only accessed by consumer.
+};
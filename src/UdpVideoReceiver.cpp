@@ -0,0 +1,292 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "UdpVideoReceiver.hpp"
+
+#include <PacketSerialisation.h>
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// Large enough for any datagram:
+constexpr std::size_t maxDatagramSize = 65536;
+// Ask the kernel for enough buffering to absorb a burst of key-frame datagrams:
+constexpr int socketReceiveBufferSize = 4 * 1024 * 1024;
+// Wake up this often (even when nothing arrives) to check for timed out packets:
+constexpr int pollTimeoutMs = 20;
+// Packets further ahead than this mean the stream restarted (or we fell far behind):
+constexpr std::uint32_t maxPacketsInFlight = 512;
+// Largest gap in the datagram sequence that is NACKed (beyond this resending would not help):
+constexpr std::uint32_t maxNackCount = 256;
+// Do not ask for key-frames more often than this:
+constexpr auto keyFrameRequestInterval = std::chrono::milliseconds(500);
+
+// Signed distance between two wrapping counters:
+std::int32_t distance(std::uint32_t from, std::uint32_t to) {
+  return static_cast<std::int32_t>(to - from);
+}
+
+std::string socketError(const std::string& what) {
+  return "UDP video: " + what + ": " + std::strerror(errno);
+}
+
+/// All the IPv4 addresses of host (network byte order).
+std::vector<std::uint32_t> resolveHost(const std::string& host) {
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  addrinfo* results = nullptr;
+  const int error = getaddrinfo(host.c_str(), nullptr, &hints, &results);
+  if (error != 0) {
+    throw std::runtime_error("UDP video: could not resolve server '" + host + "': " + gai_strerror(error));
+  }
+  std::vector<std::uint32_t> addresses;
+  for (auto* r = results; r != nullptr; r = r->ai_next) {
+    addresses.push_back(reinterpret_cast<const sockaddr_in*>(r->ai_addr)->sin_addr.s_addr);
+  }
+  freeaddrinfo(results);
+  return addresses;
+}
+
+} // end anonymous namespace
+
+UdpVideoReceiver::UdpVideoReceiver(PacketMuxer& tx, const UdpVideoOptions& options, PacketCallback deliver)
+    : sender(tx),
+      opts(options),
+      onPacket(deliver),
+      socketFd(-1),
+      boundPort(0),
+      packetType(0),
+      started(false),
+      nextPacketId(0),
+      nextSequence(0),
+      waitingForKeyFrame(true),
+      lostPackets(0),
+      run(true) {
+  // Delivered packets look exactly like those from the demuxer:
+  const auto& types = packets::packetTypes;
+  packetType = std::find(types.begin(), types.end(), "render_preview") - types.begin();
+
+  // Anyone who can reach the port could otherwise inject video (and
+  // trigger NACKs and key-frame requests):
+  if (!opts.serverHost.empty()) {
+    serverAddresses = resolveHost(opts.serverHost);
+  }
+
+  socketFd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (socketFd < 0) {
+    throw std::runtime_error(socketError("could not create socket"));
+  }
+
+  int bufferSize = socketReceiveBufferSize;
+  if (setsockopt(socketFd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize)) != 0) {
+    BOOST_LOG_TRIVIAL(warning) << socketError("could not set receive buffer size");
+  }
+
+  sockaddr_in address;
+  std::memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(static_cast<std::uint16_t>(opts.port));
+  socklen_t addressSize = sizeof(address);
+  if (bind(socketFd, reinterpret_cast<sockaddr*>(&address), addressSize) != 0 ||
+      getsockname(socketFd, reinterpret_cast<sockaddr*>(&address), &addressSize) != 0) {
+    const auto error = socketError("could not bind port " + std::to_string(opts.port));
+    close(socketFd);
+    throw std::runtime_error(error);
+  }
+  boundPort = ntohs(address.sin_port);
+  BOOST_LOG_TRIVIAL(info) << "Receiving preview video over UDP on port " << boundPort;
+
+  receiveThread.reset(new std::thread(&UdpVideoReceiver::receiveLoop, this));
+  serialise(sender, "video_udp_setup", packets::VideoUdpSetup{static_cast<std::uint16_t>(boundPort)});
+}
+
+UdpVideoReceiver::~UdpVideoReceiver() {
+  run = false;
+  if (receiveThread) {
+    receiveThread->join();
+  }
+  close(socketFd);
+  BOOST_LOG_TRIVIAL(debug) << "UDP video receiver stopped. Lost packets: " << lostPackets;
+}
+
+void UdpVideoReceiver::receiveLoop() {
+  applyToCurrentThread(opts.receiveThread);
+  std::vector<std::uint8_t> buffer(maxDatagramSize);
+  pollfd fd{socketFd, POLLIN, 0};
+  while (run) {
+    const int ready = poll(&fd, 1, pollTimeoutMs);
+    if (ready < 0 && errno != EINTR) {
+      BOOST_LOG_TRIVIAL(error) << socketError("poll failed");
+      return;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    if (ready > 0) {
+      // Drain everything that is waiting before trying to deliver:
+      while (true) {
+        sockaddr_in source;
+        socklen_t sourceSize = sizeof(source);
+        const auto size = recvfrom(socketFd, buffer.data(), buffer.size(), MSG_DONTWAIT,
+                                   reinterpret_cast<sockaddr*>(&source), &sourceSize);
+        if (size < 0) {
+          break;
+        }
+        if (!serverAddresses.empty() &&
+            std::find(serverAddresses.begin(), serverAddresses.end(), source.sin_addr.s_addr) == serverAddresses.end()) {
+          BOOST_LOG_TRIVIAL(debug) << "Ignoring video datagram from " << inet_ntoa(source.sin_addr);
+          continue;
+        }
+        receiveDatagram(buffer.data(), size, now);
+      }
+    }
+    deliverReady(now);
+  }
+}
+
+void UdpVideoReceiver::receiveDatagram(const std::uint8_t* datagram, std::size_t size,
+                                       std::chrono::steady_clock::time_point now) {
+  packets::VideoDatagramHeader header;
+  const auto* data = packets::parseVideoDatagram(datagram, size, header);
+  if (data == nullptr) {
+    BOOST_LOG_TRIVIAL(debug) << "Ignoring invalid video datagram of " << size << " bytes.";
+    return;
+  }
+
+  if (!started) {
+    started = true;
+    nextPacketId = header.packetId;
+    nextSequence = header.sequence;
+  }
+  detectLoss(header.sequence);
+
+  const auto ahead = distance(nextPacketId, header.packetId);
+  if (ahead < 0) {
+    // A late (or duplicate) fragment of a packet that was already delivered or abandoned.
+    return;
+  }
+  if (std::uint32_t(ahead) >= maxPacketsInFlight) {
+    BOOST_LOG_TRIVIAL(warning) << "Video datagrams jumped ahead by " << ahead << " packets: resynchronising.";
+    lostPackets += partial.size();
+    partial.clear();
+    nextPacketId = header.packetId;
+    waitingForKeyFrame = true;
+  }
+
+  auto& packet = partial[header.packetId];
+  if (packet.fragments.empty()) {
+    packet.fragments.resize(header.fragmentCount);
+    packet.haveFragment.resize(header.fragmentCount, false);
+    packet.flags = header.flags;
+    packet.firstSeen = now;
+  } else if (packet.fragments.size() != header.fragmentCount) {
+    BOOST_LOG_TRIVIAL(debug) << "Ignoring video datagram with inconsistent fragment count.";
+    return;
+  }
+
+  if (!packet.haveFragment[header.fragment]) {
+    packet.fragments[header.fragment].assign(data, datagram + size);
+    packet.haveFragment[header.fragment] = true;
+    packet.received += 1;
+  }
+}
+
+void UdpVideoReceiver::detectLoss(std::uint32_t sequence) {
+  const auto gap = distance(nextSequence, sequence);
+  if (gap < 0) {
+    // A reordered or resent datagram:
+    return;
+  }
+
+  if (gap > 0 && std::uint32_t(gap) <= maxNackCount) {
+    packets::VideoNack nack;
+    for (auto s = nextSequence; s != sequence; ++s) {
+      nack.sequences.push_back(s);
+    }
+    BOOST_LOG_TRIVIAL(debug) << "Requesting " << gap << " lost video datagrams from " << nextSequence;
+    serialise(sender, "video_nack", nack);
+  }
+  nextSequence = sequence + 1;
+}
+
+void UdpVideoReceiver::deliverReady(std::chrono::steady_clock::time_point now) {
+  while (!partial.empty()) {
+    auto itr = partial.begin();
+    auto& packet = itr->second;
+    const bool timedOut = now - packet.firstSeen >= opts.lossTimeout;
+
+    if (itr->first != nextPacketId) {
+      // Nothing at all of the next packet has arrived. Once a later one has
+      // been waiting for longer than the timeout assume it is lost:
+      if (!timedOut) {
+        return;
+      }
+      abandon(distance(nextPacketId, itr->first), now);
+      continue;
+    }
+
+    if (!packet.complete()) {
+      if (!timedOut) {
+        return;
+      }
+      partial.erase(itr);
+      abandon(1, now);
+      continue;
+    }
+
+    if (waitingForKeyFrame && !(packet.flags & packets::VideoDatagramHeader::KeyFrame)) {
+      // Without the packets that were lost this can not be decoded correctly:
+      requestKeyFrame(now);
+    } else {
+      waitingForKeyFrame = false;
+      deliver(packet);
+    }
+    partial.erase(itr);
+    nextPacketId += 1;
+  }
+}
+
+void UdpVideoReceiver::deliver(PartialPacket& packet) {
+  std::size_t size = 0;
+  for (const auto& f : packet.fragments) {
+    size += f.size();
+  }
+  std::vector<std::uint8_t> data;
+  data.reserve(size);
+  for (const auto& f : packet.fragments) {
+    data.insert(data.end(), f.begin(), f.end());
+  }
+  onPacket(std::make_shared<ComPacket>(packetType, std::move(data)));
+}
+
+void UdpVideoReceiver::abandon(std::uint32_t count, std::chrono::steady_clock::time_point now) {
+  BOOST_LOG_TRIVIAL(debug) << "Abandoning " << count << " incomplete video packets from " << nextPacketId;
+  lostPackets += count;
+  nextPacketId += count;
+  waitingForKeyFrame = true;
+  requestKeyFrame(now);
+}
+
+void UdpVideoReceiver::requestKeyFrame(std::chrono::steady_clock::time_point now) {
+  if (now - lastKeyFrameRequest < keyFrameRequestInterval) {
+    return;
+  }
+  lastKeyFrameRequest = now;
+  BOOST_LOG_TRIVIAL(debug) << "Requesting a video key-frame.";
+  serialise(sender, "video_keyframe_request", true);
+}
@@ -0,0 +1,104 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <PacketComms.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "PacketDescriptions.hpp"
+#include "ThreadSettings.hpp"
+
+/// Options for receiving the preview stream over UDP.
+struct UdpVideoOptions {
+  bool enabled = false;
+  /// Local port to receive on (zero picks any free port).
+  int port = 0;
+  /// Only accept datagrams sent from (any address of) this host, i.e.
+  /// the render server. Empty accepts datagrams from anywhere.
+  std::string serverHost;
+  /// How long to wait for a lost packet to be resent before giving
+  /// up on it and skipping to the next key-frame instead.
+  std::chrono::milliseconds lossTimeout = std::chrono::milliseconds(150);
+  /// Applied to the receive thread.
+  ThreadSettings receiveThread{"rui-udp-rx"};
+};
+
+/// Receives render_preview packets as UDP datagrams (see
+/// packets::VideoDatagramHeader) so that a lost datagram only affects
+/// the frames that depend on it. Over TCP a single loss stalls every
+/// following frame until it has been retransmitted.
+///
+/// The stream is partially reliable: gaps in the datagram sequence are
+/// reported straight away with a video_nack so the server can resend
+/// them. If a packet is still incomplete after the loss timeout it is
+/// abandoned, a key-frame is requested and packets are discarded until
+/// one arrives. Complete packets are delivered in order, on the receive
+/// thread, to the callback given to the constructor.
+///
+/// NACKs and key-frame requests are sent from the receive thread
+/// through the muxer given to the constructor.
+class UdpVideoReceiver {
+public:
+  using PacketCallback = std::function<void(const ComPacket::ConstSharedPacket&)>;
+
+  /// Bind the socket, start receiving and ask the server (with a
+  /// video_udp_setup packet) to send video to it. Throws a
+  /// std::runtime_error if the socket can not be created or the
+  /// server host can not be resolved.
+  UdpVideoReceiver(PacketMuxer& sender, const UdpVideoOptions& options, PacketCallback deliver);
+  virtual ~UdpVideoReceiver();
+
+  /// The local port datagrams are received on.
+  int port() const { return boundPort; }
+
+  /// Number of packets abandoned because datagrams were lost.
+  std::uint64_t getLostPacketCount() const { return lostPackets; }
+
+private:
+  struct PartialPacket {
+    std::vector<std::vector<std::uint8_t>> fragments;
+    std::vector<bool> haveFragment; // A fragment's data may be empty.
+    std::size_t received = 0;
+    std::uint32_t flags = 0;
+    std::chrono::steady_clock::time_point firstSeen;
+    bool complete() const { return received == fragments.size(); }
+  };
+
+  void receiveLoop();
+  void receiveDatagram(const std::uint8_t* datagram, std::size_t size,
+                       std::chrono::steady_clock::time_point now);
+  void detectLoss(std::uint32_t sequence);
+  void deliverReady(std::chrono::steady_clock::time_point now);
+  void deliver(PartialPacket& packet);
+  void abandon(std::uint32_t count, std::chrono::steady_clock::time_point now);
+  void requestKeyFrame(std::chrono::steady_clock::time_point now);
+
+  PacketMuxer& sender;
+  const UdpVideoOptions opts;
+  PacketCallback onPacket;
+  int socketFd;
+  int boundPort;
+  std::vector<std::uint32_t> serverAddresses; // IPv4 (network byte order).
+  ComPacket::IdType packetType;
+
+  // Only accessed on the receive thread:
+  std::map<std::uint32_t, PartialPacket> partial; // Keyed on packet ID.
+  bool started;
+  std::uint32_t nextPacketId;
+  std::uint32_t nextSequence;
+  bool waitingForKeyFrame;
+  std::chrono::steady_clock::time_point lastKeyFrameRequest;
+
+  std::atomic<std::uint64_t> lostPackets;
+  std::atomic<bool> run;
+  std::unique_ptr<std::thread> receiveThread;
+};
@@ -7,50 +7,105 @@
 
 #include <boost/log/trivial.hpp>
 
-VideoClient::VideoClient(PacketDemuxer& demuxer, const std::string& avPacketName)
-    : m_packetOffset(0),
-      m_avDataSubscription(
-          demuxer.subscribe(avPacketName, [this](const ComPacket::ConstSharedPacket& packet) {
-            m_avDataPackets.emplace(packet);
-            m_totalVideoBytes += packet->getDataSize();
-            BOOST_LOG_TRIVIAL(trace) << "Received compressed video packet of size " << packet->getDataSize() << std::endl;
-          })),
+namespace {
+// Several seconds of video at typical preview bit-rates:
+const std::size_t avQueueCapacity = 4096;
+// Several seconds worth of frames:
+const std::size_t timestampQueueCapacity = 256;
+}
+
+VideoClient::VideoClient(PacketDemuxer& demuxer, const std::string& avPacketName,
+                         const std::string& timestampPacketName)
+    : m_demuxer(demuxer),
+      m_avDataPackets(avQueueCapacity),
+      m_packetOffset(0),
+      m_lastTotalVideoBytes(0),
+      m_totalVideoBytes(0),
+      m_droppedPackets(0),
+      m_overflowed(false),
+      m_frameTimestamps(timestampQueueCapacity),
+      m_frameServerTime(-1),
+      m_frameSkipQueueDepth(0),
+      m_decodeTimeMicros(0),
+      m_packetWaitTime(0),
       m_avTimeout(0) {
+  if (!avPacketName.empty()) {
+    m_avDataSubscription = demuxer.subscribe(avPacketName, [this](const ComPacket::ConstSharedPacket& packet) {
+      enqueuePacket(packet);
+    });
+  }
+
+  if (!timestampPacketName.empty()) {
+    m_timestampSubscription = demuxer.subscribe(timestampPacketName, [this](const ComPacket::ConstSharedPacket& packet) {
+      packets::FrameTimestamp timestamp;
+      deserialise(packet, timestamp);
+      if (!m_frameTimestamps.push(timestamp)) {
+        BOOST_LOG_TRIVIAL(debug) << "Frame timestamp queue is full. Dropped timestamp for pts " << timestamp.pts;
+      }
+    });
+  }
 }
 
 VideoClient::~VideoClient() {
 }
 
+bool VideoClient::enqueuePacket(const ComPacket::ConstSharedPacket& packet) {
+  const auto size = packet->getDataSize();
+  if (m_overflowed) {
+    // Waiting for the decode thread to discard the queue:
+    m_droppedPackets += 1;
+    return false;
+  }
+  if (!m_avDataPackets.push(QueuedPacket{packet, std::chrono::steady_clock::now()})) {
+    m_droppedPackets += 1;
+    BOOST_LOG_TRIVIAL(warning) << "Compressed video queue is full. Dropping video until the next key-frame.";
+    m_overflowed = true;
+    return false;
+  }
+  m_totalVideoBytes += size;
+  BOOST_LOG_TRIVIAL(trace) << "Received compressed video packet of size " << size;
+  return true;
+}
+
+void VideoClient::recoverFromOverflow() {
+  // The producer does not push while the flag is set so the queue can
+  // be emptied from this side. The packet being read is discarded too:
+  QueuedPacket discarded;
+  while (m_avDataPackets.pop(discarded)) {
+    m_droppedPackets += 1;
+  }
+  m_currentPacket = nullptr;
+  m_packetOffset = 0;
+  m_streamer->discardUntilKeyFrame();
+  if (m_requestKeyFrame) {
+    m_requestKeyFrame();
+  }
+  m_overflowed = false;
+}
+
 /**
     @param videoTimeout If no video data is received for longer than this duration then streaming will terminate.
+    @param decoderOptions Options used to open the decoder (e.g. hardware acceleration).
 */
-bool VideoClient::initialiseVideoStream(const std::chrono::seconds& videoTimeout) {
+bool VideoClient::initialiseVideoStream(const std::chrono::seconds& videoTimeout,
+                                        const VideoDecoderOptions& decoderOptions) {
   m_avTimeout = videoTimeout;
   resetAvTimeout();
 
   m_lastBandwidthCalcTime = std::chrono::steady_clock::now();
 
   // Create a video reader object that uses function/callback IO:
-  m_videoIO.reset(new FFMpegStdFunctionIO(FFMpegCustomIO::ReadBuffer,
-                                          std::bind(&VideoClient::readPacket, std::ref(*this), std::placeholders::_1, std::placeholders::_2)));
-  m_streamer.reset(new LibAvCapture(*m_videoIO));
-  if (m_streamer->IsOpen() == false) {
+  m_streamer.reset(new VideoDecoder(std::bind(&VideoClient::readPacket, std::ref(*this), std::placeholders::_1, std::placeholders::_2),
+                                    decoderOptions));
+  if (m_streamer->isOpen() == false) {
     BOOST_LOG_TRIVIAL(debug) << "Failed to open video stream.";
     return false;
   }
 
-  // Get some frames so we can extract correct image dimensions:
-  bool gotFrame = false;
-  for (int i = 0; i < 2; ++i) {
-    gotFrame = m_streamer->GetFrame();
-    m_streamer->DoneFrame();
-  }
-
-  if (gotFrame == false) {
-    BOOST_LOG_TRIVIAL(debug) << "Failed to acquire frames from video stream.";
-    return false;
-  }
-
+  // Dimensions come from the stream parameters found while probing the
+  // format so there is no need to decode frames before returning. They
+  // may be reported as zero if the stream header did not carry them, in
+  // which case clients must take the size from each decoded frame:
   auto w = getFrameWidth();
   auto h = getFrameHeight();
   BOOST_LOG_TRIVIAL(debug) << "Successfully initialised video stream: " << w << "x" << h;
@@ -58,15 +113,36 @@ bool VideoClient::initialiseVideoStream(const std::chrono::seconds& videoTimeout
   return true;
 }
 
-bool VideoClient::receiveVideoFrame(std::function<void(LibAvCapture&)> callback) {
+bool VideoClient::receiveVideoFrame(std::function<void(VideoDecoder&)> callback) {
   if (m_streamer == nullptr) {
     throw std::logic_error(std::string(__FUNCTION__) + ": streamer object not allocated.");
   }
 
-  bool gotFrame = m_streamer->GetFrame();
+  if (m_overflowed) {
+    recoverFromOverflow();
+  }
+
+  if (m_frameSkipQueueDepth > 0) {
+    m_streamer->setSkipNonReferenceFrames(getQueueDepth() > m_frameSkipQueueDepth);
+  }
+
+  // Time spent blocked waiting for packets is subtracted so that the
+  // decode time reflects only the work done by the decoder:
+  m_packetWaitTime = std::chrono::steady_clock::duration::zero();
+  const auto startTime = std::chrono::steady_clock::now();
+  bool gotFrame = m_streamer->getFrame();
   if (gotFrame) {
+    const auto decodedTime = std::chrono::steady_clock::now();
+    const auto decodeTime = decodedTime - startTime - m_packetWaitTime;
+    m_decodeTimeMicros = std::chrono::duration_cast<std::chrono::microseconds>(decodeTime).count();
+    m_frameTiming.frameNumber += 1;
+    m_frameTiming.received = m_lastPacketReceived;
+    m_frameTiming.dequeued = m_lastPacketDequeued;
+    m_frameTiming.decoded = decodedTime;
+    m_frameTiming.decodeMicros = m_decodeTimeMicros;
+    m_frameServerTime = lookupServerTime(m_streamer->getFramePts());
     callback(*m_streamer);
-    m_streamer->DoneFrame();
+    m_streamer->doneFrame();
   }
 
   return gotFrame;
@@ -79,14 +155,15 @@ bool VideoClient::receiveVideoFrame(std::function<void(LibAvCapture&)> callback)
 double VideoClient::computeVideoBandwidthConsumed() {
   std::chrono::steady_clock::time_point timeNow = std::chrono::steady_clock::now();
   double seconds = std::chrono::duration_cast<std::chrono::milliseconds>(timeNow - m_lastBandwidthCalcTime).count() / 1000.0;
-  double bits_per_sec = (m_totalVideoBytes - m_lastTotalVideoBytes) * (8.0 / seconds);
-  m_lastTotalVideoBytes = m_totalVideoBytes;
+  const uint64_t totalBytes = m_totalVideoBytes;
+  double bits_per_sec = (totalBytes - m_lastTotalVideoBytes) * (8.0 / seconds);
+  m_lastTotalVideoBytes = totalBytes;
   m_lastBandwidthCalcTime = timeNow;
   return bits_per_sec;
 }
 
 bool VideoClient::streamerOk() const {
-  return m_streamer != nullptr && m_streamer->IoError() == false;
+  return m_streamer != nullptr && m_streamer->ioError() == false;
 }
 
 bool VideoClient::streamerIoError() const {
@@ -95,34 +172,61 @@ bool VideoClient::streamerIoError() const {
     return false;  // Streamer not allocated yet (obviosuly this does not count as IO error)
   }
 
-  return m_streamer->IoError();
+  return m_streamer->ioError();
 }
 
 /**
-    This is called back by the LibAvCapture object when it wants to decode
-    the next AV packet (i.e. in consequence of calling m_streamer->GetFrame()).
+    Pop the next AV packet from the queue, waiting for one to arrive if
+    necessary. The packet's payload is consumed later by the caller.
+
+    @param wait If false return immediately when the queue is empty.
+    @return The next packet or nullptr if none is available (or we timed out).
 */
-int VideoClient::readPacket(uint8_t* buffer, int size) {
+ComPacket::ConstSharedPacket VideoClient::popPacket(bool wait) {
   using namespace std::chrono_literals;
-  const auto retries = 4u;
-  SimpleQueue::LockedQueue lockedQueue = m_avDataPackets.lock();
-  while (m_avDataPackets.empty() && m_avDataSubscription.getDemuxer().ok()) {
-    lockedQueue.waitNotEmpty(1s);
-
-    if (m_avDataPackets.empty()) {
-      for (auto retry = 0u; retry < retries; retry++) {
-        BOOST_LOG_TRIVIAL(warning) << "VideoClient timed out waiting for an AV packet. Retry " << (retry+1) << "/" << retries << std::endl;
-        lockedQueue.waitNotEmpty(2s); // wait a bit longer before giving up...
-        if (!m_avDataPackets.empty()) {
-          BOOST_LOG_TRIVIAL(info) << "Retry " << retry + 1 << " successful." << std::endl;
-          break;
-        }
-      }
+  QueuedPacket queued;
+  while (!m_avDataPackets.pop(queued)) {
+    if (m_overflowed) {
+      // Nothing more will arrive until we have recovered:
+      recoverFromOverflow();
+      continue;
+    }
+    if (!wait || !m_demuxer.ok()) {
+      return nullptr;
+    }
 
-      if (avHasTimedOut()) {
-        BOOST_LOG_TRIVIAL(error) << "VideoClient timed out waiting for an AV packet." << std::endl;
-        return -1;
-      }
+    const auto waitStart = std::chrono::steady_clock::now();
+    const bool arrived = m_avDataPackets.waitNotEmpty(1s);
+    m_packetWaitTime += std::chrono::steady_clock::now() - waitStart;
+    if (arrived) {
+      continue;
+    }
+
+    if (avHasTimedOut()) {
+      BOOST_LOG_TRIVIAL(error) << "VideoClient timed out waiting for an AV packet." << std::endl;
+      return nullptr;
+    }
+    BOOST_LOG_TRIVIAL(warning) << "VideoClient is waiting for an AV packet." << std::endl;
+  }
+
+  m_lastPacketReceived = queued.received;
+  m_lastPacketDequeued = std::chrono::steady_clock::now();
+  return queued.packet;
+}
+
+/**
+    This is called back by the VideoDecoder object when it wants to decode
+    the next AV packet (i.e. in consequence of calling m_streamer->getFrame()).
+
+    The packet currently being consumed is held by reference (shared pointer)
+    outside of the queue while we copy out of it. The FFmpeg custom IO read callback only accepts
+    a caller owned buffer so one copy into it is unavoidable.
+*/
+int VideoClient::readPacket(uint8_t* buffer, int size) {
+  if (m_currentPacket == nullptr) {
+    m_currentPacket = popPacket(true);
+    if (m_currentPacket == nullptr) {
+      return -1;
     }
   }
 
@@ -131,22 +235,22 @@ int VideoClient::readPacket(uint8_t* buffer, int size) {
   // We were asked for more than packet contains so loop through packets until
   // we have returned what we needed or there are no more packets:
   int required = size;
-  while (required > 0 && m_avDataPackets.empty() == false) {
-    const ComPacket::ConstSharedPacket packet = m_avDataPackets.front();
-    const int availableSize = packet->getData().size() - m_packetOffset;
+  while (required > 0 && m_currentPacket != nullptr) {
+    const auto& data = m_currentPacket->getData();
+    const int availableSize = data.size() - m_packetOffset;
 
     if (availableSize <= required) {
       // Current packet contains less than required so copy the whole packet
-      // and continue:
-      std::copy(packet->getData().begin() + m_packetOffset, packet->getData().end(), buffer);
+      // and continue with the next one (if there is one already waiting):
+      std::copy(data.begin() + m_packetOffset, data.end(), buffer);
       m_packetOffset = 0;  // Reset the packet offset so the next packet will be read from beginning.
-      m_avDataPackets.pop();
       buffer += availableSize;
       required -= availableSize;
+      m_currentPacket = popPacket(false);
     } else {
       // Current packet contains more than enough to fulfill the request
       // so copy what is required and save the rest for later:
-      auto startItr = packet->getData().begin() + m_packetOffset;
+      auto startItr = data.begin() + m_packetOffset;
       std::copy(startItr, startItr + required, buffer);
       m_packetOffset += required;  // Increment the packet offset by the amount read from this packet.
       required = 0;
@@ -156,6 +260,26 @@ int VideoClient::readPacket(uint8_t* buffer, int size) {
   return size - required;
 }
 
+/**
+    Find the server time for the frame with the given pts. Timestamps arrive
+    in stream order so any older than the current frame are discarded (they
+    belong to frames that were skipped).
+
+    @return Server time in microseconds or -1 if there is no timestamp for the frame.
+*/
+std::int64_t VideoClient::lookupServerTime(std::int64_t pts) {
+  packets::FrameTimestamp timestamp;
+  while (m_frameTimestamps.peek(timestamp) && timestamp.pts < pts) {
+    m_frameTimestamps.pop(timestamp);
+  }
+
+  if (m_frameTimestamps.peek(timestamp) && timestamp.pts == pts) {
+    m_frameTimestamps.pop(timestamp);
+    return timestamp.microseconds;
+  }
+  return -1;
+}
+
 void VideoClient::resetAvTimeout() {
   m_avDataTimeoutPoint = std::chrono::steady_clock::now() + m_avTimeout;
 }
@@ -4,13 +4,18 @@
 #ifndef __VIDEO_CLIENT_H__
 #define __VIDEO_CLIENT_H__
 
-#include <VideoLib.h>
-
 #include <PacketComms.h>
 
+#include <atomic>
 #include <cinttypes>
+#include <functional>
 #include <memory>
 
+#include "FrameStats.hpp"
+#include "PacketDescriptions.hpp"
+#include "SpscRing.hpp"
+#include "VideoDecoder.hpp"
+
 // Copyright (c) 2022 Graphcore Ltd. All rights reserved.
 
 #include <boost/log/trivial.hpp>
@@ -23,38 +28,114 @@ class PacketDemuxer;
     In the constructor a subscription is made to AvData packets which are
     simply enqued as they are received. Note that the server must be sending
     packets with the same name.
+
+    The queue is a lock-free single-producer (demuxer thread) single-consumer
+    (decode thread) ring so the two threads never contend for a mutex.
+
+    If a timestamp packet name is given then the server's wall-clock time
+    for each frame is also received so that end-to-end latency can be measured.
+
+    If the AV packet name is empty no subscription is made: packets must
+    instead be supplied by enqueuePacket() (e.g. from a UDP transport).
 */
 class VideoClient {
 public:
-  VideoClient(PacketDemuxer& demuxer, const std::string& avPacketName);
+  VideoClient(PacketDemuxer& demuxer, const std::string& avPacketName,
+              const std::string& timestampPacketName = "");
   virtual ~VideoClient();
 
-  bool initialiseVideoStream(const std::chrono::seconds& videoTimeout);
-  int getFrameWidth() const { return m_streamer->GetFrameWidth(); };
-  int getFrameHeight() const { return m_streamer->GetFrameHeight(); };
+  bool initialiseVideoStream(const std::chrono::seconds& videoTimeout,
+                             const VideoDecoderOptions& decoderOptions = VideoDecoderOptions());
+  int getFrameWidth() const { return m_streamer->getFrameWidth(); };
+  int getFrameHeight() const { return m_streamer->getFrameHeight(); };
+
+  bool receiveVideoFrame(std::function<void(VideoDecoder&)>);
+
+  /// Queue a compressed packet for decoding. Only for use when not
+  /// subscribed to AV packets and only ever from one thread.
+  ///
+  /// If the queue is full the stream can no longer be decoded correctly
+  /// so packets are dropped until the decoder has discarded everything
+  /// queued and is waiting for the next key-frame (which is requested
+  /// by calling the key-frame request function, if one is set).
+  /// @return false if the packet was dropped.
+  bool enqueuePacket(const ComPacket::ConstSharedPacket& packet);
 
-  bool receiveVideoFrame(std::function<void(LibAvCapture&)>);
+  /// Set a function to ask the server for a key-frame. It is called on
+  /// the decode thread after packets were dropped.
+  void setKeyFrameRequest(std::function<void()> request) { m_requestKeyFrame = request; }
+
+  /// True once the stream can not be read any further (e.g. because no
+  /// video data arrived within the timeout given to initialiseVideoStream()).
+  bool streamLost() const { return m_streamer != nullptr && m_streamer->ioError(); }
+
+  /// Server wall-clock time (microseconds since epoch) at which the frame
+  /// passed to the receiveVideoFrame() callback was encoded, or -1 if unknown.
+  std::int64_t getFrameServerTimeMicros() const { return m_frameServerTime; }
+
+  /// Skip decoding non-reference frames whenever more than this many
+  /// packets are queued (so that we catch up). Zero disables skipping.
+  void setFrameSkipQueueDepth(std::size_t depth) { m_frameSkipQueueDepth = depth; }
 
   double computeVideoBandwidthConsumed();
 
+  /// Time taken to decode the most recent frame in microseconds (excluding
+  /// time spent waiting for packets to arrive). Safe to call from any thread.
+  std::int64_t getDecodeTimeMicros() const { return m_decodeTimeMicros; }
+
+  /// Receive, queue and decode times of the frame passed to the
+  /// receiveVideoFrame() callback (the later stages are not filled in).
+  /// The packet times are those of the last packet the decoder read for it.
+  const FrameTiming& getFrameTiming() const { return m_frameTiming; }
+
+  /// Number of compressed packets waiting to be decoded.
+  std::size_t getQueueDepth() const { return m_avDataPackets.size(); }
+  /// Maximum queue depth seen since the stream started.
+  std::size_t getQueueHighWaterMark() const { return m_avDataPackets.highWaterMark(); }
+  /// Number of packets discarded because the queue was full.
+  std::uint64_t getDroppedPacketCount() const { return m_droppedPackets; }
+
 protected:
   bool streamerOk() const;
   bool streamerIoError() const;
   int readPacket(uint8_t* buffer, int size);
+  ComPacket::ConstSharedPacket popPacket(bool wait);
+  /// After an overflow discard everything queued and resume at the next key-frame.
+  void recoverFromOverflow();
 
 private:
-  SimpleQueue m_avInfoPackets;
-  SimpleQueue m_avDataPackets;
+  struct QueuedPacket {
+    ComPacket::ConstSharedPacket packet;
+    std::chrono::steady_clock::time_point received;
+  };
+
+  PacketDemuxer& m_demuxer;
+  SpscRing<QueuedPacket> m_avDataPackets;
+  ComPacket::ConstSharedPacket m_currentPacket;
   int m_packetOffset;
   uint64_t m_lastTotalVideoBytes;
-  uint64_t m_totalVideoBytes;
+  std::atomic<uint64_t> m_totalVideoBytes;
+  std::atomic<uint64_t> m_droppedPackets;
+  // Set by the producer when the queue overflows and cleared by the
+  // consumer once it has discarded the queue (packets are dropped meanwhile):
+  std::atomic<bool> m_overflowed;
+  std::function<void()> m_requestKeyFrame;
   PacketSubscription m_avDataSubscription;
-
-  std::unique_ptr<FFMpegStdFunctionIO> m_videoIO;
-  std::unique_ptr<LibAvCapture> m_streamer;
+  SpscRing<packets::FrameTimestamp> m_frameTimestamps;
+  PacketSubscription m_timestampSubscription;
+  std::int64_t m_frameServerTime;
+  std::size_t m_frameSkipQueueDepth;
+  std::atomic<std::int64_t> m_decodeTimeMicros;
+  std::chrono::steady_clock::duration m_packetWaitTime;
+  std::chrono::steady_clock::time_point m_lastPacketReceived;
+  std::chrono::steady_clock::time_point m_lastPacketDequeued;
+  FrameTiming m_frameTiming;
+
+  std::unique_ptr<VideoDecoder> m_streamer;
 
   void resetAvTimeout();
   bool avHasTimedOut();
+  std::int64_t lookupServerTime(std::int64_t pts);
   std::chrono::steady_clock::time_point m_avDataTimeoutPoint;
   std::chrono::seconds m_avTimeout;
   std::chrono::steady_clock::time_point m_lastBandwidthCalcTime;
@@ -0,0 +1,457 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#include "VideoDecoder.hpp"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/hwcontext.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+#include <boost/log/trivial.hpp>
+
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+const int avioBufferSize = 32 * 1024;
+const int lowLatencyProbeSize = 64 * 1024;
+
+bool isPlanarYuv420(int format) {
+  return format == AV_PIX_FMT_YUV420P || format == AV_PIX_FMT_YUVJ420P;
+}
+
+/// Callback for AVCodecContext::get_format. The context's opaque
+/// pointer points at the pixel format of the chosen hw decoder.
+enum AVPixelFormat getHwFormat(AVCodecContext* context, const enum AVPixelFormat* formats) {
+  const auto hwFormat = *static_cast<const int*>(context->opaque);
+  for (auto f = formats; *f != AV_PIX_FMT_NONE; ++f) {
+    if (*f == hwFormat) {
+      return *f;
+    }
+  }
+
+  // Fall back to the first software format on offer:
+  for (auto f = formats; *f != AV_PIX_FMT_NONE; ++f) {
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(*f);
+    if (desc && !(desc->flags & AV_PIX_FMT_FLAG_HWACCEL)) {
+      BOOST_LOG_TRIVIAL(warning) << "Hardware decode format unavailable, using software format: " << desc->name;
+      return *f;
+    }
+  }
+  return AV_PIX_FMT_NONE;
+}
+
+/// Hardware device types to try (in order) for a given --hwdecode name.
+std::vector<AVHWDeviceType> hwDeviceTypes(const std::string& name) {
+  if (name == "auto") {
+    return {
+#if defined(__APPLE__)
+      AV_HWDEVICE_TYPE_VIDEOTOOLBOX,
+#endif
+      AV_HWDEVICE_TYPE_CUDA,
+      AV_HWDEVICE_TYPE_VAAPI
+    };
+  }
+  if (name == "nvdec") {
+    // FFmpeg's NVDEC hwaccel decodes via a CUDA device:
+    return {AV_HWDEVICE_TYPE_CUDA};
+  }
+  auto type = av_hwdevice_find_type_by_name(name.c_str());
+  if (type == AV_HWDEVICE_TYPE_NONE) {
+    return {};
+  }
+  return {type};
+}
+
+} // end anonymous namespace
+
+VideoDecoder::VideoDecoder(ReadFunction read, const VideoDecoderOptions& options)
+    : readFunction(read),
+      ioContext(nullptr),
+      formatContext(nullptr),
+      codecContext(nullptr),
+      frame(nullptr),
+      swFrame(nullptr),
+      packet(nullptr),
+      hwDeviceContext(nullptr),
+      hwPixelFormat(AV_PIX_FMT_NONE),
+      swsContext(nullptr),
+      streamIndex(-1),
+      ioErrorFlag(false),
+      yuvConverted(false),
+      lowLatency(false),
+      threadCount(options.threads),
+      skipNonReference(false),
+      waitingForKeyFrame(false) {
+  auto ioBuffer = static_cast<std::uint8_t*>(av_malloc(avioBufferSize));
+  if (ioBuffer == nullptr) {
+    BOOST_LOG_TRIVIAL(error) << "Could not allocate video IO buffer.";
+    return;
+  }
+  ioContext = avio_alloc_context(ioBuffer, avioBufferSize, 0, this, &VideoDecoder::readCallback, nullptr, nullptr);
+  if (ioContext == nullptr) {
+    av_free(ioBuffer);
+    BOOST_LOG_TRIVIAL(error) << "Could not allocate video IO context.";
+    return;
+  }
+
+  formatContext = avformat_alloc_context();
+  if (formatContext == nullptr) {
+    // The IO context is freed by close():
+    BOOST_LOG_TRIVIAL(error) << "Could not allocate video format context.";
+    return;
+  }
+  formatContext->pb = ioContext;
+  formatContext->flags |= AVFMT_FLAG_CUSTOM_IO;
+  if (options.lowLatency) {
+    // Do not buffer packets in the demuxer and keep probing short:
+    formatContext->flags |= AVFMT_FLAG_NOBUFFER;
+    formatContext->probesize = lowLatencyProbeSize;
+    formatContext->max_analyze_duration = AV_TIME_BASE / 10;
+  }
+
+  // Note: avformat_open_input frees the context on failure:
+  if (avformat_open_input(&formatContext, nullptr, nullptr, nullptr) < 0) {
+    BOOST_LOG_TRIVIAL(error) << "Could not open video stream.";
+    return;
+  }
+
+  if (avformat_find_stream_info(formatContext, nullptr) < 0) {
+    BOOST_LOG_TRIVIAL(error) << "Could not find video stream info.";
+    return;
+  }
+
+  streamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+  if (streamIndex < 0) {
+    BOOST_LOG_TRIVIAL(error) << "No video stream found.";
+    return;
+  }
+
+  const AVCodecParameters* params = formatContext->streams[streamIndex]->codecpar;
+  const AVCodec* codec = avcodec_find_decoder(params->codec_id);
+  if (codec == nullptr) {
+    BOOST_LOG_TRIVIAL(error) << "No decoder available for video codec id " << params->codec_id;
+    return;
+  }
+
+  lowLatency = options.lowLatency;
+  bool opened = false;
+  if (!options.hwDevice.empty()) {
+    opened = openCodec(codec, params, options.hwDevice);
+    if (!opened) {
+      BOOST_LOG_TRIVIAL(warning) << "Hardware decode (" << options.hwDevice << ") unavailable, falling back to software decode.";
+    }
+  }
+  if (!opened && !openCodec(codec, params, "")) {
+    return;
+  }
+
+  frame = av_frame_alloc();
+  swFrame = av_frame_alloc();
+  packet = av_packet_alloc();
+  BOOST_LOG_TRIVIAL(debug) << "Opened video decoder: " << codec->name;
+}
+
+/// Try to create a hw device context that the codec can decode with.
+bool VideoDecoder::initHwDevice(const AVCodec* codec, const std::string& hwDevice) {
+  for (auto type : hwDeviceTypes(hwDevice)) {
+    for (int i = 0;; ++i) {
+      const AVCodecHWConfig* config = avcodec_get_hw_config(codec, i);
+      if (config == nullptr) {
+        break;
+      }
+      if ((config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX) && config->device_type == type) {
+        if (av_hwdevice_ctx_create(&hwDeviceContext, type, nullptr, nullptr, 0) == 0) {
+          hwPixelFormat = config->pix_fmt;
+          BOOST_LOG_TRIVIAL(info) << "Using hardware video decode: " << av_hwdevice_get_type_name(type);
+          return true;
+        }
+        BOOST_LOG_TRIVIAL(debug) << "Could not create hw device: " << av_hwdevice_get_type_name(type);
+      }
+    }
+  }
+  return false;
+}
+
+/// Open the decoder (using the named hw device if not empty).
+bool VideoDecoder::openCodec(const AVCodec* codec, const AVCodecParameters* params, const std::string& hwDevice) {
+  if (!hwDevice.empty() && !initHwDevice(codec, hwDevice)) {
+    return false;
+  }
+
+  AVCodecContext* context = avcodec_alloc_context3(codec);
+  if (context == nullptr) {
+    BOOST_LOG_TRIVIAL(error) << "Could not allocate video decoder context: " << codec->name;
+    av_buffer_unref(&hwDeviceContext);
+    hwPixelFormat = AV_PIX_FMT_NONE;
+    return false;
+  }
+  if (hwDeviceContext != nullptr) {
+    context->hw_device_ctx = av_buffer_ref(hwDeviceContext);
+    context->opaque = &hwPixelFormat;
+    context->get_format = &getHwFormat;
+  }
+
+  context->thread_count = threadCount;
+  if (lowLatency) {
+    // Output frames as soon as they are decoded. Frame threading
+    // would add a frame of delay per thread so only use slices:
+    context->flags |= AV_CODEC_FLAG_LOW_DELAY;
+    context->flags2 |= AV_CODEC_FLAG2_FAST;
+    context->thread_type = FF_THREAD_SLICE;
+  }
+
+  if (avcodec_parameters_to_context(context, params) < 0 ||
+      avcodec_open2(context, codec, nullptr) < 0) {
+    BOOST_LOG_TRIVIAL(error) << "Could not open video decoder: " << codec->name;
+    avcodec_free_context(&context);
+    av_buffer_unref(&hwDeviceContext);
+    hwPixelFormat = AV_PIX_FMT_NONE;
+    return false;
+  }
+
+  codecContext = context;
+  return true;
+}
+
+VideoDecoder::~VideoDecoder() {
+  close();
+}
+
+void VideoDecoder::close() {
+  sws_freeContext(swsContext);
+  swsContext = nullptr;
+  av_frame_free(&frame);
+  av_frame_free(&swFrame);
+  av_packet_free(&packet);
+  avcodec_free_context(&codecContext);
+  av_buffer_unref(&hwDeviceContext);
+  avformat_close_input(&formatContext);
+  if (ioContext != nullptr) {
+    // Custom IO buffers are not freed by avformat_close_input:
+    av_freep(&ioContext->buffer);
+    avio_context_free(&ioContext);
+  }
+}
+
+int VideoDecoder::readCallback(void* opaque, std::uint8_t* buffer, int size) {
+  auto& decoder = *static_cast<VideoDecoder*>(opaque);
+  const int result = decoder.readFunction(buffer, size);
+  if (result < 0) {
+    return AVERROR(EIO);
+  }
+  if (result == 0) {
+    return AVERROR_EOF;
+  }
+  return result;
+}
+
+bool VideoDecoder::getFrame() {
+  if (!isOpen()) {
+    return false;
+  }
+
+  while (true) {
+    int ret = avcodec_receive_frame(codecContext, frame);
+    if (ret == 0) {
+      if (waitingForKeyFrame) {
+        // Only key-frames are decoded while waiting so this is one:
+        waitingForKeyFrame = false;
+        updateSkipFrame();
+        BOOST_LOG_TRIVIAL(debug) << "Video decoding resumed at a key-frame.";
+      }
+      return transferHwFrame();
+    }
+    if (ret != AVERROR(EAGAIN)) {
+      // End of stream or decoder error:
+      return false;
+    }
+
+    // Decoder needs more input:
+    ret = av_read_frame(formatContext, packet);
+    if (ret < 0) {
+      ioErrorFlag = true;
+      return false;
+    }
+
+    if (packet->stream_index == streamIndex) {
+      ret = avcodec_send_packet(codecContext, packet);
+      if (ret < 0 && ret != AVERROR(EAGAIN)) {
+        BOOST_LOG_TRIVIAL(warning) << "Error decoding video packet (" << ret << ").";
+      }
+    }
+    av_packet_unref(packet);
+  }
+}
+
+/// If the current frame is in hw memory download it to system memory.
+bool VideoDecoder::transferHwFrame() {
+  if (frame->format != hwPixelFormat) {
+    return true;
+  }
+
+  if (av_hwframe_transfer_data(swFrame, frame, 0) < 0) {
+    BOOST_LOG_TRIVIAL(warning) << "Could not transfer frame from hardware decoder.";
+    av_frame_unref(frame);
+    return false;
+  }
+  av_frame_copy_props(swFrame, frame);
+  av_frame_unref(frame);
+  av_frame_move_ref(frame, swFrame);
+  return true;
+}
+
+void VideoDecoder::doneFrame() {
+  av_frame_unref(frame);
+}
+
+// The current frame's own dimensions take precedence: with frame
+// threading the codec context can already describe a resolution change
+// that the frames being returned do not have yet.
+int VideoDecoder::getFrameWidth() const {
+  if (frame && frame->width > 0) {
+    return frame->width;
+  }
+  return codecContext ? codecContext->width : 0;
+}
+
+int VideoDecoder::getFrameHeight() const {
+  if (frame && frame->height > 0) {
+    return frame->height;
+  }
+  return codecContext ? codecContext->height : 0;
+}
+
+std::int64_t VideoDecoder::getFramePts() const {
+  return frame ? frame->best_effort_timestamp : AV_NOPTS_VALUE;
+}
+
+void VideoDecoder::setSkipNonReferenceFrames(bool skip) {
+  skipNonReference = skip;
+  updateSkipFrame();
+}
+
+void VideoDecoder::discardUntilKeyFrame() {
+  if (codecContext == nullptr) {
+    return;
+  }
+  avcodec_flush_buffers(codecContext);
+  waitingForKeyFrame = true;
+  updateSkipFrame();
+}
+
+void VideoDecoder::updateSkipFrame() {
+  if (codecContext != nullptr) {
+    codecContext->skip_frame = waitingForKeyFrame ? AVDISCARD_NONKEY
+                             : (skipNonReference ? AVDISCARD_NONREF : AVDISCARD_DEFAULT);
+  }
+}
+
+void VideoDecoder::extract(int avPixelFormat, std::uint8_t* const dst[], const int dstStride[]) {
+  swsContext = sws_getCachedContext(
+      swsContext,
+      frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+      frame->width, frame->height, static_cast<AVPixelFormat>(avPixelFormat),
+      SWS_BILINEAR, nullptr, nullptr, nullptr);
+  if (swsContext == nullptr) {
+    throw std::runtime_error("Could not create video colour conversion context.");
+  }
+  sws_scale(swsContext, frame->data, frame->linesize, 0, frame->height, dst, dstStride);
+}
+
+void VideoDecoder::extractRgbImage(std::uint8_t* dst, int stride) {
+  std::uint8_t* planes[4] = {dst, nullptr, nullptr, nullptr};
+  int strides[4] = {stride, 0, 0, 0};
+  extract(AV_PIX_FMT_RGB24, planes, strides);
+}
+
+void VideoDecoder::extractRgbaImage(std::uint8_t* dst, int stride) {
+  std::uint8_t* planes[4] = {dst, nullptr, nullptr, nullptr};
+  int strides[4] = {stride, 0, 0, 0};
+  extract(AV_PIX_FMT_RGBA, planes, strides);
+}
+
+void VideoDecoder::extractYuv420Planes(std::uint8_t* y, std::uint8_t* u, std::uint8_t* v) {
+  const int w = frame->width;
+  const int h = frame->height;
+  const int cw = (w + 1) / 2;
+  const int ch = (h + 1) / 2;
+
+  if (frame->format == AV_PIX_FMT_NV12) {
+    // Semi-planar output is typical of hw decoders. De-interleaving
+    // the chroma is much cheaper than a full swscale conversion:
+    yuvConverted = false;
+    av_image_copy_plane(y, w, frame->data[0], frame->linesize[0], w, h);
+    for (int r = 0; r < ch; ++r) {
+      const std::uint8_t* uv = frame->data[1] + r * frame->linesize[1];
+      for (int c = 0; c < cw; ++c) {
+        u[r * cw + c] = uv[2 * c];
+        v[r * cw + c] = uv[2 * c + 1];
+      }
+    }
+    return;
+  }
+
+  yuvConverted = !isPlanarYuv420(frame->format);
+  if (yuvConverted) {
+    std::uint8_t* planes[4] = {y, u, v, nullptr};
+    int strides[4] = {w, cw, cw, 0};
+    extract(AV_PIX_FMT_YUV420P, planes, strides);
+    return;
+  }
+
+  av_image_copy_plane(y, w, frame->data[0], frame->linesize[0], w, h);
+  av_image_copy_plane(u, cw, frame->data[1], frame->linesize[1], cw, ch);
+  av_image_copy_plane(v, cw, frame->data[2], frame->linesize[2], cw, ch);
+}
+
+YuvToRgbCoefficients VideoDecoder::makeYuvToRgbCoefficients(float kr, float kb, bool fullRange) {
+  const float kg = 1.f - kr - kb;
+
+  // Scale and offset to expand limited ("TV") range to [0, 1]:
+  const float ys = fullRange ? 1.f : 255.f / 219.f;
+  const float yo = fullRange ? 0.f : 16.f / 255.f;
+  const float cs = fullRange ? 1.f : 255.f / 224.f;
+  const float co = 128.f / 255.f;
+
+  const float rv = 2.f * (1.f - kr) * cs;
+  const float gu = -2.f * kb * (1.f - kb) / kg * cs;
+  const float gv = -2.f * kr * (1.f - kr) / kg * cs;
+  const float bu = 2.f * (1.f - kb) * cs;
+
+  return YuvToRgbCoefficients{
+    {ys, 0.f, rv, -ys * yo - rv * co},
+    {ys, gu, gv, -ys * yo - (gu + gv) * co},
+    {ys, bu, 0.f, -ys * yo - bu * co}
+  };
+}
+
+YuvToRgbCoefficients VideoDecoder::defaultYuvToRgbCoefficients() {
+  // swscale assumes limited range BT.601 when unspecified:
+  return makeYuvToRgbCoefficients(0.299f, 0.114f, false);
+}
+
+YuvToRgbCoefficients VideoDecoder::getYuvToRgbCoefficients() const {
+  if (yuvConverted || frame == nullptr) {
+    // We converted to 4:2:0 with swscale which outputs the default:
+    return defaultYuvToRgbCoefficients();
+  }
+
+  // Luma weights for the frame's colour space:
+  float kr = 0.299f;
+  float kb = 0.114f;
+  if (frame->colorspace == AVCOL_SPC_BT709) {
+    kr = 0.2126f;
+    kb = 0.0722f;
+  } else if (frame->colorspace == AVCOL_SPC_BT2020_NCL) {
+    kr = 0.2627f;
+    kb = 0.0593f;
+  }
+  const bool fullRange = frame->color_range == AVCOL_RANGE_JPEG || frame->format == AV_PIX_FMT_YUVJ420P;
+  return makeYuvToRgbCoefficients(kr, kb, fullRange);
+}
@@ -0,0 +1,139 @@
+// Copyright (c) 2022 Graphcore Ltd. All rights reserved.
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+struct AVBufferRef;
+struct AVCodec;
+struct AVCodecContext;
+struct AVCodecParameters;
+struct AVFormatContext;
+struct AVFrame;
+struct AVIOContext;
+struct AVPacket;
+struct SwsContext;
+
+/// Colour conversion coefficients for a decoded YUV frame. Each row
+/// transforms (y, u, v, 1) into one of the (r, g, b) channels where the
+/// inputs are normalised to [0, 1] (as they are when sampled from a
+/// UInt8 texture).
+struct YuvToRgbCoefficients {
+  float r[4];
+  float g[4];
+  float b[4];
+};
+
+/// Convert a single 8-bit YUV sample to 8-bit RGB (used to inspect pixels on the CPU).
+inline void yuvToRgb(const YuvToRgbCoefficients& k, std::uint8_t y, std::uint8_t u, std::uint8_t v, std::uint8_t rgb[3]) {
+  const float in[4] = {y / 255.f, u / 255.f, v / 255.f, 1.f};
+  const float* rows[3] = {k.r, k.g, k.b};
+  for (int c = 0; c < 3; ++c) {
+    float value = 0.f;
+    for (int i = 0; i < 4; ++i) {
+      value += rows[c][i] * in[i];
+    }
+    value = value < 0.f ? 0.f : (value > 1.f ? 1.f : value);
+    rgb[c] = static_cast<std::uint8_t>(value * 255.f + 0.5f);
+  }
+}
+
+/// Options used when opening the video decoder.
+struct VideoDecoderOptions {
+  /// Hardware decode device: "vaapi", "videotoolbox", "nvdec", "auto"
+  /// or any other FFmpeg hw device type name. Empty for software decode.
+  std::string hwDevice;
+  /// Configure the demuxer and decoder to minimise buffering and
+  /// frame reordering (at some cost in throughput).
+  bool lowLatency = false;
+  /// Number of decoding threads (zero lets FFmpeg use one per core).
+  int threads = 1;
+};
+
+/// Thin wrapper around the FFmpeg demuxer and decoder that reads its
+/// input from a user supplied function (in the same way as videolib's
+/// FFMpegStdFunctionIO). Unlike LibAvCapture it gives access to the
+/// decoder's native planar YUV output so that colour conversion can
+/// be done on the GPU. Hardware accelerated decoding is used if it is
+/// requested and available, otherwise decoding falls back to software.
+class VideoDecoder {
+public:
+  /// Function with the semantics of an AVIO read callback: fill the buffer
+  /// with up to size bytes and return the number written (or < 0 on error).
+  using ReadFunction = std::function<int(std::uint8_t*, int)>;
+
+  VideoDecoder(ReadFunction read, const VideoDecoderOptions& options = VideoDecoderOptions());
+  virtual ~VideoDecoder();
+
+  VideoDecoder(const VideoDecoder&) = delete;
+  VideoDecoder& operator=(const VideoDecoder&) = delete;
+
+  bool isOpen() const { return codecContext != nullptr; }
+  bool ioError() const { return ioErrorFlag; }
+  /// True if frames are being decoded in hardware.
+  bool hwDecoding() const { return hwDeviceContext != nullptr; }
+
+  /// Decode the next frame. If this returns true the frame can be
+  /// accessed until doneFrame() is called.
+  bool getFrame();
+  void doneFrame();
+
+  int getFrameWidth() const;
+  int getFrameHeight() const;
+  /// Presentation timestamp of the current frame (in the stream's time base).
+  std::int64_t getFramePts() const;
+
+  /// Ask the decoder to discard non-reference frames (e.g. to catch up when behind).
+  void setSkipNonReferenceFrames(bool skip);
+
+  /// Drop any frames buffered in the decoder and discard everything until
+  /// the next key-frame (e.g. after compressed data was lost, so that the
+  /// frames that referred to it are not shown corrupted).
+  void discardUntilKeyFrame();
+
+  /// Convert the current frame to packed RGB/RGBA (uses swscale on the CPU).
+  void extractRgbImage(std::uint8_t* dst, int stride);
+  void extractRgbaImage(std::uint8_t* dst, int stride);
+
+  /// Copy the current frame into three tightly packed YUV 4:2:0 planes.
+  /// If the decoder's native format is planar 4:2:0 this is a plain copy,
+  /// otherwise the frame is converted with swscale.
+  void extractYuv420Planes(std::uint8_t* y, std::uint8_t* u, std::uint8_t* v);
+
+  /// Coefficients needed to convert the current frame's YUV values to RGB.
+  YuvToRgbCoefficients getYuvToRgbCoefficients() const;
+
+  /// Coefficients for limited range BT.601 (what swscale assumes by default).
+  static YuvToRgbCoefficients defaultYuvToRgbCoefficients();
+
+private:
+  static YuvToRgbCoefficients makeYuvToRgbCoefficients(float kr, float kb, bool fullRange);
+  bool openCodec(const AVCodec* codec, const AVCodecParameters* params, const std::string& hwDevice);
+  bool initHwDevice(const AVCodec* codec, const std::string& hwDevice);
+  bool transferHwFrame();
+  static int readCallback(void* opaque, std::uint8_t* buffer, int size);
+  void extract(int avPixelFormat, std::uint8_t* const dst[], const int dstStride[]);
+  void close();
+
+  ReadFunction readFunction;
+  AVIOContext* ioContext;
+  AVFormatContext* formatContext;
+  AVCodecContext* codecContext;
+  AVFrame* frame;
+  AVFrame* swFrame; // Destination for frames downloaded from a hw decoder.
+  AVPacket* packet;
+  AVBufferRef* hwDeviceContext;
+  int hwPixelFormat;
+  SwsContext* swsContext;
+  int streamIndex;
+  bool ioErrorFlag;
+  bool yuvConverted; // True if the last 4:2:0 planes came from swscale rather than the decoder.
+  bool lowLatency;
+  int threadCount;
+  bool skipNonReference;
+  bool waitingForKeyFrame;
+  /// Set the codec's skip_frame from the two flags above.
+  void updateSkipFrame();
+};
@@ -3,112 +3,155 @@
 #include "VideoPreviewWindow.hpp"
 
 #include <PacketComms.h>
+#include <PacketSerialisation.h>
 
 #include <boost/log/trivial.hpp>
 
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Size of the preview before the first frame arrives:
+const nanogui::Vector2i placeholderSize(960, 540);
+
+// Only request HDR tiles for views this small (i.e. zoomed in far enough
+// for pixel values to be displayed) and not more often than this:
+constexpr int maxRegionPixels = 256 * 256;
+constexpr auto minRegionRequestInterval = std::chrono::milliseconds(100);
+// Time to wait for a reply before requesting the same region again:
+constexpr auto regionRequestTimeout = std::chrono::milliseconds(500);
+
+} // end anonymous namespace
+
 VideoPreviewWindow::VideoPreviewWindow(
     nanogui::Screen* screen,
     const std::string& title,
-    PacketDemuxer& receiver)
+    PacketDemuxer& receiver,
+    PacketMuxer& sender,
+    const VideoPreviewOptions& options)
     : nanogui::Window(screen, title),
-      videoClient(std::make_unique<VideoClient>(receiver, "render_preview")),
+      onFrameReady(options.frameReady),
       texture(nullptr),
+      imageView(nullptr),
+      statusLabel(nullptr),
+      displayedSize(0, 0),
+      rgbChannels(3),
       mbps(0.0),
       m_lastFrameTime(std::chrono::steady_clock::now()),
       fps(0.f),
-      newFrameDecoded(false),
+      latencyMs(-1.0),
+      decodeMs(0.0),
+      newUploadedTiming(false),
+      uploadedFrameCount(0),
+      uploadedServerTimeMicros(-1),
       runDecoderThread(true),
-      showRawPixelValues(false) {
+      streamFailed(false),
+      localToneMapping(false),
+      showRawPixelValues(false),
+      tileCache(nullptr),
+      selectionChanged(false),
+      gpuColourConversion(options.gpuColourConversion),
+      decoderOptions(options.decoder),
+      frameSkipQueueDepth(options.decoder.lowLatency ? options.frameSkipQueueDepth : 0),
+      udpOptions(options.udp),
+      keyFrameRequests(options.keyFrameRequests),
+      decodeThreadSettings(options.decodeThread) {
   using namespace nanogui;
-  using namespace std::chrono_literals;
-  bool videoOk = videoClient->initialiseVideoStream(5s);
-
-  if (videoOk) {
-    // Allocate a buffer to store the decoded and converted images:
-    auto w = videoClient->getFrameWidth();
-    auto h = videoClient->getFrameHeight();
 
-    // Create the texture first because internally nanogui will create
-    // one with the preferred format and we need to know how to allcoate
-    // the buffers:
-    texture = new Texture(
-        Texture::PixelFormat::RGB,
-        Texture::ComponentFormat::UInt8,
-        Vector2i(w, h),
-        Texture::InterpolationMode::Trilinear,
-        Texture::InterpolationMode::Nearest);
-    const auto ch = texture->channels();
-    BOOST_LOG_TRIVIAL(trace) << "Created texture with "
-                             << texture->channels() << " channels, "
-                             << "data ptr: " << (void*)bgrBuffer.data();
-    if (!(ch == 3 || ch == 4)) {
+  if (!gpuColourConversion) {
+    // Internally nanogui may create RGB textures with a different number of
+    // channels (e.g. RGBA) so we need to find out how to allocate the buffers
+    // before any frames are decoded:
+    ref<Texture> probe = new Texture(Texture::PixelFormat::RGB, Texture::ComponentFormat::UInt8, Vector2i(1, 1));
+    rgbChannels = probe->channels();
+    BOOST_LOG_TRIVIAL(trace) << "RGB textures have " << rgbChannels << " channels.";
+    if (!(rgbChannels == 3 || rgbChannels == 4)) {
       throw std::logic_error("Texture returned has an unsupported number of texture channels.");
     }
+  }
 
-    bgrBuffer.resize(w * h * ch);
-    this->set_size(Vector2i(w, h));
-    this->set_layout(new GroupLayout(0));
-    imageView = new ImageView(this);
-
-    for (auto c = 0; c < bgrBuffer.size(); c += ch) {
-      bgrBuffer[c + 0] = 255;
-      bgrBuffer[c + 1] = 0;
-      bgrBuffer[c + 2] = 0;
-      if (ch == 4) {
-        bgrBuffer[c + 3] = 128;
-      }
-    }
+  // Window opens immediately with a placeholder: textures are created
+  // when the first frame arrives (see draw()):
+  this->set_size(placeholderSize);
+  this->set_layout(new GroupLayout(0));
+  statusLabel = new Label(this, "Waiting for video stream...");
+  imageView = new YuvImageView(this);
+  imageView->set_size(placeholderSize);
+  imageView->set_pixel_callback(
+      [this](const Vector2i& pos, char** out, size_t size) {
+        // The information provided by this callback is used to display
+        // pixel values at high magnification. The inspector's snapshot is
+        // only updated in draw() on this (the UI) thread so is consistent:
+        inspector.inspect(pos.x(), pos.y(), showRawPixelValues, out, size);
+      });
+  imageView->set_selection_callback([this](const Vector2i& topLeft, const Vector2i& size) {
+    selectedRegion = HdrTileCache::Region{topLeft.x(), topLeft.y(), size.x(), size.y()};
+    selectionChanged = true;
+  });
 
-    texture->upload(bgrBuffer.data());
+  attach(receiver, sender);
+}
 
-    imageView->set_size(Vector2i(w, h));
-    imageView->set_image(texture);
-    imageView->center();
-    imageView->set_pixel_callback(
-        [this](const Vector2i& pos, char** out, size_t size) {
-          // The information provided by this callback is used to
-          // display pixel values at high magnification:
-          auto w = videoClient->getFrameWidth();
-          if (showRawPixelValues && !rawBuffer.empty()) {
-            // If we have the raw HDR data available then use that
-            // for the pixel labels instead:
-            std::size_t index = (pos.x() + w * pos.y()) * 3;
-            for (int c = 0; c < 3; ++c) {
-              float value = rawBuffer[index + c];
-              snprintf(out[c], size, "%.2f", value);
-            }
-          } else {
-            std::size_t index = (pos.x() + w * pos.y()) * texture->channels();
-            for (int c = 0; c < texture->channels(); ++c) {
-              uint8_t value = bgrBuffer[index + c];
-              snprintf(out[c], size, "%i", (int)value);
-            }
-          }
-        });
+VideoPreviewWindow::~VideoPreviewWindow() {
+  stopDecodeThread();
+}
 
-    BOOST_LOG_TRIVIAL(info) << "Succesfully initialised video stream.";
-    startDecodeThread();
+void VideoPreviewWindow::detach() {
+  stopDecodeThread();
+  udpReceiver.reset();
+  videoClient.reset();
+}
 
+void VideoPreviewWindow::attach(PacketDemuxer& receiver, PacketMuxer& sender) {
+  detach();
+  if (udpOptions.enabled) {
+    // Frame timestamps still arrive over TCP:
+    videoClient = std::make_unique<VideoClient>(receiver, "", "frame_timestamp");
+    udpReceiver = std::make_unique<UdpVideoReceiver>(sender, udpOptions, [this](const ComPacket::ConstSharedPacket& packet) {
+      videoClient->enqueuePacket(packet);
+    });
   } else {
-    BOOST_LOG_TRIVIAL(warning) << "Failed to initialise video stream.";
+    videoClient = std::make_unique<VideoClient>(receiver, "render_preview", "frame_timestamp");
   }
-}
-
-VideoPreviewWindow::~VideoPreviewWindow() {
-  stopDecodeThread();
+  videoClient->setFrameSkipQueueDepth(frameSkipQueueDepth);
+  if (udpOptions.enabled || keyFrameRequests) {
+    videoClient->setKeyFrameRequest([&sender]() {
+      serialise(sender, "video_keyframe_request", true);
+    });
+  }
+  streamFailed = false;
+  runDecoderThread = true;
+  startDecodeThread();
 }
 
 void VideoPreviewWindow::startDecodeThread() {
-  // Thread just decodes video frames as fast as it can:
+  // Thread initialises the stream then just decodes
+  // video frames as fast as it can:
   videoDecodeThread.reset(new std::thread([&]() {
+    using namespace std::chrono_literals;
+    applyToCurrentThread(decodeThreadSettings);
     BOOST_LOG_TRIVIAL(debug) << "Video decode thread launched.";
     if (videoClient == nullptr) {
       BOOST_LOG_TRIVIAL(debug) << "Video client must be initialised before decoding.";
       throw std::logic_error("No VideoClient object available.");
     }
 
+    bool videoOk = videoClient->initialiseVideoStream(5s, decoderOptions);
+    if (!videoOk) {
+      BOOST_LOG_TRIVIAL(warning) << "Failed to initialise video stream.";
+      streamFailed = true;
+      return;
+    }
+    BOOST_LOG_TRIVIAL(info) << "Succesfully initialised video stream.";
+
     while (runDecoderThread) {
       decodeVideoFrame();
+      if (videoClient->streamLost()) {
+        BOOST_LOG_TRIVIAL(warning) << "Video stream lost.";
+        streamFailed = true;
+        return;
+      }
     }
   }));
 }
@@ -128,47 +171,217 @@ void VideoPreviewWindow::stopDecodeThread() {
 
 /// Decode a video frame into the buffer.
 void VideoPreviewWindow::decodeVideoFrame() {
-  newFrameDecoded = videoClient->receiveVideoFrame(
-      [this](LibAvCapture& stream) {
+  bool newFrameDecoded = videoClient->receiveVideoFrame(
+      [this](VideoDecoder& stream) {
         BOOST_LOG_TRIVIAL(debug) << "Decoded video frame";
-        auto w = stream.GetFrameWidth();
-        auto h = stream.GetFrameHeight();
-        if (texture != nullptr) {
-          // Extract decoded data to the buffer:
-          std::lock_guard<std::mutex> lock(bufferMutex);
-          if (texture->channels() == 3) {
-            stream.ExtractRgbImage(bgrBuffer.data(), w * texture->channels());
-          } else if (texture->channels() == 4) {
-            stream.ExtractRgbaImage(bgrBuffer.data(), w * texture->channels());
-          } else {
-            throw std::runtime_error("Unsupported number of texture channels");
-          }
+        // Extract decoded data to the buffer we own then hand it to the UI
+        // thread. The write buffer belongs to this thread so it can be resized
+        // freely (this is a no-op unless the stream dimensions change):
+        auto& frame = frameBuffers.writeBuffer();
+        frame.extract(stream, gpuColourConversion, rgbChannels);
+        frame.serverTimeMicros = videoClient->getFrameServerTimeMicros();
+        frame.timing = videoClient->getFrameTiming();
+        frame.timing.converted = FrameTiming::Clock::now();
+        frameBuffers.publish();
+        if (onFrameReady) {
+          onFrameReady();
         }
       });
 
   if (newFrameDecoded) {
     double bps = videoClient->computeVideoBandwidthConsumed();
     auto imbps = bps / (1024.0 * 1024.0);
-    mbps = (0.9f * mbps) + (.1f * imbps);
+    const double filteredMbps = (0.9f * mbps.load(std::memory_order_relaxed)) + (.1f * imbps);
+    mbps.store(filteredMbps, std::memory_order_relaxed);
     BOOST_LOG_TRIVIAL(trace) << "Video bit-rate instantaneous: " << imbps << " Mbps" << std::endl;
-    BOOST_LOG_TRIVIAL(debug) << "Video bit-rate filtered: " << mbps << " Mbps" << std::endl;
+    BOOST_LOG_TRIVIAL(debug) << "Video bit-rate filtered: " << filteredMbps << " Mbps" << std::endl;
 
-    // Calculate instantaneous frame rate:
+    // Calculate instantaneous frame rate (intervals can be well under a
+    // millisecond when catching up so do not truncate them):
     auto newFrameTime = std::chrono::steady_clock::now();
-    auto ifps = 1000.0 / std::chrono::duration_cast<std::chrono::milliseconds>(newFrameTime - m_lastFrameTime).count();
-    fps = (0.9f * fps) + (.1f * ifps);
+    const double interval = std::chrono::duration<double>(newFrameTime - m_lastFrameTime).count();
+    auto ifps = interval > 0.0 ? 1.0 / interval : 0.0;
+    const double filteredFps = (0.9f * fps.load(std::memory_order_relaxed)) + (.1f * ifps);
+    fps.store(filteredFps, std::memory_order_relaxed);
     BOOST_LOG_TRIVIAL(trace) << "Frame rate instantaneous: " << ifps << " Fps" << std::endl;
-    BOOST_LOG_TRIVIAL(debug) << "Frame rate filtered: " << fps << " Fps" << std::endl;
+    BOOST_LOG_TRIVIAL(debug) << "Frame rate filtered: " << filteredFps << " Fps" << std::endl;
     m_lastFrameTime = newFrameTime;
+
+    const double idecodeMs = videoClient->getDecodeTimeMicros() / 1000.0;
+    decodeMs.store((0.9 * decodeMs.load(std::memory_order_relaxed)) + (0.1 * idecodeMs), std::memory_order_relaxed);
+    BOOST_LOG_TRIVIAL(trace) << "Decode time instantaneous: " << idecodeMs << " ms" << std::endl;
   }
 }
 
+/// Create (or re-create) the textures for frames of the given size.
+/// Must be called on the UI thread.
+void VideoPreviewWindow::createTextures(const nanogui::Vector2i& size, bool yuv) {
+  using namespace nanogui;
+  if (yuv) {
+    imageView->set_yuv_size(size);
+  } else {
+    texture = new Texture(
+        Texture::PixelFormat::RGB,
+        Texture::ComponentFormat::UInt8,
+        size,
+        Texture::InterpolationMode::Trilinear,
+        Texture::InterpolationMode::Nearest);
+    imageView->set_image(texture);
+  }
+  BOOST_LOG_TRIVIAL(debug) << "Created " << (yuv ? "YUV" : "RGB") << " preview textures: "
+                           << size.x() << "x" << size.y();
+
+  if (displayedSize.x() > 0) {
+    // The server changed resolution mid-stream (e.g. to reduce bit-rate):
+    // keep the window and the view's zoom/pan so the image stays put on
+    // screen rather than the window jumping to the new size:
+    const float scale = imageView->scale() * float(displayedSize.x()) / size.x();
+    imageView->set_scale(scale);
+    displayedSize = size;
+    return;
+  }
+
+  displayedSize = size;
+  statusLabel->set_visible(false);
+  this->set_size(size);
+  imageView->set_size(size);
+  screen()->perform_layout();
+  imageView->center();
+}
+
 void VideoPreviewWindow::draw(NVGcontext* ctx) {
-  // Upload latest buffer contents to video texture:
-  if (texture != nullptr) {
-    std::lock_guard<std::mutex> lock(bufferMutex);
-    texture->upload(bgrBuffer.data());
+  // Pick up the latest raw image once per frame (the pixel callback
+  // runs on this thread so can then use it without atomics):
+  rawImage = std::atomic_load(&pendingRawImage);
+  if (localToneMapping && rawImage && rawImage != toneMappedImage) {
+    // Float data is only uploaded when a new HDR image arrives: tone-mapping
+    // changes just update shader uniforms:
+    imageView->set_hdr_image(rawImage->pixels.data(), nanogui::Vector2i(rawImage->width, rawImage->height));
+    toneMappedImage = rawImage;
+  }
+  inspector.setRawImage(rawImage);
+
+  // Upload the latest frame to the video texture(s) (only if a new one was published):
+  if (frameBuffers.consume()) {
+    const auto& frame = frameBuffers.readBuffer();
+    inspector.setFrame(frame);
+    uploadedTiming = frame.timing;
+    uploadedTiming.uploadStart = FrameTiming::Clock::now();
+    if (frame.serverTimeMicros >= 0) {
+      using namespace std::chrono;
+      const auto nowMicros = duration_cast<microseconds>(system_clock::now().time_since_epoch()).count();
+      const double ilatency = (nowMicros - frame.serverTimeMicros) / 1000.0;
+      const double previous = latencyMs.load(std::memory_order_relaxed);
+      latencyMs.store(previous < 0.0 ? ilatency : (0.9 * previous) + (0.1 * ilatency), std::memory_order_relaxed);
+      BOOST_LOG_TRIVIAL(trace) << "Frame latency instantaneous: " << ilatency << " ms" << std::endl;
+    }
+
+    const nanogui::Vector2i frameSize(frame.width, frame.height);
+    if (frameSize != displayedSize) {
+      createTextures(frameSize, frame.yuv);
+    }
+
+    if (frame.yuv) {
+      imageView->upload_yuv(frame.yPlane(), frame.uPlane(), frame.vPlane());
+      imageView->set_yuv_coefficients(frame.coefficients);
+    } else {
+      texture->upload(frame.pixels.data());
+    }
+    uploadedTiming.uploaded = FrameTiming::Clock::now();
+    newUploadedTiming = true;
+    uploadedServerTimeMicros = frame.serverTimeMicros;
+    uploadedFrameCount += 1;
+  }
+
+  if (showRawPixelValues && tileCache && requestRegion) {
+    updateRegionRequest();
+  }
+
+  if (regionStatsCallback && (selectionChanged || (selectedRegion.width > 0 && rawImage != regionStatsImage))) {
+    updateRegionStats();
+  }
+
+  if (streamFailed && statusLabel->visible()) {
+    statusLabel->set_caption("Failed to initialise video stream.");
   }
 
   nanogui::Window::draw(ctx);
 }
+
+void VideoPreviewWindow::setLocalToneMapping(bool enabled) {
+  localToneMapping = enabled;
+  imageView->set_hdr_enabled(enabled);
+  if (!enabled) {
+    // Upload the latest image again when next enabled:
+    toneMappedImage.reset();
+  }
+}
+
+bool VideoPreviewWindow::takeUploadedTiming(FrameTiming& timing) {
+  if (!newUploadedTiming) {
+    return false;
+  }
+  timing = uploadedTiming;
+  newUploadedTiming = false;
+  return true;
+}
+
+void VideoPreviewWindow::updateRegionRequest() {
+  if (displayedSize.x() == 0 || displayedSize.y() == 0) {
+    return;
+  }
+
+  // Visible part of the image in pixels:
+  const auto topLeft = imageView->pos_to_pixel(nanogui::Vector2f(0.f, 0.f));
+  const auto bottomRight = imageView->pos_to_pixel(nanogui::Vector2f(imageView->size()));
+  const int x0 = std::max(0, int(std::floor(topLeft.x())));
+  const int y0 = std::max(0, int(std::floor(topLeft.y())));
+  const int x1 = std::min(displayedSize.x(), int(std::ceil(bottomRight.x())));
+  const int y1 = std::min(displayedSize.y(), int(std::ceil(bottomRight.y())));
+  const HdrTileCache::Region region{x0, y0, x1 - x0, y1 - y0};
+  if (region.width <= 0 || region.height <= 0 || region.width * region.height > maxRegionPixels) {
+    return;
+  }
+
+  // Zoomed in far enough for pixel values to be shown so let the inspector
+  // use the tiles cached now:
+  inspector.setTiles(tileCache->snapshot());
+
+  if (tileCache->covers(region)) {
+    return;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  const auto sinceLast = now - lastRequestTime;
+  if (sinceLast < minRegionRequestInterval ||
+      (region == lastRequestedRegion && sinceLast < regionRequestTimeout)) {
+    return;
+  }
+
+  BOOST_LOG_TRIVIAL(trace) << "Requesting HDR region: " << region.width << "x" << region.height
+                           << " at (" << region.x << ", " << region.y << ")";
+  requestRegion(region);
+  lastRequestedRegion = region;
+  lastRequestTime = now;
+}
+
+void VideoPreviewWindow::updateRegionStats() {
+  selectionChanged = false;
+  regionStatsImage = rawImage;
+  if (selectedRegion.width <= 0 || selectedRegion.height <= 0 || !rawImage || displayedSize.x() == 0) {
+    RegionStats empty;
+    empty.region = selectedRegion;
+    regionStatsCallback(empty);
+    return;
+  }
+
+  // The raw image may be at a different resolution to the video:
+  const float sx = float(rawImage->width) / displayedSize.x();
+  const float sy = float(rawImage->height) / displayedSize.y();
+  const int x0 = int(std::floor(selectedRegion.x * sx));
+  const int y0 = int(std::floor(selectedRegion.y * sy));
+  const int x1 = int(std::ceil((selectedRegion.x + selectedRegion.width) * sx));
+  const int y1 = int(std::ceil((selectedRegion.y + selectedRegion.height) * sy));
+  const HdrTileCache::Region rawRegion{x0, y0, x1 - x0, y1 - y0};
+  regionStatsCallback(computeRegionStats(rawImage->pixels.data(), rawImage->width, rawImage->height, rawRegion));
+}
@@ -4,34 +4,146 @@
 
 #include <nanogui/nanogui.h>
 
+#include <atomic>
+
+#include "DecodedVideoFrame.hpp"
+#include "HdrImageReceiver.hpp"
+#include "HdrTileCache.hpp"
+#include "PixelInspector.hpp"
+#include "ThreadSettings.hpp"
+#include "TripleBuffer.hpp"
+#include "UdpVideoReceiver.hpp"
 #include "VideoClient.hpp"
+#include "custom_widgets/yuv_image_view.hpp"
+
+/// Options that control how the preview stream is decoded and displayed.
+struct VideoPreviewOptions {
+  /// Upload the decoder's YUV planes and convert them to RGB in a
+  /// shader (otherwise frames are converted to RGB on the CPU).
+  bool gpuColourConversion = true;
+  /// Options passed on to the video decoder.
+  VideoDecoderOptions decoder;
+  /// In low-latency mode skip non-reference frames while more than
+  /// this many compressed packets are waiting to be decoded.
+  std::size_t frameSkipQueueDepth = 16;
+  /// Receive the video over UDP instead of the TCP connection.
+  UdpVideoOptions udp;
+  /// Ask the server for a key-frame (video_keyframe_request) after
+  /// compressed video had to be dropped. Always done over UDP (which
+  /// needs the server to support it anyway).
+  bool keyFrameRequests = false;
+  /// Called on the decode thread each time a new frame is ready for
+  /// display (e.g. to wake an event-driven UI loop).
+  std::function<void()> frameReady;
+  /// Applied to the decode thread (and inherited by any decoder threads).
+  ThreadSettings decodeThread{"rui-decode"};
+};
 
 /// Window that receives an encoded video stream and displays
 /// it in a nanogui::ImageView that allows panning and zooming
 /// of the image. Video is decoded in a separate thread to keep
 /// the UI widgets responsive (although their effect will be
-/// limited by the video rate).
+/// limited by the video rate). Decoded frames are handed to the
+/// UI thread through a lock-free triple buffer so neither thread
+/// blocks the other. The window opens straight away: the stream is
+/// initialised on the decode thread and textures are created when the
+/// first frame (or a frame with new dimensions) arrives.
 class VideoPreviewWindow : public nanogui::Window {
 public:
-  VideoPreviewWindow(nanogui::Screen* screen, const std::string& title, PacketDemuxer& receiver);
+  /// The stream is received from receiver (or over UDP in which case
+  /// sender is used to set it up).
+  VideoPreviewWindow(nanogui::Screen* screen, const std::string& title,
+                     PacketDemuxer& receiver, PacketMuxer& sender,
+                     const VideoPreviewOptions& options);
 
   virtual ~VideoPreviewWindow();
 
   virtual void draw(NVGcontext* ctx);
 
-  double getVideoBandwidthMbps() { return mbps; }
-  double getFrameRate() { return fps; }
+  double getVideoBandwidthMbps() const { return mbps.load(std::memory_order_relaxed); }
+  double getFrameRate() const { return fps.load(std::memory_order_relaxed); }
+  /// Filtered time from the server encoding a frame to it being
+  /// displayed here (or a negative value if not measured).
+  double getLatencyMs() const { return latencyMs.load(std::memory_order_relaxed); }
+  /// Filtered time taken to decode each frame (excluding waiting for data).
+  double getDecodeTimeMs() const { return decodeMs.load(std::memory_order_relaxed); }
+  /// Number of compressed video packets waiting to be decoded.
+  std::size_t getQueueDepth() const { return videoClient ? videoClient->getQueueDepth() : 0; }
+  /// Total video packets dropped because the decode queue was full.
+  std::uint64_t getDroppedPacketCount() const { return videoClient ? videoClient->getDroppedPacketCount() : 0; }
+  /// Size of the video frames being displayed (zero until the first frame).
+  const nanogui::Vector2i& getVideoSize() const { return displayedSize; }
+
+  /// True if the stream failed to initialise or stopped delivering data
+  /// (which usually means the connection to the server was lost).
+  bool streamLost() const { return streamFailed; }
+
+  /// Stop decoding and release the stream's subscriptions (e.g. before the
+  /// demuxer is destroyed). The last frame remains on display.
+  void detach();
 
-  void reset() { imageView->reset(); }
+  /// Get the timing of the frame uploaded during the last draw() (if a
+  /// new one was). The caller fills in the presentation time.
+  /// @return false if no new frame was uploaded since the last call.
+  bool takeUploadedTiming(FrameTiming& timing);
+
+  /// Number of frames uploaded for display so far.
+  std::uint64_t getUploadedFrameCount() const { return uploadedFrameCount; }
+  /// Time at which the last frame uploaded was received.
+  FrameTiming::Clock::time_point getUploadedReceiveTime() const { return uploadedTiming.received; }
+  /// Time at which the last frame was uploaded (by the draw that first shows it).
+  FrameTiming::Clock::time_point getUploadedTime() const { return uploadedTiming.uploaded; }
+  /// Server time (microseconds since epoch) at which the last frame
+  /// uploaded was encoded or -1 if the server does not send timestamps.
+  std::int64_t getUploadedServerTimeMicros() const { return uploadedServerTimeMicros; }
+
+  /// Start receiving a new stream (e.g. after a reconnect). Textures
+  /// are re-created if the new stream's dimensions differ.
+  void attach(PacketDemuxer& receiver, PacketMuxer& sender);
+
+  void reset() {
+    if (imageView) {
+      imageView->reset();
+    }
+  }
 
-  void setRawBufferData(std::vector<float>& buffer) {
-    rawBuffer = buffer;
+  /// Set the raw HDR image used for pixel values on zoom.
+  /// Safe to call from any thread: the image is shared, not copied.
+  void setRawImage(const HdrImageReceiver::ImagePtr& image) {
+    std::atomic_store(&pendingRawImage, image);
   }
 
   void displayRawValues(bool displayRaw) {
     showRawPixelValues = displayRaw;
   }
 
+  /// Display the latest raw HDR image (tone-mapped locally on the GPU)
+  /// instead of the video stream whenever one is available.
+  void setLocalToneMapping(bool enabled);
+  /// True if local tone-mapping is enabled and an HDR image is on display.
+  bool localToneMappingActive() const { return imageView && imageView->hdr_mode(); }
+  /// Exposure and gamma applied by local tone-mapping.
+  void setToneMapping(float exposure, float gamma) { imageView->set_hdr_tone_map(exposure, gamma); }
+  void setHdrOverlay(YuvImageView::HdrOverlay overlay) { imageView->set_hdr_overlay(overlay); }
+
+  using RegionRequestFunction = std::function<void(const HdrTileCache::Region&)>;
+
+  /// While raw values are displayed at high zoom, request full precision
+  /// tiles for the visible region (by calling request) and use those from
+  /// the cache for pixel values in preference to the full raw image.
+  void setHdrTileSource(HdrTileCache* cache, RegionRequestFunction request) {
+    tileCache = cache;
+    requestRegion = request;
+  }
+
+  using RegionStatsFunction = std::function<void(const RegionStats&)>;
+
+  /// Set a function to be called (on the UI thread) with the statistics
+  /// of the raw HDR values in the region selected by shift-dragging over
+  /// the preview. It is called again whenever a new raw image arrives
+  /// and with an empty region when the selection is cleared.
+  void setRegionStatsCallback(RegionStatsFunction callback) { regionStatsCallback = callback; }
+
 protected:
   void startDecodeThread();
 
@@ -40,19 +152,58 @@ protected:
   /// Decode a video frame into the buffer.
   void decodeVideoFrame();
 
+  /// Create (or re-create) the textures for frames of the given size.
+  void createTextures(const nanogui::Vector2i& size, bool yuv);
+
+  /// Request HDR tiles for the visible region if the cache does not cover it.
+  void updateRegionRequest();
+
+  /// Recompute the selected region's statistics from the raw image.
+  void updateRegionStats();
+
 private:
   std::unique_ptr<VideoClient> videoClient;
-  std::vector<std::uint8_t> bgrBuffer;
-  std::vector<float> rawBuffer;
+  std::unique_ptr<UdpVideoReceiver> udpReceiver;
+  TripleBuffer<DecodedVideoFrame> frameBuffers;
+  const std::function<void()> onFrameReady;
+  HdrImageReceiver::ImagePtr pendingRawImage; // Only accessed atomically.
+  HdrImageReceiver::ImagePtr rawImage;        // Only accessed on the UI thread.
+  HdrImageReceiver::ImagePtr toneMappedImage; // Last raw image uploaded for local tone-mapping.
+  HdrImageReceiver::ImagePtr regionStatsImage; // Raw image the region statistics were computed from.
+  PixelInspector inspector;
   nanogui::Texture* texture;
-  nanogui::ImageView* imageView;
-  double mbps;
+  YuvImageView* imageView;
+  nanogui::Label* statusLabel;
+  nanogui::Vector2i displayedSize;
+  int rgbChannels;
+  // Filtered stream statistics. Updated on the decode thread (latency on
+  // the UI thread) and read from any thread:
+  std::atomic<double> mbps;
   std::chrono::steady_clock::time_point m_lastFrameTime;
-  double fps;
+  std::atomic<double> fps;
+  std::atomic<double> latencyMs;
+  std::atomic<double> decodeMs;
+  FrameTiming uploadedTiming;
+  bool newUploadedTiming;
+  std::uint64_t uploadedFrameCount;
+  std::int64_t uploadedServerTimeMicros;
 
   std::unique_ptr<std::thread> videoDecodeThread;
-  std::mutex bufferMutex;
-  std::atomic<bool> newFrameDecoded;
   std::atomic<bool> runDecoderThread;
+  std::atomic<bool> streamFailed;
+  bool localToneMapping;
   bool showRawPixelValues;
+  HdrTileCache* tileCache;
+  RegionRequestFunction requestRegion;
+  HdrTileCache::Region lastRequestedRegion;
+  std::chrono::steady_clock::time_point lastRequestTime;
+  RegionStatsFunction regionStatsCallback;
+  HdrTileCache::Region selectedRegion; // In video frame pixels.
+  bool selectionChanged;
+  const bool gpuColourConversion;
+  const VideoDecoderOptions decoderOptions;
+  const std::size_t frameSkipQueueDepth;
+  const UdpVideoOptions udpOptions;
+  const bool keyFrameRequests;
+  const ThreadSettings decodeThreadSettings;
 };
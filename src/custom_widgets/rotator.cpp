@@ -113,6 +113,9 @@ bool Rotator::mouse_button_event(const Vector2i &p, int button, bool down,
     m_drag_region = adjust_position(p);
     return m_drag_region != None;
   } else {
+    if (m_drag_region != None && m_final_callback) {
+      m_final_callback(m_angle);
+    }
     m_drag_region = None;
     return true;
   }
@@ -149,7 +152,7 @@ Rotator::Region Rotator::adjust_position(const Vector2i &p, Region considered_re
       }
       m_value /= 2 * NVG_PI;
 
-      auto m_angle = std::atan2(y, x);
+      m_angle = std::atan2(y, x);
       // Convert angle to range [0..2Pi):
       if (m_angle < 0) {
         m_angle += 2 * NVG_PI;
@@ -34,6 +34,12 @@ public:
     /// Sets the callback to execute when a user changes the Rotator value.
     void set_callback(const std::function<void(float)> &callback) { m_callback = callback; }
 
+    /// The callback to execute when the user releases the Rotator.
+    std::function<void(float)> final_callback() const { return m_final_callback; }
+
+    /// Sets the callback to execute when the user releases the Rotator.
+    void set_final_callback(const std::function<void(float)> &callback) { m_final_callback = callback; }
+
     float value() const;
 
     void set_value(float value);
@@ -72,4 +78,7 @@ protected:
 
     /// The current callback to execute when the value changes.
     std::function<void(float)> m_callback;
+
+    /// The callback to execute when the user releases the Rotator.
+    std::function<void(float)> m_final_callback;
 };
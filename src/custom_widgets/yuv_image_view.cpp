@@ -0,0 +1,398 @@
+/*
+    NanoGUI was developed by Wenzel Jakob <wenzel.jakob@epfl.ch>.
+    The widget drawing code is based on the NanoVG demo application
+    by Mikko Mononen.
+
+    All rights reserved. Use of this source code is governed by a
+    BSD-style license that can be found in the LICENSE.txt file.
+*/
+
+#include <nanogui/screen.h>
+#include <nanogui/opengl.h>
+#include <GLFW/glfw3.h>
+
+#include "yuv_image_view.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace nanogui;
+
+namespace {
+
+#if defined(NANOGUI_USE_OPENGL)
+const char* yuv_vertex_shader = R"(#version 330
+  uniform vec4 image_rect;
+  in vec2 position;
+  out vec2 uv;
+  void main() {
+    uv = position;
+    gl_Position = vec4(mix(image_rect.xy, image_rect.zw, position), 0.0, 1.0);
+  })";
+
+const char* yuv_fragment_shader = R"(#version 330
+  uniform sampler2D y_plane;
+  uniform sampler2D u_plane;
+  uniform sampler2D v_plane;
+  uniform vec4 r_coeffs;
+  uniform vec4 g_coeffs;
+  uniform vec4 b_coeffs;
+  in vec2 uv;
+  out vec4 color;
+  void main() {
+    vec4 yuv = vec4(texture(y_plane, uv).r, texture(u_plane, uv).r, texture(v_plane, uv).r, 1.0);
+    vec3 rgb = vec3(dot(r_coeffs, yuv), dot(g_coeffs, yuv), dot(b_coeffs, yuv));
+    color = vec4(clamp(rgb, 0.0, 1.0), 1.0);
+  })";
+
+// The HDR shader shares the vertex shader. Overlay: 0 none, 1 clipping, 2 false colour.
+const char* hdr_fragment_shader = R"(#version 330
+  uniform sampler2D hdr_image;
+  uniform float exposure_scale;
+  uniform float inv_gamma;
+  uniform float overlay;
+  in vec2 uv;
+  out vec4 color;
+  vec3 false_colour(float t) {
+    return clamp(vec3(1.5 - abs(4.0 * t - 3.0), 1.5 - abs(4.0 * t - 2.0), 1.5 - abs(4.0 * t - 1.0)), 0.0, 1.0);
+  }
+  void main() {
+    vec3 hdr = max(texture(hdr_image, uv).rgb * exposure_scale, vec3(0.0));
+    if (overlay > 1.5) {
+      float luminance = dot(hdr, vec3(0.2126, 0.7152, 0.0722));
+      color = vec4(false_colour(clamp((log2(max(luminance, 1e-6)) + 8.0) / 12.0, 0.0, 1.0)), 1.0);
+      return;
+    }
+    vec3 ldr = pow(hdr, vec3(inv_gamma));
+    if (overlay > 0.5) {
+      if (any(greaterThanEqual(ldr, vec3(1.0)))) {
+        ldr = vec3(1.0, 0.0, 1.0);
+      } else if (all(lessThan(ldr, vec3(1.0 / 255.0)))) {
+        ldr = vec3(0.0, 0.0, 1.0);
+      }
+    }
+    color = vec4(clamp(ldr, 0.0, 1.0), 1.0);
+  })";
+#elif defined(NANOGUI_USE_GLES)
+const char* yuv_vertex_shader = R"(#version 100
+  precision highp float;
+  uniform vec4 image_rect;
+  attribute vec2 position;
+  varying vec2 uv;
+  void main() {
+    uv = position;
+    gl_Position = vec4(mix(image_rect.xy, image_rect.zw, position), 0.0, 1.0);
+  })";
+
+const char* yuv_fragment_shader = R"(#version 100
+  precision highp float;
+  uniform sampler2D y_plane;
+  uniform sampler2D u_plane;
+  uniform sampler2D v_plane;
+  uniform vec4 r_coeffs;
+  uniform vec4 g_coeffs;
+  uniform vec4 b_coeffs;
+  varying vec2 uv;
+  void main() {
+    vec4 yuv = vec4(texture2D(y_plane, uv).r, texture2D(u_plane, uv).r, texture2D(v_plane, uv).r, 1.0);
+    vec3 rgb = vec3(dot(r_coeffs, yuv), dot(g_coeffs, yuv), dot(b_coeffs, yuv));
+    gl_FragColor = vec4(clamp(rgb, 0.0, 1.0), 1.0);
+  })";
+
+const char* hdr_fragment_shader = R"(#version 100
+  precision highp float;
+  uniform sampler2D hdr_image;
+  uniform float exposure_scale;
+  uniform float inv_gamma;
+  uniform float overlay;
+  varying vec2 uv;
+  vec3 false_colour(float t) {
+    return clamp(vec3(1.5 - abs(4.0 * t - 3.0), 1.5 - abs(4.0 * t - 2.0), 1.5 - abs(4.0 * t - 1.0)), 0.0, 1.0);
+  }
+  void main() {
+    vec3 hdr = max(texture2D(hdr_image, uv).rgb * exposure_scale, vec3(0.0));
+    if (overlay > 1.5) {
+      float luminance = dot(hdr, vec3(0.2126, 0.7152, 0.0722));
+      gl_FragColor = vec4(false_colour(clamp((log2(max(luminance, 1e-6)) + 8.0) / 12.0, 0.0, 1.0)), 1.0);
+      return;
+    }
+    vec3 ldr = pow(hdr, vec3(inv_gamma));
+    if (overlay > 0.5) {
+      if (any(greaterThanEqual(ldr, vec3(1.0)))) {
+        ldr = vec3(1.0, 0.0, 1.0);
+      } else if (all(lessThan(ldr, vec3(1.0 / 255.0)))) {
+        ldr = vec3(0.0, 0.0, 1.0);
+      }
+    }
+    gl_FragColor = vec4(clamp(ldr, 0.0, 1.0), 1.0);
+  })";
+#elif defined(NANOGUI_USE_METAL)
+const char* yuv_vertex_shader = R"(using namespace metal;
+  struct VertexOut {
+    float4 position [[position]];
+    float2 uv;
+  };
+
+  vertex VertexOut vertex_main(const device float2 *position,
+                               constant float4 &image_rect,
+                               uint id [[vertex_id]]) {
+    VertexOut vert;
+    vert.uv = position[id];
+    vert.position = float4(mix(image_rect.xy, image_rect.zw, position[id]), 0.f, 1.f);
+    return vert;
+  })";
+
+const char* yuv_fragment_shader = R"(using namespace metal;
+  struct VertexOut {
+    float4 position [[position]];
+    float2 uv;
+  };
+
+  fragment float4 fragment_main(VertexOut vert [[stage_in]],
+                                texture2d<float, access::sample> y_plane,
+                                sampler y_plane_sampler,
+                                texture2d<float, access::sample> u_plane,
+                                sampler u_plane_sampler,
+                                texture2d<float, access::sample> v_plane,
+                                sampler v_plane_sampler,
+                                constant float4 &r_coeffs,
+                                constant float4 &g_coeffs,
+                                constant float4 &b_coeffs) {
+    float4 yuv = float4(y_plane.sample(y_plane_sampler, vert.uv).r,
+                        u_plane.sample(u_plane_sampler, vert.uv).r,
+                        v_plane.sample(v_plane_sampler, vert.uv).r, 1.f);
+    float3 rgb = float3(dot(r_coeffs, yuv), dot(g_coeffs, yuv), dot(b_coeffs, yuv));
+    return float4(clamp(rgb, 0.f, 1.f), 1.f);
+  })";
+
+const char* hdr_fragment_shader = R"(using namespace metal;
+  struct VertexOut {
+    float4 position [[position]];
+    float2 uv;
+  };
+
+  float3 false_colour(float t) {
+    return clamp(float3(1.5 - abs(4.0 * t - 3.0), 1.5 - abs(4.0 * t - 2.0), 1.5 - abs(4.0 * t - 1.0)), 0.0, 1.0);
+  }
+
+  fragment float4 fragment_main(VertexOut vert [[stage_in]],
+                                texture2d<float, access::sample> hdr_image,
+                                sampler hdr_image_sampler,
+                                constant float &exposure_scale,
+                                constant float &inv_gamma,
+                                constant float &overlay) {
+    float3 hdr = max(hdr_image.sample(hdr_image_sampler, vert.uv).rgb * exposure_scale, float3(0.f));
+    if (overlay > 1.5f) {
+      float luminance = dot(hdr, float3(0.2126f, 0.7152f, 0.0722f));
+      return float4(false_colour(clamp((log2(max(luminance, 1e-6f)) + 8.f) / 12.f, 0.f, 1.f)), 1.f);
+    }
+    float3 ldr = pow(hdr, float3(inv_gamma));
+    if (overlay > 0.5f) {
+      if (any(ldr >= float3(1.f))) {
+        ldr = float3(1.f, 0.f, 1.f);
+      } else if (all(ldr < float3(1.f / 255.f))) {
+        ldr = float3(0.f, 0.f, 1.f);
+      }
+    }
+    return float4(clamp(ldr, 0.f, 1.f), 1.f);
+  })";
+#endif
+
+Vector4f to_vector(const float (&c)[4]) {
+  return Vector4f(c[0], c[1], c[2], c[3]);
+}
+
+} // end anonymous namespace
+
+YuvImageView::YuvImageView(Widget *parent)
+  : ImageView(parent),
+    m_coefficients{{1.f, 0.f, 0.f, 0.f}, {1.f, 0.f, 0.f, 0.f}, {1.f, 0.f, 0.f, 0.f}},
+    m_hdr_enabled(false),
+    m_exposure_scale(1.f),
+    m_inv_gamma(1.f),
+    m_hdr_overlay(HdrOverlay::None),
+    m_selecting(false),
+    m_has_selection(false) {}
+
+void YuvImageView::set_yuv_size(const Vector2i &size) {
+  const Vector2i chroma_size((size.x() + 1) / 2, (size.y() + 1) / 2);
+
+  // Luma is sampled with nearest filtering at high magnification so
+  // individual pixels can be inspected (as for the RGB texture):
+  m_y_plane = new Texture(Texture::PixelFormat::R, Texture::ComponentFormat::UInt8, size,
+                          Texture::InterpolationMode::Bilinear,
+                          Texture::InterpolationMode::Nearest);
+  m_u_plane = new Texture(Texture::PixelFormat::R, Texture::ComponentFormat::UInt8, chroma_size,
+                          Texture::InterpolationMode::Bilinear,
+                          Texture::InterpolationMode::Bilinear);
+  m_v_plane = new Texture(Texture::PixelFormat::R, Texture::ComponentFormat::UInt8, chroma_size,
+                          Texture::InterpolationMode::Bilinear,
+                          Texture::InterpolationMode::Bilinear);
+
+  if (!m_yuv_shader) {
+    m_yuv_shader = new Shader(render_pass(), "yuv_image_view", yuv_vertex_shader, yuv_fragment_shader);
+    const float positions[] = {0.f, 0.f, 1.f, 0.f, 0.f, 1.f,
+                               1.f, 0.f, 1.f, 1.f, 0.f, 1.f};
+    m_yuv_shader->set_buffer("position", VariableType::Float32, {6, 2}, positions);
+  }
+  m_yuv_shader->set_texture("y_plane", m_y_plane);
+  m_yuv_shader->set_texture("u_plane", m_u_plane);
+  m_yuv_shader->set_texture("v_plane", m_v_plane);
+
+  set_image(m_y_plane);
+}
+
+void YuvImageView::upload_yuv(const uint8_t *y, const uint8_t *u, const uint8_t *v) {
+  m_y_plane->upload(y);
+  m_u_plane->upload(u);
+  m_v_plane->upload(v);
+}
+
+void YuvImageView::set_yuv_coefficients(const YuvToRgbCoefficients &coefficients) {
+  m_coefficients = coefficients;
+}
+
+void YuvImageView::set_hdr_image(const float *rgb, const Vector2i &size) {
+  if (!m_hdr_image || m_hdr_image->size() != size) {
+    m_hdr_image = new Texture(Texture::PixelFormat::RGB, Texture::ComponentFormat::Float32, size,
+                              Texture::InterpolationMode::Bilinear,
+                              Texture::InterpolationMode::Nearest);
+  }
+  if (!m_hdr_shader) {
+    m_hdr_shader = new Shader(render_pass(), "hdr_image_view", yuv_vertex_shader, hdr_fragment_shader);
+    const float positions[] = {0.f, 0.f, 1.f, 0.f, 0.f, 1.f,
+                               1.f, 0.f, 1.f, 1.f, 0.f, 1.f};
+    m_hdr_shader->set_buffer("position", VariableType::Float32, {6, 2}, positions);
+  }
+  m_hdr_shader->set_texture("hdr_image", m_hdr_image);
+
+  // Some backends have no 3 channel float format so textures may be RGBA:
+  if (m_hdr_image->channels() == 4) {
+    const size_t count = size_t(size.x()) * size.y();
+    m_hdr_rgba.resize(count * 4);
+    for (size_t i = 0; i < count; ++i) {
+      m_hdr_rgba[4 * i] = rgb[3 * i];
+      m_hdr_rgba[4 * i + 1] = rgb[3 * i + 1];
+      m_hdr_rgba[4 * i + 2] = rgb[3 * i + 2];
+      m_hdr_rgba[4 * i + 3] = 1.f;
+    }
+    rgb = m_hdr_rgba.data();
+  }
+  m_hdr_image->upload(reinterpret_cast<const uint8_t *>(rgb));
+}
+
+void YuvImageView::set_hdr_tone_map(float exposure, float gamma) {
+  m_exposure_scale = std::exp2(exposure);
+  m_inv_gamma = 1.f / std::max(gamma, 0.01f);
+}
+
+Vector4f YuvImageView::image_rect(const Vector2i &image_size) const {
+  // Work out where the image lies in the canvas's framebuffer (the
+  // ImageView offset and scale are measured in framebuffer pixels):
+  const float pixel_ratio = screen()->pixel_ratio();
+  Vector2i fb_size = size();
+  if (draw_border()) {
+    fb_size -= 2;
+  }
+  const Vector2f viewport = Vector2f(fb_size) * pixel_ratio;
+  const Vector2f top_left = offset();
+  const Vector2f bottom_right = top_left + Vector2f(image_size) * scale();
+
+  // Convert to normalised device coordinates (y axis points up):
+  return Vector4f(
+    2.f * top_left.x() / viewport.x() - 1.f,
+    1.f - 2.f * top_left.y() / viewport.y(),
+    2.f * bottom_right.x() / viewport.x() - 1.f,
+    1.f - 2.f * bottom_right.y() / viewport.y());
+}
+
+void YuvImageView::draw_hdr() {
+  m_hdr_shader->set_uniform("image_rect", image_rect(image()->size()));
+  m_hdr_shader->set_uniform("exposure_scale", m_exposure_scale);
+  m_hdr_shader->set_uniform("inv_gamma", m_inv_gamma);
+  m_hdr_shader->set_uniform("overlay", float(m_hdr_overlay));
+  m_hdr_shader->begin();
+  m_hdr_shader->draw_array(Shader::PrimitiveType::Triangle, 0, 6, false);
+  m_hdr_shader->end();
+}
+
+void YuvImageView::draw_contents() {
+  if (hdr_mode()) {
+    draw_hdr();
+    return;
+  }
+
+  if (!yuv_mode()) {
+    ImageView::draw_contents();
+    return;
+  }
+
+  m_yuv_shader->set_uniform("image_rect", image_rect(m_y_plane->size()));
+  m_yuv_shader->set_uniform("r_coeffs", to_vector(m_coefficients.r));
+  m_yuv_shader->set_uniform("g_coeffs", to_vector(m_coefficients.g));
+  m_yuv_shader->set_uniform("b_coeffs", to_vector(m_coefficients.b));
+  m_yuv_shader->begin();
+  m_yuv_shader->draw_array(Shader::PrimitiveType::Triangle, 0, 6, false);
+  m_yuv_shader->end();
+}
+
+std::pair<Vector2i, Vector2i> YuvImageView::selection() const {
+  const Vector2i image_size = image() ? image()->size() : Vector2i(0);
+  const Vector2f lo(std::min(m_selection_start.x(), m_selection_end.x()),
+                    std::min(m_selection_start.y(), m_selection_end.y()));
+  const Vector2f hi(std::max(m_selection_start.x(), m_selection_end.x()),
+                    std::max(m_selection_start.y(), m_selection_end.y()));
+  const Vector2i top_left(std::clamp(int(std::floor(lo.x())), 0, image_size.x()),
+                          std::clamp(int(std::floor(lo.y())), 0, image_size.y()));
+  const Vector2i bottom_right(std::clamp(int(std::ceil(hi.x())), 0, image_size.x()),
+                              std::clamp(int(std::ceil(hi.y())), 0, image_size.y()));
+  return {top_left, bottom_right - top_left};
+}
+
+bool YuvImageView::mouse_button_event(const Vector2i &p, int button, bool down, int modifiers) {
+  if (button == GLFW_MOUSE_BUTTON_1 && down && (modifiers & GLFW_MOD_SHIFT) && image()) {
+    // Event positions are relative to the parent:
+    m_selection_start = m_selection_end = pos_to_pixel(Vector2f(p - m_pos));
+    m_selecting = true;
+    m_has_selection = false;
+    return true;
+  }
+  if (button == GLFW_MOUSE_BUTTON_1 && !down && m_selecting) {
+    m_selecting = false;
+    const auto region = selection();
+    m_has_selection = region.second.x() > 0 && region.second.y() > 0;
+    if (m_selection_callback) {
+      m_selection_callback(region.first, m_has_selection ? region.second : Vector2i(0));
+    }
+    return true;
+  }
+  return ImageView::mouse_button_event(p, button, down, modifiers);
+}
+
+bool YuvImageView::mouse_drag_event(const Vector2i &p, const Vector2i &rel, int button, int modifiers) {
+  if (m_selecting) {
+    m_selection_end = pos_to_pixel(Vector2f(p - m_pos));
+    m_has_selection = true;
+    return true;
+  }
+  return ImageView::mouse_drag_event(p, rel, button, modifiers);
+}
+
+void YuvImageView::draw(NVGcontext *ctx) {
+  ImageView::draw(ctx);
+  if (!m_has_selection) {
+    return;
+  }
+
+  const auto region = selection();
+  const Vector2f top_left = pixel_to_pos(Vector2f(region.first)) + Vector2f(m_pos);
+  const Vector2f size = pixel_to_pos(Vector2f(region.first + region.second)) + Vector2f(m_pos) - top_left;
+  nvgSave(ctx);
+  nvgIntersectScissor(ctx, m_pos.x(), m_pos.y(), m_size.x(), m_size.y());
+  nvgBeginPath(ctx);
+  nvgRect(ctx, top_left.x(), top_left.y(), size.x(), size.y());
+  nvgStrokeColor(ctx, Color(255, 255, 0, 220));
+  nvgStrokeWidth(ctx, 1.5f);
+  nvgStroke(ctx);
+  nvgRestore(ctx);
+}
@@ -0,0 +1,131 @@
+/*
+    NanoGUI was developed by Wenzel Jakob <wenzel.jakob@epfl.ch>.
+    The widget drawing code is based on the NanoVG demo application
+    by Mikko Mononen.
+
+    All rights reserved. Use of this source code is governed by a
+    BSD-style license that can be found in the LICENSE.txt file.
+*/
+/**
+ * An ImageView that can display planar YUV 4:2:0 images by converting
+ * them to RGB in a fragment shader.
+ *
+ * It can also display a raw HDR (float RGB) image in place of the video
+ * with exposure, gamma and an optional diagnostic overlay applied in a
+ * shader so that tone-mapping changes take effect without a round trip
+ * to the server.
+ *
+ * Shift-dragging selects a rectangle of the image (e.g. to compute the
+ * statistics of a region) instead of panning.
+ */
+
+#pragma once
+
+#include <nanogui/imageview.h>
+#include <nanogui/shader.h>
+#include <nanogui/texture.h>
+
+#include "../VideoDecoder.hpp"
+
+#include <functional>
+#include <vector>
+
+class YuvImageView : public nanogui::ImageView {
+public:
+    /// Diagnostic overlays for the HDR display.
+    enum class HdrOverlay {
+        None,
+        Clipping,   ///< Clipped highlights magenta, crushed shadows blue.
+        FalseColour ///< Luminance from -8 to +4 stops as a colour ramp.
+    };
+
+    YuvImageView(nanogui::Widget *parent);
+
+    /**
+     * Switch the view to YUV mode and allocate the plane textures.
+     *
+     * \param size
+     *     Size of the luma plane in pixels. The chroma planes are
+     *     half the size in each dimension (rounded up).
+     *
+     * The luma texture is also set as the ImageView's image so that
+     * panning/zooming and pixel callbacks behave as they do for RGB.
+     */
+    void set_yuv_size(const nanogui::Vector2i &size);
+
+    /// Upload tightly packed Y, U and V planes to the textures.
+    void upload_yuv(const uint8_t *y, const uint8_t *u, const uint8_t *v);
+
+    /// Set the colour conversion used by the shader.
+    void set_yuv_coefficients(const YuvToRgbCoefficients &coefficients);
+
+    /**
+     * Upload a packed RGB float image (top row first) for the HDR display.
+     * The image is stretched over the current video image so should have
+     * the same aspect ratio.
+     */
+    void set_hdr_image(const float *rgb, const nanogui::Vector2i &size);
+
+    /// Display the HDR image instead of the video (if one has been set).
+    void set_hdr_enabled(bool enabled) { m_hdr_enabled = enabled; }
+
+    /// True if the HDR image is being displayed.
+    bool hdr_mode() const { return m_hdr_enabled && m_hdr_image.get() != nullptr && image() != nullptr; }
+
+    /**
+     * Set the tone-mapping applied to the HDR image: pixels are scaled by
+     * 2^exposure then raised to the power 1/gamma (as done by the server).
+     */
+    void set_hdr_tone_map(float exposure, float gamma);
+
+    void set_hdr_overlay(HdrOverlay overlay) { m_hdr_overlay = overlay; }
+
+    /**
+     * Set a function called with the selected region (top left and size
+     * in image pixels) when a shift-drag finishes. A shift-click without
+     * dragging clears the selection and reports an empty region.
+     */
+    using SelectionCallback = std::function<void(const nanogui::Vector2i &, const nanogui::Vector2i &)>;
+    void set_selection_callback(const SelectionCallback &callback) { m_selection_callback = callback; }
+
+    /// True if the view is displaying YUV planes.
+    bool yuv_mode() const { return m_y_plane.get() != nullptr; }
+
+    /// Draws the image (in YUV mode) or defers to ImageView (in RGB mode).
+    virtual void draw_contents() override;
+
+    /// Draws the view then the selection rectangle (if any).
+    virtual void draw(NVGcontext *ctx) override;
+
+    virtual bool mouse_button_event(const nanogui::Vector2i &p, int button, bool down,
+                                    int modifiers) override;
+    virtual bool mouse_drag_event(const nanogui::Vector2i &p, const nanogui::Vector2i &rel,
+                                  int button, int modifiers) override;
+
+private:
+    /// Position of the image in normalised device coordinates.
+    nanogui::Vector4f image_rect(const nanogui::Vector2i &image_size) const;
+    void draw_hdr();
+    /// Selected region clamped to the image as (top left, size).
+    std::pair<nanogui::Vector2i, nanogui::Vector2i> selection() const;
+
+    nanogui::ref<nanogui::Texture> m_y_plane;
+    nanogui::ref<nanogui::Texture> m_u_plane;
+    nanogui::ref<nanogui::Texture> m_v_plane;
+    nanogui::ref<nanogui::Shader> m_yuv_shader;
+    YuvToRgbCoefficients m_coefficients;
+
+    nanogui::ref<nanogui::Texture> m_hdr_image;
+    nanogui::ref<nanogui::Shader> m_hdr_shader;
+    std::vector<float> m_hdr_rgba; // Used if float textures have an alpha channel.
+    bool m_hdr_enabled;
+    float m_exposure_scale;
+    float m_inv_gamma;
+    HdrOverlay m_hdr_overlay;
+
+    SelectionCallback m_selection_callback;
+    bool m_selecting;
+    bool m_has_selection;
+    nanogui::Vector2f m_selection_start; // In image pixels.
+    nanogui::Vector2f m_selection_end;
+};
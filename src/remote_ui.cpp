@@ -3,13 +3,13 @@
 #include <nanogui/nanogui.h>
 
 #include <PacketComms.h>
-#include <network/TcpSocket.h>
 
 #include <chrono>
 #include <iostream>
 #include <map>
 #include <mutex>
 #include <thread>
+#include <vector>
 
 #include <boost/log/core.hpp>
 #include <boost/log/expressions.hpp>
@@ -18,8 +18,13 @@
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 
+#include "BufferPool.hpp"
+#include "CaptureReplayServer.hpp"
+#include "ConnectionManager.hpp"
 #include "ControlsForm.hpp"
+#include "PacketCapture.hpp"
 #include "RenderClientApp.hpp"
+#include "ThreadSettings.hpp"
 #include "VideoPreviewWindow.hpp"
 #include "PacketDescriptions.hpp"
 
@@ -30,10 +35,45 @@ boost::program_options::options_description getOptions() {
   ("help", "Show command help.")
   ("port", po::value<int>()->default_value(3000), "Port number to connect on.")
   ("host", po::value<std::string>()->default_value("localhost"), "Host to connect to.")
+  ("server", po::value<std::vector<std::string>>()->composing(), "Connect to a render server given as host:port[:hdr-port]. Repeat to view several servers side by side (--host, --port and --hdr-port are then ignored).")
+  ("hdr-port", po::value<int>()->default_value(0), "If non-zero receive bulk HDR data over a second connection to this port so that it can not delay video and control packets (the server must support it).")
   ("log-level", po::value<std::string>()->default_value("info"), "Set the log level to one of the following: 'trace', 'debug', 'info', 'warn', 'err', 'critical', 'off'.")
   ("nif-paths", po::value<std::string>()->default_value(""), "JSON file containing a mapping from menu names to paths to NIF models on the remote. Used to build the NIF selection menu.")
   ("width,w", po::value<int>()->default_value(1320), "Main window width in pixels.")
-  ("height,h", po::value<int>()->default_value(800), "Main window height in pixels.");
+  ("height,h", po::value<int>()->default_value(800), "Main window height in pixels.")
+  ("redraw-rate", po::value<double>()->default_value(0.0), "Redraw the UI at this fixed rate (Hz). Zero only redraws when a new video frame is ready, on input and for periodic status updates (which uses far less CPU and GPU when idle).")
+  ("cpu-colour-conversion", po::bool_switch()->default_value(false), "Convert decoded video frames to RGB on the CPU instead of in a shader.")
+  ("hwdecode", po::value<std::string>()->default_value(""), "Decode video in hardware using one of: 'vaapi', 'videotoolbox', 'nvdec' or 'auto'. Falls back to software decode if unavailable.")
+  ("huge-pages", po::bool_switch()->default_value(false), "Back large frame and HDR image buffers with transparent huge pages where available.")
+  ("buffer-cache-mb", po::value<std::size_t>()->default_value(BufferPool::defaultCacheLimit >> 20), "Maximum size (MiB) of freed frame and HDR image buffers kept for reuse.")
+  ("decode-threads", po::value<int>()->default_value(1), "Number of video decoding threads (zero uses one per core).")
+  ("low-latency", po::bool_switch()->default_value(false), "Minimise video buffering and skip non-reference frames when decoding falls behind.")
+  ("low-latency-skip-depth", po::value<std::size_t>()->default_value(16), "In low-latency mode skip non-reference frames while more than this many video packets are queued.")
+  ("udp-video", po::bool_switch()->default_value(false), "Receive the preview video over UDP so that packet loss does not stall the stream (the server must support it). Controls stay on TCP.")
+  ("udp-video-port", po::value<int>()->default_value(0), "Local port to receive UDP video on (zero picks a free port).")
+  ("udp-loss-timeout", po::value<int>()->default_value(150), "Milliseconds to wait for lost UDP video to be resent before skipping to the next key-frame.")
+  ("control-rate", po::value<double>()->default_value(0.0), "Maximum rate (Hz) at which control changes are sent to the server while dragging. Zero sends at most once per UI frame.")
+  ("camera-state-packets", po::bool_switch()->default_value(false), "Send render parameter changes as single batched 'camera_state' packets (the server must support them).")
+  ("hdr-capabilities", po::bool_switch()->default_value(false), "Advertise the compressed HDR encodings this client can decode in an 'hdr_capabilities' packet (the server must support it).")
+  ("stream-feedback", po::bool_switch()->default_value(false), "Send 'stream_feedback' statistics so the server can adapt the video bit-rate and ask for a key-frame after video was dropped (the server must support both).")
+  ("nif-prefetch", po::bool_switch()->default_value(false), "Send a 'nif_prefetch' hint with the next models in the menu after each model is loaded (the server must support it).")
+  ("hdr-region-requests", po::bool_switch()->default_value(false), "When raw HDR values are shown zoomed in ask for full precision data of the visible region with 'hdr_region_request' packets (the server must support them).")
+  ("no-reconnect", po::bool_switch()->default_value(false), "Do not try to reconnect if the connection to the server is lost.")
+  ("reconnect-max-delay", po::value<double>()->default_value(10.0), "Maximum time in seconds between reconnection attempts (the delay doubles after each failure).")
+  ("ui-cpus", po::value<std::string>()->default_value(""), "Pin the UI (GL) thread to these cores, e.g. '0' or '0,2-3'. An empty list allows any core the process may use.")
+  ("decode-cpus", po::value<std::string>()->default_value(""), "Pin the video decode threads to these cores.")
+  ("comms-cpus", po::value<std::string>()->default_value(""), "Pin the packet send and receive threads (including UDP video) to these cores.")
+  ("ui-priority", po::value<std::string>()->default_value("normal"), "Priority of the UI thread: 'normal', 'high' or 'realtime'. Raising priority needs permission (e.g. CAP_SYS_NICE or rtprio/nice limits): if real-time is not allowed high is tried instead.")
+  ("decode-priority", po::value<std::string>()->default_value("normal"), "Priority of the video decode threads (see --ui-priority).")
+  ("comms-priority", po::value<std::string>()->default_value("normal"), "Priority of the packet send and receive threads (see --ui-priority).")
+  ("telemetry-interval", po::value<double>()->default_value(1.0), "Seconds between telemetry samples (path and ray rates, video rate, frame rate, decode queue depth and progress). Press 'T' to show their graphs.")
+  ("telemetry-csv", po::value<std::string>()->default_value(""), "Append every telemetry sample to this CSV file (a header is written if it is new).")
+  ("telemetry-port", po::value<int>()->default_value(0), "If non-zero serve the latest telemetry in Prometheus text format over HTTP on this port.")
+  ("telemetry-address", po::value<std::string>()->default_value("127.0.0.1"), "Local address to serve telemetry on. Use '0.0.0.0' to allow scraping from other hosts.")
+  ("record", po::value<std::string>()->default_value(""), "Record every packet received from the (first) server to this capture file.")
+  ("replay", po::value<std::string>()->default_value(""), "Instead of connecting to a server replay a capture file made with --record (served locally on --port).")
+  ("replay-speed", po::value<double>()->default_value(1.0), "Replay speed relative to the recording. Zero replays as fast as possible to measure throughput.")
+  ("replay-loop", po::bool_switch()->default_value(false), "Replay the capture file repeatedly.");
   return desc;
 }
 
@@ -52,6 +92,43 @@ parseOptions(int argc, char** argv, boost::program_options::options_description&
   return vm;
 }
 
+struct ServerAddress {
+  std::string host;
+  int port;
+  int hdrPort;
+};
+
+/// Parse host:port[:hdr-port].
+ServerAddress parseServerAddress(const std::string& address) {
+  ServerAddress server{"", 0, 0};
+  std::stringstream ss(address);
+  std::string port;
+  std::string hdrPort;
+  std::getline(ss, server.host, ':');
+  std::getline(ss, port, ':');
+  std::getline(ss, hdrPort);
+  try {
+    server.port = std::stoi(port);
+    server.hdrPort = hdrPort.empty() ? 0 : std::stoi(hdrPort);
+  } catch (const std::logic_error&) {
+    server.port = 0;
+  }
+  if (server.host.empty() || server.port <= 0) {
+    throw std::runtime_error("Invalid server address '" + address + "' (expected host:port[:hdr-port])");
+  }
+  return server;
+}
+
+/// Get the settings for one of the thread groups ("ui", "decode" or "comms").
+ThreadSettings getThreadSettings(const boost::program_options::variables_map& args,
+                                 const std::string& group, const std::string& name) {
+  ThreadSettings settings;
+  settings.name = name;
+  settings.cpus = parseCpuList(args.at(group + "-cpus").as<std::string>());
+  settings.priority = parseThreadPriority(args.at(group + "-priority").as<std::string>());
+  return settings;
+}
+
 std::map<std::string, std::string>
 jsonFileToMap(const std::string& file) {
   std::map<std::string, std::string> m;
@@ -82,6 +159,9 @@ int main(int argc, char** argv) {
   ss >> level;
   logging::core::get()->set_filter(logging::trivial::severity >= level);
 
+  BufferPool::shared().setHugePages(args.at("huge-pages").as<bool>());
+  BufferPool::shared().setCacheLimit(args.at("buffer-cache-mb").as<std::size_t>() << 20);
+
   try {
     // Parse NIF description before attempting to connect:
     std::map<std::string, std::string> remoteNifModels;
@@ -95,37 +175,119 @@ int main(int argc, char** argv) {
 
     auto host = args.at("host").as<std::string>();
     auto port = args.at("port").as<int>();
-    auto socket = std::make_unique<TcpSocket>();
-    bool connected = socket->Connect(host.c_str(), port);
-    if (!connected) {
-      BOOST_LOG_TRIVIAL(info) << "Could not conect to server " << host << ":" << port;
-      throw std::runtime_error("Unable to connect");
+    ReconnectOptions reconnectOptions;
+    reconnectOptions.enabled = !args.at("no-reconnect").as<bool>();
+    reconnectOptions.maxDelay = std::chrono::milliseconds(
+        static_cast<std::int64_t>(1000 * args.at("reconnect-max-delay").as<double>()));
+    auto hdrPort = args.at("hdr-port").as<int>();
+    // The UI thread keeps the process name:
+    const auto uiThread = getThreadSettings(args, "ui", "");
+    const auto decodeThread = getThreadSettings(args, "decode", "rui-decode");
+    const auto commsThread = getThreadSettings(args, "comms", "rui-comms");
+
+    // Replay serves the capture on a local port in place of the render
+    // server so that the whole client runs exactly as it would live:
+    std::unique_ptr<CaptureReplayServer> replayServer;
+    const auto replayFile = args.at("replay").as<std::string>();
+    if (!replayFile.empty()) {
+      replayServer = std::make_unique<CaptureReplayServer>(
+          replayFile, port, args.at("replay-speed").as<double>(), args.at("replay-loop").as<bool>());
+      host = "localhost";
+      hdrPort = 0;
+      reconnectOptions.enabled = false;
     }
-    BOOST_LOG_TRIVIAL(info) << "Connected to server " << host << ":" << port;
 
-    auto sender = std::make_unique<PacketMuxer>(*socket, packets::packetTypes);
-    auto receiver = std::make_unique<PacketDemuxer>(*socket, packets::packetTypes);
+    std::unique_ptr<capture::PacketRecorder> recorder;
+    const auto recordFile = args.at("record").as<std::string>();
+    if (!recordFile.empty()) {
+      recorder = std::make_unique<capture::PacketRecorder>(recordFile);
+    }
 
+    // One connection per session:
+    std::vector<ServerAddress> servers;
+    if (args.count("server") && !replayServer) {
+      for (const auto& s : args.at("server").as<std::vector<std::string>>()) {
+        servers.push_back(parseServerAddress(s));
+      }
+    } else {
+      servers.push_back(ServerAddress{host, port, hdrPort});
+    }
+
+    std::vector<std::unique_ptr<ConnectionManager>> connections;
+    std::vector<SessionConnection> sessions;
+    for (const auto& server : servers) {
+      connections.push_back(std::make_unique<ConnectionManager>(server.host, server.port, server.hdrPort, reconnectOptions));
+      connections.back()->setCommsThreadSettings(commsThread);
+      if (!connections.back()->connect()) {
+        throw std::runtime_error("Unable to connect to " + server.host + ":" + std::to_string(server.port));
+      }
+      SessionConnection session;
+      if (servers.size() > 1) {
+        session.name = server.host + ":" + std::to_string(server.port);
+      }
+      session.connection = connections.back().get();
+      sessions.push_back(session);
+    }
+    sessions.front().recorder = recorder.get();
+
+    // Only now so that the replay server and connection threads
+    // started above do not inherit the UI thread's settings:
+    applyToCurrentThread(uiThread);
     nanogui::init();
 
     {
       const auto w = args.at("width").as<int>();
       const auto h = args.at("height").as<int>();
       nanogui::Vector2i screenSize(w, h);
-      RenderClientApp app(screenSize, *sender, *receiver);
+      VideoPreviewOptions videoOptions;
+      videoOptions.gpuColourConversion = !args.at("cpu-colour-conversion").as<bool>();
+      videoOptions.decoder.hwDevice = args.at("hwdecode").as<std::string>();
+      videoOptions.decoder.lowLatency = args.at("low-latency").as<bool>();
+      videoOptions.decoder.threads = args.at("decode-threads").as<int>();
+      videoOptions.frameSkipQueueDepth = args.at("low-latency-skip-depth").as<std::size_t>();
+      videoOptions.udp.enabled = args.at("udp-video").as<bool>() && !replayServer;
+      videoOptions.udp.port = args.at("udp-video-port").as<int>();
+      videoOptions.udp.lossTimeout = std::chrono::milliseconds(args.at("udp-loss-timeout").as<int>());
+      videoOptions.udp.receiveThread = commsThread;
+      videoOptions.udp.receiveThread.name = "rui-udp-rx";
+      videoOptions.decodeThread = decodeThread;
+      videoOptions.keyFrameRequests = args.at("stream-feedback").as<bool>();
+      ControlOptions controlOptions;
+      const auto controlRate = args.at("control-rate").as<double>();
+      if (controlRate > 0.0) {
+        controlOptions.minInterval = std::chrono::microseconds(static_cast<std::int64_t>(1e6 / controlRate));
+      }
+      controlOptions.cameraStatePackets = args.at("camera-state-packets").as<bool>();
+      controlOptions.hdrCapabilities = args.at("hdr-capabilities").as<bool>();
+      controlOptions.streamFeedback = args.at("stream-feedback").as<bool>();
+      controlOptions.nifPrefetch = args.at("nif-prefetch").as<bool>();
+      controlOptions.hdrRegionRequests = args.at("hdr-region-requests").as<bool>();
+      TelemetryOptions telemetryOptions;
+      const auto telemetryInterval = args.at("telemetry-interval").as<double>();
+      if (telemetryInterval <= 0.0) {
+        throw std::runtime_error("--telemetry-interval must be positive.");
+      }
+      telemetryOptions.interval = std::chrono::milliseconds(static_cast<std::int64_t>(1000 * telemetryInterval));
+      telemetryOptions.csvFile = args.at("telemetry-csv").as<std::string>();
+      telemetryOptions.metricsPort = args.at("telemetry-port").as<int>();
+      telemetryOptions.metricsAddress = args.at("telemetry-address").as<std::string>();
+      RenderClientApp app(screenSize, sessions, videoOptions, controlOptions, telemetryOptions);
       if (!remoteNifModels.empty()) {
         app.set_nif_selection(remoteNifModels);
       }
+      const auto redrawRate = args.at("redraw-rate").as<double>();
+      if (redrawRate <= 0.0) {
+        app.enableEventDrivenRedraw();
+      }
       app.draw_all();
       app.set_visible(true);
-      nanogui::mainloop(1 / 60.f * 1000);
+      nanogui::mainloop(redrawRate > 0.0 ? 1000.f / redrawRate : -1.f);
     }
 
     nanogui::shutdown();
 
-    // Cleanly terminate the connection:
-    sender.reset();
-    socket.reset();
+    // Cleanly terminate the connections:
+    connections.clear();
 
   } catch (const std::runtime_error& e) {
     std::string error_msg = std::string("Error: ") + std::string(e.what());